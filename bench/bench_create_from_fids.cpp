@@ -0,0 +1,95 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Building results for a set of files, one createFromFid per file against
+// one batched createFromFids, both with cached statements. Sets of 5 are
+// what local's fuzzy search reports, 1000 is a big boffin RQL result.
+// Checks the two give the same items.
+//
+//   bench_create_from_fids collection.db [fids per set] [sets]
+
+#include "resolved_item_builder.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using namespace std;
+using namespace playdar;
+
+static double now_ms()
+{
+    static const boost::posix_time::ptime epoch( boost::gregorian::date(2000,1,1) );
+    return ( boost::posix_time::microsec_clock::universal_time() - epoch ).total_microseconds() / 1000.0;
+}
+
+int main( int argc, char** argv )
+{
+    if( argc < 2 )
+    {
+        cerr << "usage: " << argv[0] << " collection.db [fids per set] [sets]" << endl;
+        return 1;
+    }
+    sqlite3pp::database db( argv[1] );
+    utils::stmt_cache cache( db );
+    int per = argc > 2 ? atoi( argv[2] ) : 5;
+    int sets = argc > 3 ? atoi( argv[3] ) : 200;
+
+    int maxid;
+    {
+        sqlite3pp::query q( db, "SELECT max(id) FROM file" );
+        maxid = (*q.begin()).get<int>(0);
+    }
+    if( maxid < 1 ) maxid = 1;
+
+    srand( 7 );
+    vector< vector<int> > fids( sets );
+    for( int s = 0; s < sets; ++s )
+        for( int k = 0; k < per; ++k )
+            fids[s].push_back( 1 + rand() % maxid );
+
+    vector< vector<json_spirit::Object> > one( sets ), batched( sets );
+    size_t found_one = 0, found_batched = 0;
+    double t = now_ms();
+    for( int s = 0; s < sets; ++s )
+        for( int k = 0; k < per; ++k )
+        {
+            json_spirit::Object o;
+            if( ResolvedItemBuilder::createFromFid( cache, fids[s][k], o ) ) ++found_one;
+            one[s].push_back( o );
+        }
+    double a = now_ms() - t;
+
+    t = now_ms();
+    for( int s = 0; s < sets; ++s )
+        found_batched += ResolvedItemBuilder::createFromFids( cache, fids[s], batched[s] );
+    double b = now_ms() - t;
+
+    bool same = true;
+    for( int s = 0; s < sets; ++s )
+        if( one[s] != batched[s] ) same = false;
+
+    cout << sets << " sets of " << per << " fids" << endl
+         << "createFromFid each   " << a / sets << " ms/set" << endl
+         << "createFromFids       " << b / sets << " ms/set" << endl
+         << "found " << found_one << " / " << found_batched
+         << ( same ? ", same items" : ", ITEMS DIFFER" ) << endl;
+    return same ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The resolver's dispatch pool, utils::work_queues, with synthetic pipeline
+// steps: a few producer threads dispatch queries, each step burns some cpu
+// (what run_pipeline and a plugin's start_resolving cost) and queues the
+// query's next tier, keyed by qid like the resolver does. Prints steps per
+// second for each number of dispatch threads, and checks every step ran
+// exactly once.
+//
+//   bench_dispatch [queries] [tiers] [us per step] [threads...]
+//
+// threads defaults to 1, 2, 4 .. up to twice the number of cores.
+
+#include "playdar/utils/work_queues.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+using namespace playdar::utils;
+
+// query number, and its tier
+typedef pair<size_t, unsigned int> step_t;
+
+struct pool
+{
+    pool( size_t nthreads, size_t nqueries, unsigned int tiers, unsigned int us )
+        : q( nthreads ), done( nqueries, 0 ), tiers( tiers ), us( us ), 
+          remaining( nqueries * tiers )
+    {}
+
+    work_queues< step_t > q;
+    vector< unsigned int > done; // steps run, per query
+    boost::mutex mut;            // protects done and remaining
+    boost::condition finished;
+    unsigned int tiers, us;
+    size_t remaining;
+};
+
+static volatile unsigned int sink;
+static double iters_per_us = 300; // see calibrate
+
+static void spin( unsigned long n )
+{
+    unsigned int x = 1;
+    for( unsigned long i = 0; i < n; ++i ) x = x * 1664525u + 1013904223u;
+    sink = x;
+}
+
+static void burn( unsigned int us )
+{
+    spin( (unsigned long)( us * iters_per_us ) );
+}
+
+static void calibrate()
+{
+    const unsigned long n = 50000000;
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    spin( n );
+    long us = ( boost::posix_time::microsec_clock::universal_time() - start ).total_microseconds();
+    if( us > 0 ) iters_per_us = (double) n / us;
+}
+
+static void worker( pool* p, size_t idx )
+{
+    step_t s;
+    while( p->q.take( idx, s ) )
+    {
+        burn( p->us );
+        if( s.second + 1 < p->tiers ) 
+            p->q.push( s.first * 2654435761u, step_t( s.first, s.second + 1 ) );
+        boost::mutex::scoped_lock lk( p->mut );
+        ++p->done[ s.first ];
+        if( --p->remaining == 0 ) p->finished.notify_all();
+    }
+}
+
+static void producer( pool* p, size_t from, size_t step )
+{
+    for( size_t i = from; i < p->done.size(); i += step )
+        p->q.push( i * 2654435761u, step_t( i, 0 ) );
+}
+
+int main( int argc, char** argv )
+{
+    size_t nqueries = argc > 1 ? atoi( argv[1] ) : 200000;
+    unsigned int tiers = argc > 2 ? atoi( argv[2] ) : 3;
+    unsigned int us = argc > 3 ? atoi( argv[3] ) : 20;
+    if( tiers == 0 ) tiers = 1;
+    vector< size_t > threads;
+    for( int i = 4; i < argc; ++i ) threads.push_back( atoi( argv[i] ) );
+    size_t cores = boost::thread::hardware_concurrency();
+    if( threads.empty() )
+        for( size_t n = 1; n <= 2 * ( cores ? cores : 1 ); n *= 2 ) threads.push_back( n );
+
+    calibrate();
+    cout << cores << " cores, " << nqueries << " queries x " << tiers 
+         << " tiers, ~" << us << "us a step" << endl;
+    int failures = 0;
+    for( size_t t = 0; t < threads.size(); ++t )
+    {
+        size_t n = threads[t] ? threads[t] : 1;
+        pool p( n, nqueries, tiers, us );
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+        boost::thread_group workers, producers;
+        for( size_t i = 0; i < n; ++i )
+            workers.create_thread( boost::bind( &worker, &p, i ) );
+        const size_t nproducers = 4;
+        for( size_t i = 0; i < nproducers; ++i )
+            producers.create_thread( boost::bind( &producer, &p, i, nproducers ) );
+        producers.join_all();
+        {
+            boost::mutex::scoped_lock lk( p.mut );
+            while( p.remaining ) p.finished.wait( lk );
+        }
+        double ms = ( boost::posix_time::microsec_clock::universal_time() - start ).total_microseconds() / 1000.0;
+        p.q.shutdown();
+        workers.join_all();
+
+        size_t wrong = 0;
+        for( size_t i = 0; i < p.done.size(); ++i ) if( p.done[i] != tiers ) ++wrong;
+        if( wrong || p.q.pending() ) ++failures;
+        cout << n << " dispatch threads: " << ms << " ms, " 
+             << nqueries * tiers / ms * 1000 << " steps/s"
+             << ( wrong ? ", QUERIES WITH MISSING OR REPEATED STEPS" : "" ) << endl;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The local resolver's fuzzy search, through the SQL ngram index and
+// through MemoryIndex. Queries are random tracks from the library, with a
+// transposed pair of letters in about half the names, and each goes through
+// the same artists-then-tracks flow as local::find_candidates.
+//
+//   bench_memory_index collection.db [queries]
+//
+// make a library to run it on with gen_library.py.
+
+#include "library.h"
+#include "memory_index.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using namespace std;
+using namespace playdar;
+
+static double now_us()
+{
+    static const boost::posix_time::ptime epoch( boost::gregorian::date(2000,1,1) );
+    return ( boost::posix_time::microsec_clock::universal_time() - epoch ).total_microseconds();
+}
+
+static string typo( string s )
+{
+    if( s.size() > 4 && rand() % 2 )
+    {
+        size_t p = rand() % ( s.size() - 1 );
+        swap( s[p], s[p+1] );
+    }
+    return s;
+}
+
+int main( int argc, char** argv )
+{
+    if( argc < 2 )
+    {
+        cerr << "usage: " << argv[0] << " collection.db [queries]" << endl;
+        return 1;
+    }
+    int nq = argc > 2 ? atoi( argv[2] ) : 300;
+    Library lib( argv[1] );
+
+    double t = now_us();
+    MemoryIndex mi;
+    mi.build( lib.db() );
+    cout << "index built in " << ( now_us() - t ) / 1e6 << "s, "
+         << mi.footprint() / 1024 / 1024 << "MB" << endl;
+
+    srand( 3 );
+    vector< pair<string, string> > qs;
+    vector< int > want;
+    {
+        sqlite3pp::query q( lib.db(),
+            "SELECT artist.name, track.name, track.id FROM track, artist "
+            "WHERE artist.id = track.artist ORDER BY random() LIMIT ?" );
+        q.bind( 1, nq );
+        for( sqlite3pp::query::iterator i = q.begin(); i != q.end(); ++i )
+        {
+            string artist = typo( (*i).get<string>(0) );
+            string track = typo( (*i).get<string>(1) );
+            qs.push_back( make_pair( artist, track ) );
+            want.push_back( (*i).get<int>(2) );
+        }
+    }
+    if( qs.empty() )
+    {
+        cerr << "no tracks in " << argv[1] << endl;
+        return 1;
+    }
+
+    vector< double > sql, mem;
+    int right_sql = 0, right_mem = 0, same_top = 0;
+    for( size_t k = 0; k < qs.size(); ++k )
+    {
+        int top_sql = -1, top_mem = -1;
+
+        double a = now_us();
+        vector< scorepair > artists = lib.search_catalogue( "artist", qs[k].first );
+        for( size_t i = 0; i < artists.size(); ++i )
+        {
+            vector< scorepair > tracks =
+                lib.search_catalogue_for_artist( artists[i].id, "track", qs[k].second );
+            if( i == 0 && tracks.size() ) top_sql = tracks[0].id;
+        }
+        double b = now_us();
+        artists = mi.search_artists( qs[k].first );
+        for( size_t i = 0; i < artists.size(); ++i )
+        {
+            vector< scorepair > tracks = mi.search_artist_tracks( artists[i].id, qs[k].second );
+            if( i == 0 && tracks.size() ) top_mem = tracks[0].id;
+        }
+        double c = now_us();
+
+        sql.push_back( b - a );
+        mem.push_back( c - b );
+        same_top += top_sql == top_mem;
+        right_sql += top_sql == want[k];
+        right_mem += top_mem == want[k];
+    }
+
+    sort( sql.begin(), sql.end() );
+    sort( mem.begin(), mem.end() );
+    size_t m = sql.size();
+    cout << m << " queries" << endl
+         << "sql     p50 " << sql[m/2] / 1000 << "ms  p99 " << sql[m*99/100] / 1000 << "ms" << endl
+         << "memory  p50 " << mem[m/2] / 1000 << "ms  p99 " << mem[m*99/100] / 1000 << "ms" << endl
+         << "same top candidate " << same_top << "/" << m << endl
+         << "right track first: sql " << right_sql << ", memory " << right_mem << endl;
+    return 0;
+}
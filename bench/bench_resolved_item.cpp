@@ -0,0 +1,114 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// ResolvedItem costs: ranking results, serializing them, and their size.
+// Only uses the public API, so it builds against older revisions of
+// resolved_item.h too; the output checksum should match between them.
+//
+//   bench_resolved_item [items]
+
+#include "playdar/resolved_item.h"
+#include "json_spirit/json_spirit_writer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using namespace std;
+using namespace playdar;
+
+static double now_ms()
+{
+    static const boost::posix_time::ptime epoch( boost::gregorian::date(2000,1,1) );
+    return ( boost::posix_time::microsec_clock::universal_time() - epoch ).total_microseconds() / 1000.0;
+}
+
+// a typical result from the local resolver
+static ResolvedItem make( int i )
+{
+    ResolvedItem r;
+    ostringstream sid;
+    sid << "7D3B1A3E-0000-4000-8000-0000000000" << i % 100;
+    r.set_id( sid.str() );
+    r.set_json_value( "artist", string("Artist Name Here") );
+    r.set_json_value( "track", string("Some Track Title") );
+    r.set_json_value( "album", string("An Album") );
+    r.set_json_value( "bitrate", 192 );
+    r.set_json_value( "size", 5000000 + i );
+    r.set_json_value( "duration", 240 );
+    r.set_source( "somebody" );
+    r.set_url( "file:///music/a/b/c.mp3" );
+    r.set_json_value( "mimetype", string("audio/mpeg") );
+    r.set_score( ( i % 97 ) / 97.0 );
+    r.set_preference( i % 5 );
+    return r;
+}
+
+// what ResolverQuery ranks results on
+static bool sorter( const ResolvedItem* lhs, const ResolvedItem* rhs )
+{
+    if( lhs->score() == rhs->score() )
+        return lhs->preference() > rhs->preference();
+    return lhs->score() > rhs->score();
+}
+
+int main( int argc, char** argv )
+{
+    const int n = argc > 1 ? atoi( argv[1] ) : 100000;
+    const int rounds = 5;
+
+    vector< ResolvedItem > items;
+    for( int i = 0; i < n; ++i ) items.push_back( make( i ) );
+    vector< const ResolvedItem* > p;
+    for( int i = 0; i < n; ++i ) p.push_back( &items[i] );
+
+    srand( 1 );
+    double sorting = 0;
+    for( int r = 0; r < rounds; ++r )
+    {
+        for( int i = n - 1; i > 0; --i ) swap( p[i], p[ rand() % (i + 1) ] );
+        double t = now_ms();
+        stable_sort( p.begin(), p.end(), &sorter );
+        sorting += now_ms() - t;
+    }
+
+    // fnv-1a over everything written, to compare revisions:
+    unsigned int sum = 2166136261u;
+    size_t bytes = 0, json = 0;
+    double t = now_ms();
+    for( int i = 0; i < n; ++i )
+    {
+        string s = json_spirit::write( items[i].get_json() );
+        json += s.size();
+        for( size_t k = 0; k < s.size(); ++k ) sum = ( sum ^ (unsigned char)s[k] ) * 16777619u;
+    }
+    double writing = now_ms() - t;
+    for( int i = 0; i < n; ++i ) bytes += items[i].approx_bytes();
+
+    cout << n << " items" << endl
+         << "stable_sort on score/preference  " << sorting / rounds << " ms" << endl
+         << "get_json + write                 " << writing << " ms, "
+         << json / n << " bytes each, checksum " << hex << sum << dec << endl
+         << "approx_bytes per item            " << bytes / n << endl
+         << "sizeof(ResolvedItem)             " << sizeof(ResolvedItem) << endl;
+    return 0;
+}
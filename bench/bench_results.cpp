@@ -0,0 +1,147 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// A query being polled while its results come in: resolvers report
+// batches of results, and a client calls get_results a few times between
+// each. Compares ResolverQuery, which keeps its results sorted as they're
+// added, with what it did before: push_back, then sort everything and copy
+// it out on every results() call.
+//
+//   bench_results [results per query] [batch size] [polls per batch]
+
+#include "playdar/resolver_query.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using namespace std;
+using namespace playdar;
+
+static double now_ms()
+{
+    static const boost::posix_time::ptime epoch( boost::gregorian::date(2000,1,1) );
+    return ( boost::posix_time::microsec_clock::universal_time() - epoch ).total_microseconds() / 1000.0;
+}
+
+// the old ResolverQuery result handling
+class unsorted_results
+{
+public:
+    void add_results( const vector< ri_ptr >& v )
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        m_results.insert( m_results.end(), v.begin(), v.end() );
+    }
+    vector< ri_ptr > results()
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        sort( m_results.begin(), m_results.end(), &ResolverQuery::sorter );
+        return m_results;
+    }
+private:
+    boost::mutex m_mut;
+    vector< ri_ptr > m_results;
+};
+
+static ri_ptr make( int i )
+{
+    ri_ptr r( new ResolvedItem );
+    ostringstream sid;
+    sid << "7D3B1A3E-0000-4000-8000-" << i;
+    r->set_id( sid.str() );
+    r->set_json_value( "artist", string("Artist Name Here") );
+    r->set_json_value( "track", string("Some Track Title") );
+    r->set_json_value( "bitrate", 192 );
+    r->set_url( "file:///music/a/b/c.mp3" );
+    // only a few distinct scores, like real results; nothing solves it:
+    r->set_score( ( rand() % 20 ) / 21.0 );
+    r->set_preference( rand() % 5 );
+    return r;
+}
+
+int main( int argc, char** argv )
+{
+    size_t nres = argc > 1 ? atoi( argv[1] ) : 200;
+    size_t batch = argc > 2 ? atoi( argv[2] ) : 5;
+    size_t polls = argc > 3 ? atoi( argv[3] ) : 10;
+    const size_t queries = 200;
+    if( batch == 0 ) batch = 1;
+
+    srand( 1 );
+    vector< vector< ri_ptr > > batches;
+    for( size_t i = 0; i < nres; i += batch )
+    {
+        vector< ri_ptr > b;
+        for( size_t j = i; j < i + batch && j < nres; ++j ) b.push_back( make( j ) );
+        batches.push_back( b );
+    }
+
+    size_t sink = 0;
+    double t = now_ms();
+    for( size_t q = 0; q < queries; ++q )
+    {
+        unsorted_results rq;
+        for( size_t b = 0; b < batches.size(); ++b )
+        {
+            rq.add_results( batches[b] );
+            for( size_t p = 0; p < polls; ++p ) sink += rq.results().size();
+        }
+    }
+    double old_all = now_ms() - t;
+
+    double t_all = 0, t_top = 0;
+    bool same = true;
+    for( int pass = 0; pass < 2; ++pass )
+    {
+        t = now_ms();
+        for( size_t q = 0; q < queries; ++q )
+        {
+            ResolverQuery rq;
+            for( size_t b = 0; b < batches.size(); ++b )
+            {
+                rq.add_results( batches[b] );
+                for( size_t p = 0; p < polls; ++p )
+                    sink += pass ? rq.results( 1 ).size() : rq.results().size();
+            }
+            if( q == 0 && pass == 0 )
+            {
+                // same order as the old sort, give or take ties:
+                unsorted_results u;
+                for( size_t b = 0; b < batches.size(); ++b ) u.add_results( batches[b] );
+                vector< ri_ptr > a = rq.results(), o = u.results();
+                for( size_t i = 0; i < a.size(); ++i )
+                    if( ResolverQuery::sorter( a[i], o[i] ) || ResolverQuery::sorter( o[i], a[i] ) )
+                        same = false;
+            }
+        }
+        ( pass ? t_top : t_all ) = now_ms() - t;
+    }
+
+    size_t calls = queries * batches.size() * polls;
+    cout << nres << " results in batches of " << batch << ", " << polls
+         << " polls per batch, " << queries << " queries" << endl
+         << "sort per call, all results  " << old_all * 1000 / calls << " us/poll" << endl
+         << "kept sorted,   all results  " << t_all * 1000 / calls << " us/poll" << endl
+         << "kept sorted,   top result   " << t_top * 1000 / calls << " us/poll" << endl
+         << "same ranking " << same << " (" << sink << ")" << endl;
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// utils::sharded_map against the std::map behind one mutex that the
+// resolver used for its queries, sids and timers. Each thread does what a
+// query's life looks like to those maps: an insert, a run of lookups by
+// other threads' keys, then a take.
+//
+//   bench_sharded_map [threads] [ops per thread]
+
+#include "playdar/utils/sharded_map.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+using namespace playdar::utils;
+
+typedef boost::shared_ptr<int> val_t;
+
+class locked_map
+{
+public:
+    bool insert( const string& k, const val_t& v )
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        return m_map.insert( make_pair(k, v) ).second;
+    }
+    bool get( const string& k, val_t& out )
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        map<string, val_t>::iterator it = m_map.find( k );
+        if( it == m_map.end() ) return false;
+        out = it->second;
+        return true;
+    }
+    bool take( const string& k, val_t& out )
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        map<string, val_t>::iterator it = m_map.find( k );
+        if( it == m_map.end() ) return false;
+        out = it->second;
+        m_map.erase( it );
+        return true;
+    }
+private:
+    boost::mutex m_mut;
+    map<string, val_t> m_map;
+};
+
+static const size_t lookups = 8;   // get()s per insert/take pair
+static const size_t live = 64;     // keys each thread keeps in the map
+
+static string key( size_t t, size_t i )
+{
+    ostringstream os;
+    os << "8f14e45f-ceea-467a-9575-" << t << "-" << i;
+    return os.str();
+}
+
+template <class M>
+static void worker( M* m, size_t t, size_t nthreads, size_t ops, const vector< vector<string> >* keys, size_t* found )
+{
+    const vector<string>& mine = (*keys)[t];
+    size_t n = 0;
+    unsigned int seed = t + 1;
+    val_t v( new int(0) ), out;
+    for( size_t i = 0; i < ops; ++i )
+    {
+        m->insert( mine[i], v );
+        for( size_t j = 0; j < lookups; ++j )
+        {
+            const vector<string>& other = (*keys)[ rand_r(&seed) % nthreads ];
+            // one of the keys the other thread should have live about now:
+            size_t k = i - rand_r(&seed) % ( i < live ? i + 1 : live );
+            if( m->get( other[k], out ) ) ++n;
+        }
+        if( i >= live ) m->take( mine[i - live], out );
+    }
+    *found = n;
+}
+
+template <class M>
+static double run( size_t nthreads, size_t ops, const vector< vector<string> >& keys, size_t& found )
+{
+    M m;
+    vector<size_t> f( nthreads );
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    boost::thread_group tg;
+    for( size_t t = 0; t < nthreads; ++t )
+        tg.create_thread( boost::bind( &worker<M>, &m, t, nthreads, ops, &keys, &f[t] ) );
+    tg.join_all();
+    found = 0;
+    for( size_t t = 0; t < nthreads; ++t ) found += f[t];
+    return ( boost::posix_time::microsec_clock::universal_time() - start ).total_microseconds() / 1000.0;
+}
+
+int main( int argc, char** argv )
+{
+    size_t nthreads = argc > 1 ? atoi( argv[1] ) : boost::thread::hardware_concurrency();
+    size_t ops = argc > 2 ? atoi( argv[2] ) : 200000;
+    if( nthreads == 0 ) nthreads = 1;
+
+    vector< vector<string> > keys( nthreads );
+    for( size_t t = 0; t < nthreads; ++t )
+        for( size_t i = 0; i < ops; ++i )
+            keys[t].push_back( key( t, i ) );
+
+    size_t total = nthreads * ops * ( lookups + 2 );
+    cout << nthreads << " threads (" << boost::thread::hardware_concurrency()
+         << " cores), " << total << " operations" << endl;
+    for( int round = 0; round < 2; ++round ) // first round warms up
+    {
+        size_t f1, f2;
+        double a = run<locked_map>( nthreads, ops, keys, f1 );
+        double b = run< sharded_map<string, val_t> >( nthreads, ops, keys, f2 );
+        if( round == 0 ) continue;
+        cout << "map + mutex  " << a << " ms, " << total / a / 1000 << " Mops/s" << endl
+             << "sharded_map  " << b << " ms, " << total / b / 1000 << " Mops/s" << endl
+             << "lookups found " << f1 << " / " << f2 << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// One bound lookup at a time, the way Library's helpers do them: a fresh
+// sqlite3pp::query each call, against a statement borrowed from a
+// utils::stmt_cache. The SQL is Library's own.
+//
+//   bench_stmt_cache collection.db [calls]
+
+#include "sqlite3pp.h"
+#include "playdar/utils/stmt_cache.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using namespace std;
+using playdar::utils::stmt_cache;
+
+static double now_ms()
+{
+    static const boost::posix_time::ptime epoch( boost::gregorian::date(2000,1,1) );
+    return ( boost::posix_time::microsec_clock::universal_time() - epoch ).total_microseconds() / 1000.0;
+}
+
+static const char* names[] = { "load_artist", "get_fids_for_tid", "file_from_fid" };
+static const char* sqls[] = {
+    "SELECT id,name FROM artist WHERE id = ?",
+    "SELECT file.id FROM file, file_join WHERE file_join.file=file.id AND file_join.track = ? ORDER BY bitrate DESC",
+    "SELECT file.url, file.size, file.mimetype, file.duration, file.bitrate, "
+    "file_join.artist, file_join.album, file_join.track "
+    "FROM file, file_join "
+    "WHERE file.id = file_join.file AND file.id = ?"
+};
+static const char* maxids[] = {
+    "SELECT max(id) FROM artist", "SELECT max(id) FROM track", "SELECT max(id) FROM file"
+};
+
+int main( int argc, char** argv )
+{
+    if( argc < 2 )
+    {
+        cerr << "usage: " << argv[0] << " collection.db [calls]" << endl;
+        return 1;
+    }
+    sqlite3pp::database db( argv[1] );
+    int n = argc > 2 ? atoi( argv[2] ) : 50000;
+    stmt_cache cache( db );
+
+    long sink = 0;
+    for( int round = 0; round < 2; ++round ) // first round warms the page cache
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            int maxid;
+            {
+                sqlite3pp::query q( db, maxids[k] );
+                maxid = (*q.begin()).get<int>(0);
+            }
+            if( maxid < 1 ) maxid = 1;
+
+            srand( 1 );
+            double t = now_ms();
+            for( int i = 0; i < n; ++i )
+            {
+                sqlite3pp::query q( db, sqls[k] );
+                q.bind( 1, 1 + rand() % maxid );
+                for( sqlite3pp::query::iterator it = q.begin(); it != q.end(); ++it )
+                    sink += (*it).get<int>(0);
+            }
+            double fresh = now_ms() - t;
+
+            srand( 1 );
+            t = now_ms();
+            for( int i = 0; i < n; ++i )
+            {
+                stmt_cache::query q( cache, sqls[k] );
+                q->bind( 1, 1 + rand() % maxid );
+                for( sqlite3pp::query::iterator it = q->begin(); it != q->end(); ++it )
+                    sink += (*it).get<int>(0);
+            }
+            double cached = now_ms() - t;
+
+            if( round )
+                cout << names[k] << ": fresh " << fresh * 1000 / n
+                     << " us/call, cached " << cached * 1000 / n << " us/call" << endl;
+        }
+    }
+    cout << "prepared " << cache.prepared() << ", reused " << cache.reused()
+         << " (" << sink << ")" << endl;
+    return 0;
+}
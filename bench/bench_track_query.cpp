@@ -0,0 +1,95 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Query param lookups, the way scoring and the http handlers do them, and
+// what from_json/get_json_str/str() make of a few kinds of query. Only uses
+// the public API so it builds against older includes/ too; everything but
+// the timing line should be the same between revisions.
+//
+//   bench_track_query [iterations]
+
+#include "playdar/track_rq_builder.hpp"
+#include "json_spirit/json_spirit.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using namespace std;
+using namespace json_spirit;
+using namespace playdar;
+
+static double now_ms()
+{
+    static const boost::posix_time::ptime epoch( boost::gregorian::date(2000,1,1) );
+    return ( boost::posix_time::microsec_clock::universal_time() - epoch ).total_microseconds() / 1000.0;
+}
+
+int main( int argc, char** argv )
+{
+    const int n = argc > 1 ? atoi( argv[1] ) : 2000000;
+
+    vector< Object > objs( 4 );
+    // a track query from a script resolver:
+    objs[0].push_back( Pair("_msgtype", "rq") );
+    objs[0].push_back( Pair("qid", "q1") );
+    objs[0].push_back( Pair("artist", "Foo") );
+    objs[0].push_back( Pair("track", "Bar") );
+    objs[0].push_back( Pair("album", "Baz") );
+    objs[0].push_back( Pair("from_name", "x") );
+    // extra params either side of the typed ones, by name:
+    Array mimetypes;
+    mimetypes.push_back( "audio/mpeg" );
+    objs[1].push_back( Pair("qid", "q2") );
+    objs[1].push_back( Pair("artist", "Foo") );
+    objs[1].push_back( Pair("track", "Bar") );
+    objs[1].push_back( Pair("mimetypes", mimetypes) );
+    objs[1].push_back( Pair("aaa", 1) );
+    objs[1].push_back( Pair("bitrate", 3) );
+    objs[1].push_back( Pair("zz", true) );
+    // not a track query:
+    objs[2].push_back( Pair("qid", "q3") );
+    objs[2].push_back( Pair("boffin_tags", "*") );
+    // malformed:
+    objs[3].push_back( Pair("qid", "q4") );
+    objs[3].push_back( Pair("artist", "Foo") );
+    objs[3].push_back( Pair("track", 5) );
+
+    for( size_t k = 0; k < objs.size(); ++k )
+    {
+        rq_ptr rq = ResolverQuery::from_json( objs[k] );
+        cout << rq->get_json_str() << " | " << rq->str() << " | "
+             << rq->isValidTrack() << " " << rq->param_exists("album") << endl;
+    }
+    rq_ptr rq = TrackRQBuilder::build( "Artist", "Album", "Track" );
+    rq->set_id( "q5" );
+    cout << rq->get_json_str() << " | " << rq->str() << endl;
+
+    size_t sink = 0;
+    double t = now_ms();
+    for( int i = 0; i < n; ++i )
+    {
+        sink += rq->param("artist").get_str().size() + rq->param("track").get_str().size();
+        if( rq->param_exists("album") ) sink += rq->param("album").get_str().size();
+        sink += rq->isValidTrack();
+    }
+    cout << n << " lookups: " << now_ms() - t << " ms (" << sink << ")" << endl;
+    return 0;
+}
@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+#
+# Load test for the resolver's dispatch pool, against a running playdar.
+#
+#   dispatch_load.py [options] queries.txt
+#
+# --clients threads each loop over the queries (one "artist<TAB>track" per
+# line): resolve, poll get_results every --poll seconds until the query is
+# solved or --wait runs out, then cancel. Prints queries per second and the
+# time to the first result and to solved.
+#
+# Compare runs with resolver.dispatch_threads set to 1 and left unset, on a
+# machine with a few cores; the script resolvers in scripts/ and the lan
+# plugin make for a pipeline with more than one tier.
+#
+import sys, time, threading, optparse
+try:
+    import json
+except ImportError:
+    import simplejson as json
+try:
+    from urllib import urlencode
+    from urllib2 import urlopen
+except ImportError:
+    from urllib.parse import urlencode
+    from urllib.request import urlopen
+
+p = optparse.OptionParser(usage="%prog [options] queries.txt")
+p.add_option("--host", default="localhost")
+p.add_option("--port", type="int", default=8888)
+p.add_option("--auth", help="auth token, from /settings/auth_1/")
+p.add_option("--clients", type="int", default=16)
+p.add_option("--seconds", type="float", default=30.0, help="how long to run for")
+p.add_option("--wait", type="float", default=2.0, help="give up on a query after this long")
+p.add_option("--poll", type="float", default=0.02)
+opts, args = p.parse_args()
+if len(args) != 1 or not opts.auth:
+    p.error("need a queries file and --auth")
+
+base = "http://%s:%d" % (opts.host, opts.port)
+
+def api(**params):
+    params['auth'] = opts.auth
+    return json.loads(urlopen(base + "/api/?" + urlencode(params)).read().decode('utf-8'))
+
+queries = []
+for line in open(args[0]):
+    f = line.rstrip("\n").split("\t")
+    if len(f) >= 2 and f[0] and f[1]:
+        queries.append((f[0], f[1]))
+if not queries:
+    p.error("no queries in " + args[0])
+
+lock = threading.Lock()
+first, solved = [], []   # seconds from resolve
+done = [0]
+errors = [0]
+
+def client(n):
+    i = n
+    end = start + opts.seconds
+    while time.time() < end:
+        artist, track = queries[i % len(queries)]
+        i += opts.clients
+        try:
+            t0 = time.time()
+            qid = api(method='resolve', artist=artist, track=track)['qid']
+            t_first = t_solved = None
+            while time.time() - t0 < opts.wait:
+                r = api(method='get_results', qid=qid, limit=1)
+                if r['results'] and t_first is None:
+                    t_first = time.time() - t0
+                if r['query'].get('solved'):
+                    t_solved = time.time() - t0
+                    break
+                time.sleep(opts.poll)
+            api(method='cancel', qid=qid)
+        except Exception:
+            with lock:
+                errors[0] += 1
+            continue
+        with lock:
+            done[0] += 1
+            if t_first is not None: first.append(t_first)
+            if t_solved is not None: solved.append(t_solved)
+
+def pct(v, q):
+    if not v: return float('nan')
+    v = sorted(v)
+    return v[min(len(v) - 1, int(len(v) * q))] * 1000
+
+start = time.time()
+ts = [threading.Thread(target=client, args=(n,)) for n in range(opts.clients)]
+for t in ts: t.start()
+for t in ts: t.join()
+took = time.time() - start
+
+print("%d clients, %d queries in %.1fs: %.1f queries/s, %d errors"
+      % (opts.clients, done[0], took, done[0] / took, errors[0]))
+print("first result  %5d  p50 %7.1fms  p99 %7.1fms" % (len(first), pct(first, .5), pct(first, .99)))
+print("solved        %5d  p50 %7.1fms  p99 %7.1fms" % (len(solved), pct(solved, .5), pct(solved, .99)))
@@ -0,0 +1,82 @@
+#!/usr/bin/env python
+#
+# Makes a synthetic collection db for the local library benchmarks.
+#
+#   gen_library.py out.db artists tracks [schema.sql]
+#
+# Names are 1-4 made-up words from a small set of syllables, so there are
+# plenty of near misses for the fuzzy search. Each artist gets tracks/artists
+# tracks, each with one file. Fills in the ngram search index the way the
+# scanner does. Seeded, so the same arguments give the same library.
+#
+import sqlite3, random, sys, os
+
+if len(sys.argv) < 4:
+    sys.exit("usage: gen_library.py out.db artists tracks [schema.sql]")
+path = sys.argv[1]
+n_artists = int(sys.argv[2])
+n_tracks = int(sys.argv[3])
+schema = sys.argv[4] if len(sys.argv) > 4 else \
+    os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "etc", "schema.sql")
+
+random.seed(7)
+syllables = ("ka ri mo the lo ve zep pe lin ra dio head mu se blu ston ro ses sun "
+             "day mon key ar tic cold play bo wie pink floy d nir va na quee n smi "
+             "ths joy div is ion ne w or der ma ss ive at tack por tis head").split()
+words = set()
+while len(words) < 20000:
+    words.add("".join(random.choice(syllables) for _ in range(random.randint(1, 4))))
+words = sorted(words)
+
+def name(k):
+    return " ".join(random.choice(words) for _ in range(k))
+
+def ngrams(s):
+    s = " " + s + " "
+    m = {}
+    for i in range(len(s) - 2):
+        g = s[i:i+3]
+        m[g] = m.get(g, 0) + 1
+    return m
+
+if os.path.exists(path):
+    os.remove(path)
+db = sqlite3.connect(path)
+db.executescript(open(schema).read())
+
+seen = set()
+artists = []
+while len(artists) < n_artists:
+    a = name(random.randint(1, 3))
+    if a in seen:
+        continue
+    seen.add(a)
+    artists.append(a)
+db.executemany("INSERT INTO artist(id,name,sortname) VALUES(?,?,?)",
+               [(i + 1, a, a) for i, a in enumerate(artists)])
+db.executemany("INSERT INTO artist_search_index(ngram,id,num) VALUES(?,?,?)",
+               ((g, i + 1, c) for i, a in enumerate(artists) for g, c in ngrams(a).items()))
+
+per = max(1, n_tracks // n_artists)
+tid = 0
+tracks, index, files, joins = [], [], [], []
+for ai in range(n_artists):
+    titles = set()
+    for k in range(per):
+        t = name(random.randint(1, 4))
+        if t in titles:
+            continue
+        titles.add(t)
+        tid += 1
+        tracks.append((tid, ai + 1, t, t))
+        for g, c in ngrams(t).items():
+            index.append((g, tid, c))
+        files.append((tid, "file:///music/%d.mp3" % tid, 4000000 + tid, 1234567,
+                      "audio/mpeg", 200, 128))
+        joins.append((tid, ai + 1, tid, None))
+db.executemany("INSERT INTO track(id,artist,name,sortname) VALUES(?,?,?,?)", tracks)
+db.executemany("INSERT INTO track_search_index(ngram,id,num) VALUES(?,?,?)", index)
+db.executemany("INSERT INTO file(id,url,size,mtime,mimetype,duration,bitrate) VALUES(?,?,?,?,?,?,?)", files)
+db.executemany("INSERT INTO file_join(file,artist,track,album) VALUES(?,?,?,?)", joins)
+db.commit()
+print("%d artists, %d tracks, %d ngrams" % (n_artists, tid, len(index)))
@@ -33,14 +33,20 @@ while(!feof($in)){
     $rq = json_decode($msg);
     // TODO validation - was it valid json?
     $pis = get_matches($rq);
-    // don't reply with anything if there were no matches:
-    if(count($pis)==0) continue;
-    $res = new stdclass;
-    $res->_msgtype = "results";
-    $res->qid = $rq->qid;
-    $res->results = array();
-    $res->results = $pis;
-    send_reply( $res );
+    if(count($pis)){
+        $res = new stdclass;
+        $res->_msgtype = "results";
+        $res->qid = $rq->qid;
+        $res->results = array();
+        $res->results = $pis;
+        send_reply( $res );
+    }
+    // tell playdar we're finished with this query, so it doesn't 
+    // have to wait for our targettime before asking other resolvers:
+    $done = new stdclass;
+    $done->_msgtype = "done";
+    $done->qid = $rq->qid;
+    send_reply( $done );
 }
 
 // put a 4-byte big-endian int first, denoting length of message
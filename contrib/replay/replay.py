@@ -0,0 +1,83 @@
+#!/usr/bin/env python
+#
+# Replays a list of queries against a running playdar, and prints what the
+# resolver counters in /stats did meanwhile.
+#
+#   replay.py [options] queries.txt
+#
+# queries.txt has one "artist<TAB>track" per line, a log of real traffic
+# ideally. Queries go at --rate per second, each given --wait seconds to
+# find results before the next batch goes out; they're cancelled after.
+#
+import sys, time, optparse
+try:
+    import json
+except ImportError:
+    import simplejson as json
+try:
+    from urllib import urlencode
+    from urllib2 import urlopen
+except ImportError:
+    from urllib.parse import urlencode
+    from urllib.request import urlopen
+
+p = optparse.OptionParser(usage="%prog [options] queries.txt")
+p.add_option("--host", default="localhost")
+p.add_option("--port", type="int", default=8888)
+p.add_option("--auth", help="auth token, from /settings/auth_1/")
+p.add_option("--rate", type="float", default=10.0, help="queries per second")
+p.add_option("--wait", type="float", default=5.0, help="seconds before cancelling each query")
+p.add_option("--hedge", action="store_true", help="ask for hedged dispatch")
+opts, args = p.parse_args()
+if len(args) != 1 or not opts.auth:
+    p.error("need a queries file and --auth")
+
+base = "http://%s:%d" % (opts.host, opts.port)
+
+def api(**params):
+    params['auth'] = opts.auth
+    return json.loads(urlopen(base + "/api/?" + urlencode(params)).read().decode('utf-8'))
+
+def stats():
+    return json.loads(urlopen(base + "/stats").read().decode('utf-8'))
+
+queries = []
+for line in open(args[0]):
+    f = line.rstrip("\n").split("\t")
+    if len(f) >= 2 and f[0] and f[1]:
+        queries.append((f[0], f[1]))
+
+before = stats()
+start = time.time()
+live = []   # (qid, cancel at)
+solved = 0
+for i, (artist, track) in enumerate(queries):
+    params = { 'method': 'resolve', 'artist': artist, 'track': track }
+    if opts.hedge:
+        params['hedge'] = '1'
+    live.append((api(**params)['qid'], time.time() + opts.wait))
+    # keep to the rate, cancelling what's had its time meanwhile:
+    while True:
+        now = time.time()
+        while live and live[0][1] <= now:
+            qid = live.pop(0)[0]
+            r = api(method='get_results', qid=qid)
+            if r['query'].get('solved'):
+                solved += 1
+            api(method='cancel', qid=qid)
+        if now >= start + (i + 1) / opts.rate:
+            break
+        time.sleep(min(0.05, start + (i + 1) / opts.rate - now))
+for qid, at in live:
+    time.sleep(max(0, at - time.time()))
+    r = api(method='get_results', qid=qid)
+    if r['query'].get('solved'):
+        solved += 1
+    api(method='cancel', qid=qid)
+after = stats()
+
+print("%d queries in %.1fs, %d solved" % (len(queries), time.time() - start, solved))
+for k in ('solved', 'work_skipped', 'hedged_dispatches', 'hedged_cancels',
+          'tiers_done_early', 'tiers_timed_out'):
+    print("%-20s %d" % (k, after.get(k, 0) - before.get(k, 0)))
+print("script resolvers log their own counts to playdar's stderr")
@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+#
+# A script resolver that stands in for one doing slow outbound lookups
+# (a web service, say), for measuring what "cancel" messages save.
+#
+# Queries are queued and looked up one at a time, each lookup spending
+# SLOW_CPU seconds of cpu (building/parsing), sleeping SLOW_LATENCY seconds
+# and counting SLOW_BYTES bytes of outbound traffic.
+# A cancel for a query that's still queued drops it. Counts go to stderr,
+# which playdar logs, after every lookup and at exit.
+#
+# Environment:
+#   SLOW_LATENCY        seconds per lookup, default 0.5
+#   SLOW_CPU            cpu seconds per lookup, default 0.01
+#   SLOW_BYTES          outbound bytes per lookup, default 2048
+#   SLOW_WEIGHT         resolver weight, default 50
+#   SLOW_IGNORE_CANCEL  set to 1 to ignore cancels, for a baseline
+#
+import os, sys, time, threading
+from struct import pack, unpack
+try:
+    import json
+except ImportError:
+    import simplejson as json
+
+latency = float(os.environ.get('SLOW_LATENCY', '0.5'))
+cpu = float(os.environ.get('SLOW_CPU', '0.01'))
+nbytes = int(os.environ.get('SLOW_BYTES', '2048'))
+weight = int(os.environ.get('SLOW_WEIGHT', '50'))
+ignore_cancel = os.environ.get('SLOW_IGNORE_CANCEL', '') == '1'
+
+stdin = getattr(sys.stdin, 'buffer', sys.stdin)
+stdout = getattr(sys.stdout, 'buffer', sys.stdout)
+out_lock = threading.Lock()
+
+def send(o):
+    s = json.dumps(o).encode('utf-8')
+    out_lock.acquire()
+    try:
+        stdout.write(pack('!L', len(s)))
+        stdout.write(s)
+        stdout.flush()
+    finally:
+        out_lock.release()
+
+cond = threading.Condition()
+queue = []          # queries waiting for a lookup
+cancelled = set()   # qids cancelled while queued
+counts = { 'queries': 0, 'cancels': 0, 'lookups': 0, 'skipped': 0, 'bytes': 0 }
+done_reading = [False]
+
+def report():
+    t = os.times()
+    sys.stderr.write("lookups %d skipped %d of %d queries, %d cancels, %d bytes out, %.2fs cpu\n" %
+                     (counts['lookups'], counts['skipped'], counts['queries'],
+                      counts['cancels'], counts['bytes'], t[0] + t[1]))
+    sys.stderr.flush()
+
+def worker():
+    while True:
+        cond.acquire()
+        while not queue and not done_reading[0]:
+            cond.wait()
+        if not queue:
+            cond.release()
+            return
+        rq = queue.pop(0)
+        skip = rq['qid'] in cancelled
+        cancelled.discard(rq['qid'])
+        cond.release()
+        if skip:
+            counts['skipped'] += 1
+        else:
+            # the "request": some cpu for building and parsing it, then wait
+            t = os.times()
+            while os.times()[0] - t[0] < cpu:
+                json.loads(json.dumps(rq))
+            time.sleep(latency)
+            counts['lookups'] += 1
+            counts['bytes'] += nbytes
+            result = { 'artist': rq.get('artist', ''), 'track': rq.get('track', ''),
+                       'album': rq.get('album', ''), 'source': 'slow-resolver',
+                       'url': 'http://localhost/slow/%s' % rq['qid'],
+                       'bitrate': 128, 'duration': 200, 'score': 0.5 }
+            send({ '_msgtype': 'results', 'qid': rq['qid'], 'results': [result] })
+        send({ '_msgtype': 'done', 'qid': rq['qid'] })
+        report()
+
+send({ '_msgtype': 'settings', 'name': 'Slow Resolver',
+       'targettime': int(latency * 1000), 'weight': weight })
+
+t = threading.Thread(target=worker)
+t.start()
+while True:
+    length = stdin.read(4)
+    if len(length) < 4:
+        break
+    length = unpack('!L', length)[0]
+    if length > 4096:
+        break
+    msg = json.loads(stdin.read(length).decode('utf-8'))
+    cond.acquire()
+    if msg.get('_msgtype') == 'cancel':
+        counts['cancels'] += 1
+        if not ignore_cancel:
+            for rq in queue:
+                if rq['qid'] == msg['qid']:
+                    cancelled.add(msg['qid'])
+    elif 'qid' in msg and 'artist' in msg and 'track' in msg:
+        counts['queries'] += 1
+        queue.append(msg)
+        cond.notify()
+    cond.release()
+
+cond.acquire()
+done_reading[0] = True
+cond.notify()
+cond.release()
+t.join()
+report()
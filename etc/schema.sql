@@ -75,6 +75,7 @@ CREATE TABLE IF NOT EXISTS file_join (
     album INTEGER REFERENCES album(id) ON DELETE CASCADE ON UPDATE CASCADE
 );
 CREATE INDEX file_join_track ON file_join(track);
+CREATE INDEX file_join_file ON file_join(file);
 
 -- Schema version, and misc playdar settings
 
@@ -82,7 +83,7 @@ CREATE TABLE IF NOT EXISTS playdar_system (
     key TEXT NOT NULL PRIMARY KEY,
     value TEXT NOT NULL DEFAULT ''
 );
-INSERT INTO playdar_system(key,value) VALUES('schema_version', '2');
+INSERT INTO playdar_system(key,value) VALUES('schema_version', '3');
 
 -- Settings NOT USED
 
@@ -54,10 +54,9 @@ public:
     // serialise into buffer
     void result_item_cb(const query_uid& qid, ri_ptr rip)
     {
-        json_spirit::Object o;
-        o.push_back( json_spirit::Pair("query", qid) );
-        o.push_back( json_spirit::Pair("result", rip->get_json()) );
-        enqueue(json_spirit::write(o), true);
+        // same as writing {query, result}, using the result's cached JSON:
+        enqueue("{\"query\":" + json_spirit::write(json_spirit::Value(qid)) +
+                ",\"result\":" + rip->get_json_str() + "}", true);
     }
 
 
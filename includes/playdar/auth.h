@@ -24,6 +24,7 @@
 #include <vector>
 #include <set>
 #include "sqlite3pp.h"
+#include "playdar/utils/stmt_cache.hpp"
 #include <boost/thread/mutex.hpp>
 
 namespace playdar {
@@ -47,6 +48,7 @@ private:
 
     std::set<std::string> m_formtokens;
     sqlite3pp::database m_db;
+    utils::stmt_cache m_stmts;
     boost::mutex m_mut;
 };
 
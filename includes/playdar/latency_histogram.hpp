@@ -0,0 +1,128 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __LATENCY_HISTOGRAM_HPP__
+#define __LATENCY_HISTOGRAM_HPP__
+
+#include <algorithm>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+#include "json_spirit/json_spirit.h"
+
+namespace playdar {
+
+/*
+    Histogram of response times in ms, with buckets about 25% wide from 1ms
+    up to a minute, plus one for anything slower.
+    Counts are halved once there are max_samples of them, so old samples
+    fade out and percentiles follow the recent behaviour of a resolver.
+    Thread safe.
+*/
+class LatencyHistogram
+{
+public:
+    LatencyHistogram( unsigned int max_samples = 1000 )
+        : m_total(0), m_max_samples( max_samples ? max_samples : 1 )
+    {
+        unsigned int b = 1;
+        while( b < 60000 )
+        {
+            m_bounds.push_back( b );
+            unsigned int next = b + b/4;
+            b = next > b ? next : b + 1;
+        }
+        m_bounds.push_back( 60000 );
+        m_counts.resize( m_bounds.size() + 1, 0 ); // last is > 60s
+    }
+
+    void add( unsigned int ms )
+    {
+        size_t i = std::lower_bound( m_bounds.begin(), m_bounds.end(), ms )
+                   - m_bounds.begin();
+        boost::mutex::scoped_lock lk(m_mut);
+        ++m_counts[i];
+        if( ++m_total >= m_max_samples )
+        {
+            m_total = 0;
+            for( size_t j = 0; j < m_counts.size(); ++j )
+            {
+                m_counts[j] /= 2;
+                m_total += m_counts[j];
+            }
+        }
+    }
+
+    /// weighted number of samples, after decay
+    unsigned int count() const
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        return m_total;
+    }
+
+    /// latency in ms that p percent of samples were at or under,
+    /// interpolated within the bucket. 0 if there are no samples.
+    unsigned int percentile( float p ) const
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        if( m_total == 0 ) return 0;
+        float want = m_total * p / 100.0f;
+        float seen = 0;
+        for( size_t i = 0; i < m_counts.size(); ++i )
+        {
+            if( m_counts[i] == 0 ) continue;
+            if( seen + m_counts[i] >= want )
+            {
+                if( i == m_bounds.size() ) return m_bounds.back();
+                unsigned int lo = i ? m_bounds[i-1] : 0;
+                float frac = ( want - seen ) / m_counts[i];
+                return lo + (unsigned int)( frac * ( m_bounds[i] - lo ) + 0.5f );
+            }
+            seen += m_counts[i];
+        }
+        return m_bounds.back();
+    }
+
+    /// non-empty buckets, as [upper bound ms, count]. the last bucket,
+    /// for anything over a minute, has an upper bound of 0.
+    json_spirit::Array buckets() const
+    {
+        json_spirit::Array a;
+        boost::mutex::scoped_lock lk(m_mut);
+        for( size_t i = 0; i < m_counts.size(); ++i )
+        {
+            if( m_counts[i] == 0 ) continue;
+            json_spirit::Array b;
+            b.push_back( (int)( i < m_bounds.size() ? m_bounds[i] : 0 ) );
+            b.push_back( (int) m_counts[i] );
+            a.push_back( b );
+        }
+        return a;
+    }
+
+private:
+    mutable boost::mutex m_mut;
+    std::vector< unsigned int > m_bounds; // upper bound of each bucket
+    std::vector< unsigned int > m_counts;
+    unsigned int m_total;
+    unsigned int m_max_samples;
+};
+
+} // ns
+
+#endif
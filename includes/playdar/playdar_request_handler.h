@@ -22,6 +22,7 @@
 #include <map>
 #include <string>
 #include <iostream>
+#include <sstream>
 
 #include <moost/http.hpp>
 
@@ -57,6 +58,7 @@ private:
     void handle_shutdown( const playdar_request&, moost::http::reply& );
     void handle_settings( const playdar_request&, moost::http::reply& );
     void handle_queries( const playdar_request&, moost::http::reply& );
+    void handle_stats( const playdar_request&, moost::http::reply& );
     void handle_serve( const playdar_request&, moost::http::reply& );
     void handle_sid( const playdar_request&, moost::http::reply& );
     void handle_quickplay( const playdar_request&, moost::http::reply& );
@@ -64,6 +66,7 @@ private:
     void handle_comet( const playdar_request& , moost::http::reply& );
 
     std::string handle_queries_root(const playdar_request& req);
+    void latency_cells( const json_spirit::Object& lat, std::ostringstream& os );
 
     MyApplication * m_app;
     playdar::auth * m_pauth;    
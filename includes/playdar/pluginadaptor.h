@@ -23,6 +23,7 @@
 #include "playdar/types.h"
 //#include "playdar/streaming_strategy.h"
 #include "resolver_service.h"
+#include <boost/thread/mutex.hpp>
 
 namespace playdar {
 
@@ -51,14 +52,26 @@ public:
     virtual json_spirit::Value get_json(const std::string& key) const = 0;
     // results are a vector of json result objects
     virtual bool report_results(const query_uid& qid, const std::vector< json_spirit::Object >&) = 0;
+    /// tell playdar we won't be reporting (any more) results for this query.
+    /// optional, but lets the pipeline move on without waiting out our targettime.
+    virtual void report_done(const query_uid& qid) = 0;
+    /// like report_done, for queries we dropped without doing anything
+    /// because they were already solved or cancelled. counted in /stats.
+    virtual void report_skipped(const query_uid& qid) = 0;
 
     virtual std::string gen_uuid() const = 0;
+    /// a unique id for a result (sid) or query, much cheaper than gen_uuid.
+    /// carries a keyed SipHash tag so it can't be guessed from other ids;
+    /// /sid/<sid> streams without auth, so keep it that way.
+    virtual std::string gen_sid() const = 0;
     virtual void set_rs( ResolverService * rs )
     { m_rs = rs; }
 
     virtual bool query_exists(const query_uid & qid) = 0;
     
     virtual std::vector< ri_ptr > get_results(query_uid qid) = 0;
+    /// best limit results after skipping offset, limit 0 means all.
+    virtual std::vector< ri_ptr > get_results(query_uid qid, size_t limit, size_t offset) = 0;
     virtual int num_results(query_uid qid) = 0;
     virtual rq_ptr rq(const query_uid & qid) = 0;
     virtual void cancel_query(const query_uid & qid) = 0;
@@ -69,7 +82,13 @@ public:
     /// what plugins/capabilities does playdar have available?
     virtual const json_spirit::Object capabilities() const = 0;
     
-    unsigned int targettime() const { return m_targettime; }
+    /// the resolver adapts this from its latency on whichever thread reported
+    /// results, while dispatch threads read it, so it's behind a lock.
+    unsigned int targettime() const 
+    { 
+        boost::mutex::scoped_lock lk( m_targettime_mut );
+        return m_targettime; 
+    }
     unsigned short weight() const { return m_weight; }
     unsigned short preference() const { return m_preference; }
     const bool script() const { return m_script; }
@@ -79,7 +98,11 @@ public:
     
     void set_weight(unsigned short w) { m_weight = w; }
     void set_preference(unsigned short p) { m_preference = p; }
-    void set_targettime(unsigned short t) { m_targettime = t; }
+    void set_targettime(unsigned int t) 
+    { 
+        boost::mutex::scoped_lock lk( m_targettime_mut );
+        m_targettime = t; 
+    }
     void set_script(bool t) { m_script = t; }
     void set_scriptpath(std::string s) { m_scriptpath = s; }
     void set_localonly(bool t) { m_localonly = t; }
@@ -94,6 +117,7 @@ public:
 private:
     ResolverService * m_rs;    // instance of a plugin
     unsigned int m_targettime; // ms before passing to next resolver
+    mutable boost::mutex m_targettime_mut;
     unsigned short m_weight;   // highest weight runs first.
     unsigned short m_preference;// secondary sort value. indicates network reliability or other user preference setting
     
@@ -125,6 +149,16 @@ inline int PluginAdaptor::get(const std::string& k, const int& def) const
     
     return v.get_int();
 }
+
+template <>
+inline bool PluginAdaptor::get(const std::string& k, const bool& def) const
+{
+    json_spirit::Value v = get_json(k);
+    if( v.type() != json_spirit::bool_type )
+        return def;
+    
+    return v.get_bool();
+}
     
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -93,6 +93,7 @@ public:
     
     virtual bool report_results(const query_uid& qid, const std::vector< json_spirit::Object >& results)
     {
+        if( results.size() ) m_resolver->note_first_result( qid, rs() );
         std::vector< ri_ptr > v;
         BOOST_FOREACH( const json_spirit::Object & o, results )
         {
@@ -119,10 +120,25 @@ public:
         return true;
     }
     
+    virtual void report_done(const query_uid& qid)
+    {
+        m_resolver->report_done( qid, rs() );
+    }
+    
+    virtual void report_skipped(const query_uid& qid)
+    {
+        m_resolver->report_skipped( qid, rs() );
+    }
+    
     virtual std::string gen_uuid() const
     {
         return m_resolver->gen_uuid();
     }
+    
+    virtual std::string gen_sid() const
+    {
+        return m_resolver->gen_sid();
+    }
 
     virtual bool query_exists(const query_uid & qid)
     {
@@ -134,6 +150,11 @@ public:
         return m_resolver->get_results(qid); 
     }
     
+    virtual std::vector< ri_ptr > get_results(query_uid qid, size_t limit, size_t offset)
+    {
+        return m_resolver->get_results(qid, limit, offset); 
+    }
+    
     virtual rq_ptr rq(const query_uid & qid)
     {
         return m_resolver->rq(qid); 
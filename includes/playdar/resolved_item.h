@@ -20,25 +20,44 @@
 #define __RESOLVED_ITEM_H__
 
 #include <string>
+#include <boost/cstdint.hpp>
 #include <boost/function.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
 #include "playdar/types.h"
 #include "json_spirit/json_spirit.h"
 
 namespace playdar {
 
+/*
+    A result for a query, as a set of JSON properties.
+    The properties every result has, and that sorting and serving look at
+    all the time, are kept typed in the object itself. Anything else, or 
+    a common property with an unexpected JSON type, goes in a map. 
+    get_json() puts them back together in the same (sorted by name) order
+    a plain map would, so the JSON is the same either way.
+    Once a result is reported it doesn't change, and it gets sent to every
+    poller, comet session and LAN peer that wants it, so get_json_str()
+    keeps the serialized JSON until the next set_*.
+*/
 class ResolvedItem
 {
 public:
 
     ResolvedItem()
+        : m_score( 0 ), m_present( 0 )
     {
-        
+        for( int i = 0; i < NUM_INT; ++i ) m_int[i] = 0;
     }
     
     ResolvedItem( const json_spirit::Object& jsonobj )
+        : m_score( 0 ), m_present( 0 )
     {
-        json_spirit::obj_to_map( jsonobj, m_jsonmap );
+        for( int i = 0; i < NUM_INT; ++i ) m_int[i] = 0;
+        BOOST_FOREACH( const json_spirit::Pair& p, jsonobj )
+        {
+            set_value( p.name_, p.value_ );
+        }
     }
     
     virtual ~ResolvedItem(){};
@@ -47,24 +66,52 @@ public:
     {
         using namespace json_spirit;
         
+        // merge the typed fields with the map, both sorted by name:
         Object o;
-        map_to_obj( m_jsonmap, o );
+        o.reserve( m_jsonmap.size() + NUM_FIELDS );
+        std::map< std::string, Value >::const_iterator i = m_jsonmap.begin();
+        for( int f = 0; f < NUM_FIELDS; ++f )
+        {
+            if( !present( f ) || ( stripUrl && f == URL ) ) continue;
+            for( ; i != m_jsonmap.end() && i->first < field_name( f ); ++i )
+                if( !stripUrl || i->first != "url" )
+                    o.push_back( Pair( i->first, i->second ) );
+            o.push_back( Pair( field_name( f ), field_value( f ) ) );
+        }
+        for( ; i != m_jsonmap.end(); ++i )
+            if( !stripUrl || i->first != "url" )
+                o.push_back( Pair( i->first, i->second ) );
         return o;
     }
     
-    void rm_json_value( const std::string& v ){ m_jsonmap.erase( v ); }
-    const source_uid id() const         { return json_value( "sid", ""); }
-    void set_id(const source_uid& s)    { set_json_value( "sid", s ); }
+    /// get_json(), written compactly. built the first time it's asked for.
+    std::string get_json_str( bool stripUrl = false ) const
+    {
+        boost::mutex::scoped_lock lk( m_json.mut );
+        std::string& s = m_json.str[ stripUrl ? 1 : 0 ];
+        if( s.empty() ) s = json_spirit::write( get_json( stripUrl ) );
+        return s;
+    }
+    
+    void rm_json_value( const std::string& v )
+    { 
+        int f = field( v );
+        if( f >= 0 ) m_present &= ~(1 << f);
+        m_jsonmap.erase( v ); 
+        m_json.clear();
+    }
+    const source_uid id() const         { return present( SID ) ? m_str[S_SID] : source_uid(); }
+    void set_id(const source_uid& s)    { set_str( SID, s ); }
 
-    void set_score( const double s )    { set_json_value( "score", s ); }
-    const float score() const           { return (float) json_value( "score",  -1.0); }
-    void set_preference( const short p ){ set_json_value( "preference", p ); }
-    const short preference() const      { return json_value( "preference",  -1); }
+    void set_score( const double s )    { m_score = s; set_present( SCORE ); m_json.clear(); }
+    const float score() const           { return present( SCORE ) ? (float) m_score : -1.0f; }
+    void set_preference( const short p ){ m_int[I_PREFERENCE] = p; set_present( PREFERENCE ); m_json.clear(); }
+    const short preference() const      { return present( PREFERENCE ) ? (short) m_int[I_PREFERENCE] : -1; }
     
-    const std::string source() const    { return json_value( "source", "" ); }
+    const std::string source() const    { return present( SOURCE ) ? m_str[S_SOURCE] : std::string(); }
     
-    virtual void set_url(const std::string& s)  { m_jsonmap["url"] = s; }
-    virtual const std::string url() const  { return json_value( "url", "" ); }
+    virtual void set_url(const std::string& s)  { set_str( URL, s ); }
+    virtual const std::string url() const  { return present( URL ) ? m_str[S_URL] : std::string(); }
     
     /// extra headers to send in the request for this url.
     /// typically only used for http urls, but could be implemented for 
@@ -90,6 +137,9 @@ public:
     template< typename T >
     bool has_json_value( const std::string& s ) const
     {
+        int f = field( s );
+        if( f >= 0 && present( f ) ) return field_type( f ) == json_type<T>();
+
         std::map< std::string, json_spirit::Value >::const_iterator i = 
             m_jsonmap.find( s );
         
@@ -105,6 +155,14 @@ public:
     template< typename T >
     T json_value( const std::string& s, const T& def ) const
     {
+        int f = field( s );
+        if( f >= 0 && present( f ) )
+        {
+            return field_type( f ) == json_type<T>() 
+                ? field_value( f ).get_value<T>()
+                : def;
+        }
+        
         std::map< std::string, json_spirit::Value >::const_iterator i = 
             m_jsonmap.find( s );
         
@@ -116,15 +174,191 @@ public:
     template< typename T >
     void set_json_value( const std::string& k, const T& v )
     {
-        m_jsonmap[k] = v;
+        set_value( k, json_spirit::Value( v ) );
+    }
+
+    void set_source(const std::string& s)   { set_str( SOURCE, s ); }
+
+    /// rough number of bytes of memory this item is holding on to.
+    size_t approx_bytes() const
+    {
+        size_t b = sizeof(*this);
+        for( int i = 0; i < NUM_STR; ++i ) b += m_str[i].capacity();
+        std::map< std::string, json_spirit::Value >::const_iterator i;
+        for( i = m_jsonmap.begin(); i != m_jsonmap.end(); ++i )
+        {
+            b += i->first.capacity() + approx_bytes( i->second );
+        }
+        return b;
     }
 
-    void set_source(const std::string& s)   { m_jsonmap["source"] = s; }
+    /// rough size of a json value, including a map node to hold it.
+    static size_t approx_bytes( const json_spirit::Value& v )
+    {
+        using namespace json_spirit;
+        size_t b = sizeof(Value) + 48;
+        switch( v.type() )
+        {
+            case str_type:
+                b += v.get_str().capacity();
+                break;
+            case array_type:
+                BOOST_FOREACH( const Value& e, v.get_array() )
+                    b += approx_bytes( e );
+                break;
+            case obj_type:
+                BOOST_FOREACH( const Pair& p, v.get_obj() )
+                    b += p.name_.capacity() + approx_bytes( p.value_ );
+                break;
+            default:
+                break;
+        }
+        return b;
+    }
 
     
 private:
+    // typed fields, in name order so get_json can merge them with the map:
+    enum field_t { ALBUM, ARTIST, BITRATE, DURATION, PREFERENCE, SCORE, 
+                   SID, SIZE, SOURCE, TRACK, URL, NUM_FIELDS };
+    // ..and where each one's stored:
+    enum { S_ALBUM, S_ARTIST, S_SID, S_SOURCE, S_TRACK, S_URL, NUM_STR };
+    enum { I_BITRATE, I_DURATION, I_PREFERENCE, I_SIZE, NUM_INT };
+
+    static const char* field_name( int f )
+    {
+        static const char* names[NUM_FIELDS] = {
+            "album", "artist", "bitrate", "duration", "preference", "score",
+            "sid", "size", "source", "track", "url" };
+        return names[f];
+    }
+    
+    /// index of a typed field, -1 if k isn't one.
+    static int field( const std::string& k )
+    {
+        int lo = 0, hi = NUM_FIELDS - 1;
+        while( lo <= hi )
+        {
+            int mid = ( lo + hi ) / 2;
+            int c = k.compare( field_name( mid ) );
+            if( c == 0 ) return mid;
+            if( c < 0 ) hi = mid - 1; else lo = mid + 1;
+        }
+        return -1;
+    }
+    
+    static json_spirit::Value_type field_type( int f )
+    {
+        switch( f )
+        {
+            case BITRATE: case DURATION: case PREFERENCE: case SIZE:
+                return json_spirit::int_type;
+            case SCORE:
+                return json_spirit::real_type;
+            default:
+                return json_spirit::str_type;
+        }
+    }
+    
+    /// slot in m_str or m_int
+    static int slot( int f )
+    {
+        switch( f )
+        {
+            case ALBUM:      return S_ALBUM;
+            case ARTIST:     return S_ARTIST;
+            case SID:        return S_SID;
+            case SOURCE:     return S_SOURCE;
+            case TRACK:      return S_TRACK;
+            case URL:        return S_URL;
+            case BITRATE:    return I_BITRATE;
+            case DURATION:   return I_DURATION;
+            case PREFERENCE: return I_PREFERENCE;
+            case SIZE:       return I_SIZE;
+            default:         return 0;
+        }
+    }
+    
+    json_spirit::Value field_value( int f ) const
+    {
+        switch( field_type( f ) )
+        {
+            case json_spirit::int_type:  return json_spirit::Value( m_int[ slot(f) ] );
+            case json_spirit::real_type: return json_spirit::Value( m_score );
+            default:                     return json_spirit::Value( m_str[ slot(f) ] );
+        }
+    }
+    
+    bool present( int f ) const { return ( m_present & (1 << f) ) != 0; }
+    
+    /// typed field f is now set, so any value for it in the map goes.
+    void set_present( int f )
+    {
+        if( !present( f ) )
+        {
+            m_present |= (1 << f);
+            if( m_jsonmap.size() ) m_jsonmap.erase( field_name( f ) );
+        }
+    }
+    
+    void set_str( int f, const std::string& s )
+    {
+        m_str[ slot(f) ] = s;
+        set_present( f );
+        m_json.clear();
+    }
+    
+    /// store typed if it's one of ours with the right type, otherwise as is.
+    void set_value( const std::string& k, const json_spirit::Value& v )
+    {
+        m_json.clear();
+        int f = field( k );
+        if( f < 0 )
+        {
+            m_jsonmap[k] = v;
+            return;
+        }
+        if( v.type() != field_type( f ) )
+        {
+            m_present &= ~(1 << f);
+            m_jsonmap[k] = v;
+            return;
+        }
+        switch( v.type() )
+        {
+            case json_spirit::int_type:  m_int[ slot(f) ] = v.get_int64(); break;
+            case json_spirit::real_type: m_score = v.get_real(); break;
+            default:                     m_str[ slot(f) ] = v.get_str(); break;
+        }
+        set_present( f );
+    }
+
+    std::string m_str[NUM_STR];
+    boost::int64_t m_int[NUM_INT];  // same as json_spirit, sizes can be over 2GB
+    double m_score;
+    unsigned short m_present;   // bit per field_t that's set
+    
+    // everything else:
     std::map< std::string, json_spirit::Value > m_jsonmap;
     
+    /// serialized JSON, with and without the url. empty until built.
+    /// a copy of an item starts without, it's likely to be changed.
+    struct json_cache
+    {
+        json_cache() {}
+        json_cache( const json_cache& ) {}
+        json_cache& operator=( const json_cache& ) { clear(); return *this; }
+        void clear()
+        {
+            boost::mutex::scoped_lock lk( mut );
+            str[0].clear();
+            str[1].clear();
+        }
+        boost::mutex mut;
+        std::string str[2];
+    };
+    mutable json_cache m_json;
+    
     template< typename T > 
     static json_spirit::Value_type json_type();
     
@@ -133,6 +367,9 @@ private:
 template<>
 inline json_spirit::Value_type ResolvedItem::json_type<int>() { return json_spirit::int_type; }
 
+template<>
+inline json_spirit::Value_type ResolvedItem::json_type<boost::int64_t>() { return json_spirit::int_type; }
+
 template<>
 inline json_spirit::Value_type ResolvedItem::json_type<std::string>() { return json_spirit::str_type; }
 
@@ -28,7 +28,12 @@
 #include "playdar/types.h"
 #include "playdar/resolver_query.hpp"
 #include "playdar/resolver_service.h"
+#include "playdar/timer_wheel.h"
+#include "playdar/latency_histogram.hpp"
 #include "playdar/utils/uuid.h"
+#include "playdar/utils/id_gen.h"
+#include "playdar/utils/sharded_map.hpp"
+#include "playdar/utils/work_queues.hpp"
 
 #include <DynamicClass.hpp>
 
@@ -40,6 +45,7 @@ namespace playdar {
 
 class MyApplication;
 class ResolverService;
+class ResultCache;
 
 /*
  *  Acts as a container for all content-resolution queries that are running
@@ -65,6 +71,7 @@ public:
                      const std::vector< ri_ptr >& results,
                      std::string via);
     std::vector< ri_ptr > get_results(query_uid qid);
+    std::vector< ri_ptr > get_results(query_uid qid, size_t limit, size_t offset);
     int num_results(query_uid qid);
     
     bool query_exists(const query_uid & qid);
@@ -98,24 +105,42 @@ public:
     
     /// number of seconds queries should survive for since last being used/accessed.
     /// when this time expires, queries and associated results will be deleted to free memory.
+    /// queries may also be evicted sooner if we're over max_queries or max_query_memory.
     const time_t max_query_lifetime() const
     {
-        return 21600; // 6 hours.
+        return m_max_query_lifetime; // 6 hours by default.
     }
     
+    /// counters about live queries, memory use and evictions.
+    json_spirit::Object stats();
+    
+    /// unguessable, for auth and form tokens.
     std::string gen_uuid() const
     {
         return m_uuid_gen();
     }
     
+    /// much cheaper than gen_uuid, for sids and qids. see utils::id_gen
+    std::string gen_sid() const
+    {
+        return m_sid_gen();
+    }
+    
     bool pluginadaptor_sorter(const pa_ptr& lhs, const pa_ptr& rhs);
     
-    void run_pipeline_cont( rq_ptr rq, 
-                       unsigned short lastweight,
-                       boost::shared_ptr<boost::asio::deadline_timer> oldtimer);
+    bool run_pipeline_cont( rq_ptr rq, unsigned short lastweight );
+    void run_pipeline_timeout( rq_ptr rq, unsigned short lastweight );
+    void run_pipeline_hedge( rq_ptr rq, unsigned short lastweight );
+    void query_solved( const query_uid & qid );
+    void report_skipped( const query_uid & qid, ResolverService * rs );
     void run_pipeline( rq_ptr rq, unsigned short lastweight );
+    void report_done( const query_uid & qid, ResolverService * rs );
+    void note_first_result( const query_uid & qid, ResolverService * rs );
     
-    void dispatch_runner();
+    /// observed latency and current targettime of a resolver, empty if unknown.
+    json_spirit::Object latency_stats( ResolverService * rs ) const;
+    
+    void dispatch_runner( size_t idx );
     
     bool create_comet_session(const std::string& sessionId, rq_callback_t cb);
     void remove_comet_session(const std::string& sessionId);
@@ -129,6 +154,12 @@ protected:
                            const ri_ptr & ri,  // candidate
                            std::string & reason );  // fail reason
 
+    static ResolverQuery::score_terms make_score_terms( const rq_ptr & rq );
+    
+    static void score_candidates( const rq_ptr & rq,
+                                  const std::vector< ri_ptr >& candidates,
+                                  std::vector< ri_ptr >& accepted );
+
 private:
     boost::asio::io_service::work * m_work;
     boost::asio::io_service * m_io_service;
@@ -138,31 +169,127 @@ private:
     
     MyApplication * m_app;
     
-    std::map< query_uid, rq_ptr > m_queries;
-    std::map< source_uid, ri_ptr > m_sid2ri;
+    // live queries, results and timers. each is striped over several locks
+    // so HTTP threads and plugin threads don't all queue on one mutex.
+    // a query is live while it's in m_queries, whoever take()s it cancels it.
+    playdar::utils::sharded_map< query_uid, rq_ptr > m_queries;
+    playdar::utils::sharded_map< source_uid, ri_ptr > m_sid2ri;
     // timers used to auto-cancel queries that are inactive for long enough:
-    std::map< query_uid, boost::asio::deadline_timer* > m_qidtimers;
+    playdar::utils::sharded_map< query_uid, TimerWheel::handle > m_qidtimers;
+    // drives the timers above, and pipeline continuations:
+    TimerWheel * m_wheel;
+    // runs result callbacks for every query:
+    boost::shared_ptr<ResultDelivery> m_delivery;
     
-    // newest-first list of dispatched qids:
+    // newest-first list of recently dispatched qids, at most m_max_qidlist:
     std::deque< query_uid > m_qidlist;
+    size_t m_max_qidlist;
     boost::mutex m_mut_qidlist;
     
-    bool m_exiting;
-    boost::thread * m_t;
+    // in-flight query coalescing. a track query that matches one dispatched
+    // within the last m_coalesce_window secs follows it instead of running 
+    // the pipeline; the leader's results are forwarded to every follower.
+    struct coalesce_group
+    {
+        std::string key;
+        query_uid leader;
+        time_t started;
+        int live;           // leader + followers not yet cancelled
+        boost::mutex mut;   // protects live
+    };
+    typedef boost::shared_ptr<coalesce_group> group_ptr;
+    bool coalesce( rq_ptr rq, rq_ptr & leader );
+    void leave_group( const query_uid & qid, bool & last );
+    void forward_result( const query_uid & follower, const ri_ptr & rip );
+    static std::string coalesce_key( const rq_ptr & rq );
+    
+    // cache of results for track queries, 0 if disabled.
+    query_uid dispatch_query( rq_ptr rq, rq_callback_t cb, bool usecache );
+    bool serve_from_cache( rq_ptr rq );
+    time_t cache_ttl( const std::string& via ) const;
+    void save_cache();
+    void cache_results( const rq_ptr & rq, const std::vector< ri_ptr >& accepted,
+                        time_t ttl );
+    void commit_cache( const rq_ptr & rq );
+    ResultCache * m_cache;
+    // results held back from the cache until their query is solved or its
+    // pipeline is done, so a query arriving mid-run never gets half a run.
+    // runs that hit their deadline are dropped. gone when the query is.
+    struct cache_pending
+    {
+        cache_pending() : state( pending ) {}
+        enum { pending, committed, dropped } state;
+        std::vector< std::pair<ri_ptr, time_t> > items; // with their ttl
+    };
+    std::map< query_uid, cache_pending > m_cache_pending;
+    boost::mutex m_mut_cache_pending;
+    std::map< std::string, time_t > m_cache_ttls; // resolver name -> secs
+    time_t m_cache_default_ttl;
+    bool m_cache_refresh;       // serve stale results while refreshing them
+    time_t m_cache_refresh_time;
+    time_t m_cache_save_interval;
+    time_t m_coalesce_window;
+    std::map< std::string, group_ptr > m_inflight; // key -> group
+    boost::mutex m_mut_inflight;
+    playdar::utils::sharded_map< query_uid, group_ptr > m_qid2group;
+    
+    // retention limits, and counters used to enforce them.
+    // footprint is an estimate, see ResolverQuery::footprint()
+    void map_sid( const ri_ptr& rip );
+    bool over_limits( float fraction ) const;
+    void evict_if_needed();
+    time_t m_max_query_lifetime;
+    size_t m_max_queries;
+    size_t m_max_query_memory;
+    boost::mutex m_mut_stats; // protects the following:
+    long long m_footprint;
+    long long m_num_queries;
+    size_t m_num_evicted;
+    size_t m_num_expired;
+    size_t m_num_leaders;
+    size_t m_num_followers;
+    size_t m_num_tiers_early;   // all resolvers at a tier reported done
+    size_t m_num_tiers_timeout; // waited out the targettime
+    size_t m_num_deadline_cut;  // pipelines stopped at a query's deadline
+    size_t m_num_hedges;        // tiers started early, in hedged mode
+    size_t m_num_hedge_dispatches; // resolvers dispatched to in those tiers
+    size_t m_num_hedge_cancels; // ..and cancelled after a solve
+    size_t m_num_solved;
+    size_t m_num_skipped;       // queued work resolvers dropped, see report_skipped
+    bool m_evicting;
+    
     boost::thread * m_iothr;
     unsigned int m_id_counter;
 
     // resolver plugin pipeline:
     std::vector< pa_ptr > m_resolvers;
+    
+    // time from dispatching to a resolver to its first results. unless 
+    // disabled, its targettime follows a percentile of this, within bounds.
+    struct latency_tracker
+    {
+        pa_ptr pap;
+        LatencyHistogram hist;
+        unsigned int configured, min, max;
+    };
+    void track_latency( pa_ptr pap, const std::string& conf );
+    std::map< ResolverService*, boost::shared_ptr<latency_tracker> > m_latency;
+    bool m_adaptive_targettime;
+    float m_targettime_percentile;
+    unsigned int m_targettime_min_samples;
+    float m_solve_threshold;
+    bool m_hedge;
+    double m_hedge_fraction; // of a tier's targettime before hedging
 
     std::map< std::string, ResolverService* > m_pluginNameMap;
     
-    boost::mutex m_mut_results; // when adding results
-    
-    // for dispatching to the pipeline:
-    std::deque< std::pair<rq_ptr, unsigned short> > m_pending;
-    boost::mutex m_mutex;
-    boost::condition m_cond;
+    // for dispatching to the pipeline. each dispatch thread owns a queue,
+    // work for a query always goes to the same one (hash of qid), and idle
+    // threads steal from busy ones.
+    typedef std::pair<rq_ptr, unsigned short> pipeline_work;
+    utils::work_queues< pipeline_work > * m_dispatch;
+    std::vector< boost::thread* > m_dthreads;
+    void enqueue_pipeline( rq_ptr rq, unsigned short lastweight );
 
     // StreamingStrategy factories
     std::map< std::string, boost::function<ss_ptr(std::string)> > m_ss_factories;
@@ -171,6 +298,7 @@ private:
     boost::shared_ptr<T> ss_ptr_generator(std::string url);
     
     mutable playdar::utils::uuid_gen m_uuid_gen;
+    mutable playdar::utils::id_gen m_sid_gen;
 
     boost::mutex m_comets_mutex;
     std::map< std::string, rq_callback_t > m_comets;
@@ -23,6 +23,7 @@
 #include "playdar/types.h"
 #include "playdar/config.hpp"
 #include "playdar/resolved_item.h"
+#include "playdar/result_delivery.h"
 
 #include "json_spirit/json_spirit.h"
 #include <boost/algorithm/string.hpp>
@@ -30,26 +31,69 @@
 #include <boost/foreach.hpp>
 #include <boost/function.hpp>
 #include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <map>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include "time.h"
 
 namespace playdar {
 
+class ResolverService;
+
 // Represents a search query to resolve a particular track
 // Contains results, as they are found
 
 class ResolverQuery
 {
 public:
+    /// a track query's names the way scoring compares them, and how far off
+    /// a candidate can be. worked out once, when the query's dispatched,
+    /// rather than for every candidate. see Resolver::make_score_terms
+    struct score_terms
+    {
+        score_terms() : ready(false), max_artist(0), max_track(0) {}
+        bool ready;
+        std::string artist, album, track;
+        // most edits from artist/track a candidate can have and still score:
+        int max_artist, max_track;
+    };
+    
     ResolverQuery()
-        : m_solved(false), m_cancelled(false), m_origin_local(false)
+        : m_results_bytes(0), m_tier_weight(0), m_tier_claimed(false), 
+          m_next_speculative(false), m_hedge(false), m_solve_threshold(1.0f),
+          m_solved(false), m_json_solved(false), m_cancelled(false), 
+          m_origin_local(false)
     {
         // set initial "last access" time:
         time(&m_atime);
     }
     
     void set_origin_local(bool b) { m_origin_local = b; }
+    
+    void set_score_terms( const score_terms& t ) { m_score_terms = t; }
+    const score_terms& terms() const { return m_score_terms; }
     bool origin_local() const { return m_origin_local; }
     
+    /// the client only cares about results for the next ms milliseconds.
+    /// the pipeline won't start tiers after this, and plugins can check
+    /// remaining_ms() to cut their own work short.
+    void set_deadline_ms(unsigned int ms)
+    {
+        m_deadline = boost::posix_time::microsec_clock::universal_time()
+                     + boost::posix_time::milliseconds(ms);
+    }
+    bool has_deadline() const { return !m_deadline.is_not_a_date_time(); }
+    
+    /// ms left before the deadline, 0 once it's passed, -1 if there isn't one.
+    int remaining_ms() const
+    {
+        if( !has_deadline() ) return -1;
+        boost::posix_time::time_duration d = 
+            m_deadline - boost::posix_time::microsec_clock::universal_time();
+        return d.is_negative() ? 0 : (int) d.total_milliseconds();
+    }
+    bool past_deadline() const { return remaining_ms() == 0; }
+    
     /// when was this query last "used"
     time_t atime() const
     {
@@ -77,7 +121,11 @@ public:
     {
         boost::mutex::scoped_lock lock(m_mut);
         m_cancelled = true;
-        m_callbacks.clear();
+        BOOST_FOREACH(ResultDelivery::sub_ptr & s, m_subscribers) {
+            s->close();
+        }
+        m_subscribers.clear();
+        m_solved_callbacks.clear();
         std::cout << "RQ::cancel() for " << id() << std::endl;
     }
     
@@ -92,42 +140,37 @@ public:
         j.push_back( Pair("_msgtype", "rq")   );
         j.push_back( Pair("qid",    id())     );
 
-        for( std::map<std::string,Value>::const_iterator i = m_qryobj_map.begin();
-            i != m_qryobj_map.end(); i++ )
-        {
-            if( i->first != "_msgtype" &&
-                i->first != "qid" &&
-                i->first != "from_name" )
-                j.push_back( Pair( i->first, i->second ));
-        }
+        append_params( j );
         
         j.push_back( Pair("solved",  solved())  );
         j.push_back( Pair("from_name",  from_name())  );
+        // what's left of it, so remote peers can honour it too:
+        if( has_deadline() ) j.push_back( Pair("deadline", remaining_ms()) );
         return j;
     }
     
-    static boost::shared_ptr<ResolverQuery> from_json(json_spirit::Object qryobj)
+    /// get_json(), written compactly. kept until the params change, or we
+    /// get solved. not cached if there's a deadline, that's always changing.
+    std::string get_json_str() const
     {
-        boost::shared_ptr<ResolverQuery> rq(new ResolverQuery);
-
-        using namespace json_spirit;
-        std::map<std::string,Value> qryobj_map;
-        obj_to_map(qryobj, qryobj_map);
-        rq->m_qryobj_map = qryobj_map;
-
-        std::map<std::string,Value>::const_iterator it;
-        std::map<std::string,Value>::const_iterator end( qryobj_map.end() );
-        if((it = qryobj_map.find("qid")) != end) 
-            rq->set_id( it->second.get_str() );
-        if((it = qryobj_map.find("from_name")) != end) 
-            rq->set_from_name( it->second.get_str() );
-                    
-        return rq;
+        if( has_deadline() ) return json_spirit::write( get_json() );
+        time(&m_atime);
+        boost::mutex::scoped_lock lock(m_json_mut);
+        if( m_json_str.empty() || m_json_solved != solved() )
+        {
+            m_json_solved = solved();
+            m_json_str = json_spirit::write( get_json() );
+        }
+        return m_json_str;
     }
     
-    void set_id(const query_uid& q) { m_uuid = q; }
+    /// a TrackQuery if qryobj has an artist and track, otherwise a plain
+    /// ResolverQuery with everything in its param map.
+    static boost::shared_ptr<ResolverQuery> from_json(json_spirit::Object qryobj);
+    
+    void set_id(const query_uid& q) { m_uuid = q; json_changed(); }
     
-    void set_from_name(const std::string& s) { m_from_name = s; }
+    void set_from_name(const std::string& s) { m_from_name = s; json_changed(); }
 
     void set_comet_session_id(const std::string& s) { m_comet_session_id = s; }
 
@@ -146,25 +189,40 @@ public:
         boost::mutex::scoped_lock lock(m_mut);
         return m_results.size();
     }
+    
+    /// rough number of bytes this query and its results are holding on to.
+    size_t footprint() const
+    {
+        size_t b = sizeof(*this) + m_uuid.capacity() + m_from_name.capacity()
+                   + params_bytes();
+        boost::mutex::scoped_lock lock(m_mut);
+        return b + m_results_bytes;
+    }
 
+    /// all results, best first.
     std::vector< ri_ptr > results()
     {
         time(&m_atime);
-        // sort results on score/preference.
-        // TODO this could be memoized
-        boost::function
-                    < bool 
-                    (   const ri_ptr &, 
-                        const ri_ptr &
-                    ) > sortfun = 
-                    boost::bind(&ResolverQuery::sorter, this, _1, _2);
-        
+        // kept sorted as they're added, see insert_sorted
         boost::mutex::scoped_lock lock(m_mut);
-        sort(m_results.begin(), m_results.end(), sortfun);
         return m_results; 
     }
+    
+    /// the best limit results after skipping offset, so pollers that only 
+    /// want the top few don't copy the lot. limit 0 means no limit.
+    std::vector< ri_ptr > results( size_t limit, size_t offset = 0 )
+    {
+        time(&m_atime);
+        boost::mutex::scoped_lock lock(m_mut);
+        if( offset >= m_results.size() ) return std::vector< ri_ptr >();
+        size_t n = m_results.size() - offset;
+        if( limit && limit < n ) n = limit;
+        return std::vector< ri_ptr >( m_results.begin() + offset, 
+                                      m_results.begin() + offset + n );
+    }
 
-    bool sorter(const ri_ptr & lhs, const ri_ptr & rhs)
+    /// sort order of results, on score then preference.
+    static bool sorter(const ri_ptr & lhs, const ri_ptr & rhs)
     {
         // if equal scores, prefer item with higher preference 
         // usually this indicates network reliability or user-configured preference
@@ -176,80 +234,223 @@ public:
     }
 
     // add a single result
-    void add_result( ri_ptr rip )
+    // returns number of bytes the query grew by (see footprint)
+    size_t add_result( ri_ptr rip )
     {
-        if (!m_cancelled) {
-            boost::mutex::scoped_lock lock(m_mut);
-            if (rip->score() == 1.0) {
-                m_solved = true;
-            }
-			m_results.push_back(rip); 
-            // fire callbacks:
-            BOOST_FOREACH(rq_callback_t & cb, m_callbacks) {
-				cb(id(), rip);
-            }
-        }
+        boost::mutex::scoped_lock lock(m_mut);
+        if (m_cancelled) return 0;
+        bool solves = check_solved( rip );
+        m_results.insert( std::upper_bound( m_results.begin(), m_results.end(),
+                                            rip, &ResolverQuery::sorter ),
+                          rip );
+        size_t bytes = rip->approx_bytes() + sizeof(ri_ptr);
+        m_results_bytes += bytes;
+        // fire callbacks:
+        direct_t direct;
+        notify( rip, direct );
+        if (solves) fire_solved( lock );
+        else lock.unlock();
+        call_direct( direct );
+        return bytes;
     }
 
     // add a vector of results
-    void add_results(const std::vector< ri_ptr >& results) 
+    // returns number of bytes the query grew by (see footprint)
+    size_t add_results(const std::vector< ri_ptr >& results) 
     { 
-        if (!m_cancelled) {
-            boost::mutex::scoped_lock lock(m_mut);
-            BOOST_FOREACH(const ri_ptr& rip, results) {
-				m_results.push_back(rip); 
-            }
-
-            BOOST_FOREACH(const ri_ptr& rip, results) {
-                // decide if this result "solves" the query:
-                // for now just assume score of 1 means solved.
-                if(rip->score() == 1.0) {
-                    m_solved = true;
-                }
-                // fire callbacks:
-                BOOST_FOREACH(rq_callback_t & cb, m_callbacks) {
-					cb(id(), rip);
-                }
+        boost::mutex::scoped_lock lock(m_mut);
+        if (m_cancelled) return 0;
+        size_t bytes = 0;
+        BOOST_FOREACH(const ri_ptr& rip, results) {
+            bytes += rip->approx_bytes() + sizeof(ri_ptr);
+        }
+        insert_sorted( results );
+        m_results_bytes += bytes;
+
+        bool solves = false;
+        direct_t direct;
+        BOOST_FOREACH(const ri_ptr& rip, results) {
+            // decide if this result "solves" the query:
+            if(check_solved( rip )) {
+                solves = true;
             }
+            // fire callbacks:
+            notify( rip, direct );
         }
+        if (solves) fire_solved( lock );
+        else lock.unlock();
+        call_direct( direct );
+        return bytes;
+    }
+    
+    /// result callbacks are queued on this, if set. otherwise they're
+    /// called on the reporting thread, after the query lock is released.
+    void set_delivery( boost::shared_ptr<ResultDelivery> d ) { m_delivery = d; }
+    
+    /// results scoring at least this solve the query, 1.0 by default.
+    void set_solve_threshold( float t ) { m_solve_threshold = t; }
+    float solve_threshold() const { return m_solve_threshold; }
+    
+    /// cb fires once, when we're solved. straight away if we already are,
+    /// never if we're cancelled first. 
+    /// resolvers working on a query can use this (or poll solved()) to 
+    /// give up on work that's no longer needed.
+    void on_solved( rq_solved_callback_t cb )
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        if (m_cancelled) return;
+        if (!m_solved)
+        {
+            m_solved_callbacks.push_back( cb );
+            return;
+        }
+        lock.unlock();
+        cb( id() );
     }
 
     void register_callback(rq_callback_t cb)
     {
         boost::mutex::scoped_lock lock(m_mut);
-        m_callbacks.push_back( cb );
+        m_subscribers.push_back( ResultDelivery::sub_ptr( new ResultDelivery::Subscriber( cb ) ) );
+    }
+    
+    /// like register_callback, but first calls cb for every result we 
+    /// already have, so the subscriber sees each result exactly once.
+    /// if we've been cancelled, it only gets the existing results.
+    /// internal subscribers (another query following this one) never have
+    /// results dropped for falling behind.
+    void subscribe(rq_callback_t cb, bool internal = false)
+    {
+        ResultDelivery::sub_ptr s( new ResultDelivery::Subscriber( cb, internal ) );
+        direct_t direct;
+        boost::mutex::scoped_lock lock(m_mut);
+        BOOST_FOREACH(const ri_ptr& rip, m_results) {
+            if (m_delivery) m_delivery->deliver( s, id(), rip );
+            else direct.push_back( std::make_pair( s, rip ) );
+        }
+        if (!m_cancelled) m_subscribers.push_back( s );
+        lock.unlock();
+        call_direct( direct );
+    }
+    
+    /// pipeline bookkeeping, used by the Resolver.
+    /// start of a tier, dispatched are the resolvers we're sending it to.
+    /// true if the tier was started speculatively, see claim_tier.
+    bool begin_tier( unsigned short weight, 
+                     const std::vector<ResolverService*>& dispatched )
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        m_tier_weight = weight;
+        // the last tier too, moving on from that finishes the pipeline:
+        m_tier_pending = dispatched;
+        m_tier_claimed = false;
+        bool spec = m_next_speculative;
+        m_next_speculative = false;
+        if( spec )
+        {
+            m_speculative.insert( m_speculative.end(), 
+                                  dispatched.begin(), dispatched.end() );
+        }
+        return spec;
+    }
+    
+    /// speculatively dispatched resolvers that haven't said they're done,
+    /// only returned once so they only get cancelled once.
+    std::vector<ResolverService*> take_speculative()
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        std::vector<ResolverService*> v;
+        v.swap( m_speculative );
+        return v;
+    }
+    
+    void set_hedge( bool b ) { m_hedge = b; }
+    /// dispatch lower tiers early, before the current one has run its course
+    bool hedge() const { return m_hedge; }
+    
+    /// rs is done with us. true if that was the last one at the current tier,
+    /// and sets weight to the tier.
+    bool tier_done( ResolverService* rs, unsigned short & weight )
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        std::vector<ResolverService*>::iterator sit = 
+            std::find( m_speculative.begin(), m_speculative.end(), rs );
+        if( sit != m_speculative.end() ) m_speculative.erase( sit );
+        std::vector<ResolverService*>::iterator it = 
+            std::find( m_tier_pending.begin(), m_tier_pending.end(), rs );
+        if( it == m_tier_pending.end() ) return false; // old tier, or twice
+        m_tier_pending.erase( it );
+        weight = m_tier_weight;
+        return m_tier_pending.empty();
+    }
+    
+    /// remember when we asked rs, to time its first result.
+    void mark_dispatched( ResolverService* rs )
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        m_dispatched[rs] = boost::posix_time::microsec_clock::universal_time();
+    }
+    
+    /// true the first time rs reports results for us, with ms set to
+    /// how long it took since we dispatched to it.
+    bool first_result( ResolverService* rs, unsigned int & ms )
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        std::map<ResolverService*, boost::posix_time::ptime>::iterator it = 
+            m_dispatched.find( rs );
+        if( it == m_dispatched.end() ) return false;
+        ms = (unsigned int)( boost::posix_time::microsec_clock::universal_time()
+                             - it->second ).total_milliseconds();
+        m_dispatched.erase( it );
+        return true;
+    }
+    
+    /// true for exactly one caller per tier, the one that moves the 
+    /// pipeline on to the next tier. speculative if the current tier
+    /// hasn't run its course, and may still be working.
+    bool claim_tier( unsigned short weight, bool speculative = false )
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        if( m_tier_weight != weight || m_tier_claimed ) return false;
+        m_tier_claimed = true;
+        m_next_speculative = speculative;
+        return true;
     }
     
     bool solved()   const { return m_solved; }
+    /// true if nobody needs more results from us, solved or cancelled.
+    bool finished() const { return m_solved || m_cancelled; }
     std::string from_name() const { return m_from_name;  }
 
-    bool param_exists( const std::string& param ) const { return m_qryobj_map.find( param ) != m_qryobj_map.end(); }
-    const json_spirit::Value& param( const std::string& param ) const { return m_qryobj_map.find( param )->second; }
-    const json_spirit::Value_type param_type( const std::string& param ) const { return m_qryobj_map.find( param )->second.type(); }
+    virtual bool param_exists( const std::string& param ) const { return m_qryobj_map.find( param ) != m_qryobj_map.end(); }
+    virtual const json_spirit::Value& param( const std::string& param ) const { return m_qryobj_map.find( param )->second; }
+    const json_spirit::Value_type param_type( const std::string& param ) const { return this->param( param ).type(); }
     
     template<typename T>
-    void set_param( const std::string& param, const T& value ){ m_qryobj_map[param] = value; }
+    void set_param( const std::string& param, const T& value ){ set_param_value( param, json_spirit::Value( value ) ); }
+    virtual void set_param_value( const std::string& param, const json_spirit::Value& value )
+    {
+        m_qryobj_map[param] = value;
+        json_changed();
+    }
     
     std::string str() const
     {
         std::ostringstream os;
         os << "{ ";
         
-        std::pair<std::string,json_spirit::Value> i;
-        BOOST_FOREACH( i, m_qryobj_map )
+        // This should return a pretty string
+        // so leaves out internal data, same as get_json.
+        json_spirit::Object params;
+        append_params( params );
+        BOOST_FOREACH( const json_spirit::Pair& i, params )
         {
-            // This should return a pretty string
-            // so discard internal data.
-            if( i.first == "qid" ||
-                i.first == "_msgtype" ||
-                i.first == "from_name" ) continue;
-            
-            if( i.second.type() == json_spirit::str_type )
-                os << i.first << ": " << i.second.get_str();
-            else if( i.second.type() == json_spirit::real_type )
-                os << i.first << ": " << i.second.get_real();
-            else if( i.second.type() == json_spirit::int_type )
-                os << i.first << ": " << i.second.get_int();
+            if( i.value_.type() == json_spirit::str_type )
+                os << i.name_ << ": " << i.value_.get_str();
+            else if( i.value_.type() == json_spirit::real_type )
+                os << i.name_ << ": " << i.value_.get_real();
+            else if( i.value_.type() == json_spirit::int_type )
+                os << i.name_ << ": " << i.value_.get_int();
             else 
                 continue;
 
@@ -259,7 +460,7 @@ public:
         return os.str();
     }
     
-    bool isValidTrack()
+    virtual bool isValidTrack()
     {
         std::map<std::string,json_spirit::Value>::const_iterator end(m_qryobj_map.end());
         std::map<std::string,json_spirit::Value>::const_iterator it;
@@ -274,21 +475,136 @@ public:
 
 protected:
     std::map<std::string,json_spirit::Value> m_qryobj_map;
+    
+    /// drop the cached get_json_str(). call after changing m_qryobj_map.
+    void json_changed()
+    {
+        boost::mutex::scoped_lock lock(m_json_mut);
+        m_json_str.clear();
+    }
+    
+    /// set by us rather than being query params, left out of get_json's params
+    static bool internal_param( const std::string& name )
+    {
+        return name == "_msgtype" || name == "qid" || 
+               name == "from_name" || name == "deadline";
+    }
+    
+    /// the query params, in name order, for get_json and str.
+    virtual void append_params( json_spirit::Object& j ) const
+    {
+        std::map<std::string,json_spirit::Value>::const_iterator i;
+        for( i = m_qryobj_map.begin(); i != m_qryobj_map.end(); ++i )
+        {
+            if( !internal_param( i->first ) )
+                j.push_back( json_spirit::Pair( i->first, i->second ) );
+        }
+    }
+    
+    /// rough size of the params, for footprint()
+    virtual size_t params_bytes() const
+    {
+        size_t b = 0;
+        std::map<std::string,json_spirit::Value>::const_iterator i;
+        for( i = m_qryobj_map.begin(); i != m_qryobj_map.end(); ++i )
+        {
+            b += i->first.capacity() + ResolvedItem::approx_bytes( i->second );
+        }
+        return b;
+    }
 
 private:
+    /// true if rip is the result that first solves us. caller holds m_mut.
+    bool check_solved( const ri_ptr & rip )
+    {
+        if (m_solved || rip->score() < m_solve_threshold) return false;
+        m_solved = true;
+        return true;
+    }
+    
+    /// sort a batch of new results and merge it in to m_results.
+    /// both merges are stable, so of equally ranked results the one we 
+    /// got first stays first. caller holds m_mut.
+    void insert_sorted( const std::vector< ri_ptr >& results )
+    {
+        size_t mid = m_results.size();
+        m_results.insert( m_results.end(), results.begin(), results.end() );
+        std::stable_sort( m_results.begin() + mid, m_results.end(), 
+                          &ResolverQuery::sorter );
+        std::inplace_merge( m_results.begin(), m_results.begin() + mid, 
+                            m_results.end(), &ResolverQuery::sorter );
+    }
+    
+    typedef std::vector< std::pair<ResultDelivery::sub_ptr, ri_ptr> > direct_t;
+    
+    /// tell subscribers about a new result. that's just queueing it if we 
+    /// have a ResultDelivery, done under m_mut so it keeps the order results
+    /// were added in. otherwise it goes in direct, for call_direct.
+    /// caller holds m_mut.
+    void notify( const ri_ptr & rip, direct_t & direct )
+    {
+        BOOST_FOREACH(ResultDelivery::sub_ptr & s, m_subscribers) {
+            if (m_delivery) m_delivery->deliver( s, id(), rip );
+            else direct.push_back( std::make_pair( s, rip ) );
+        }
+    }
+    
+    /// caller must not hold m_mut.
+    void call_direct( const direct_t & direct )
+    {
+        for (direct_t::const_iterator i = direct.begin(); i != direct.end(); ++i) {
+            i->first->call( id(), i->second );
+        }
+    }
+    
+    /// fire the on_solved callbacks, outside the lock so they can 
+    /// call back in to us.
+    void fire_solved( boost::mutex::scoped_lock & lock )
+    {
+        std::vector<rq_solved_callback_t> cbs;
+        cbs.swap( m_solved_callbacks );
+        lock.unlock();
+        BOOST_FOREACH(rq_solved_callback_t & cb, cbs) {
+            cb( id() );
+        }
+    }
+
     query_uid m_uuid;
+    score_terms m_score_terms;
     std::vector< ri_ptr > m_results;
+    size_t m_results_bytes; // sum of approx_bytes() for m_results, plus a ptr each
     std::string m_from_name;
     std::string m_comet_session_id;
         
-    // list of functors to fire on new result:
-    std::vector<rq_callback_t> m_callbacks;
-
-    // for protecting m_results and m_callbacks
+    // pipeline tier we're at, and resolvers there we're still waiting on:
+    unsigned short m_tier_weight;
+    std::vector<ResolverService*> m_tier_pending;
+    bool m_tier_claimed;
+    // hedged pipeline: next tier starts early, and the resolvers that
+    // got it early still working, to cancel once we're solved.
+    bool m_next_speculative;
+    std::vector<ResolverService*> m_speculative;
+    bool m_hedge;
+    // resolvers we've dispatched to but not heard results from yet:
+    std::map<ResolverService*, boost::posix_time::ptime> m_dispatched;
+    
+    // functors to fire on new result, and what fires them:
+    std::vector<ResultDelivery::sub_ptr> m_subscribers;
+    boost::shared_ptr<ResultDelivery> m_delivery;
+    // ..and once, when solved:
+    std::vector<rq_solved_callback_t> m_solved_callbacks;
+    float m_solve_threshold;
+
+    // for protecting m_results and m_subscribers
     mutable boost::mutex m_mut;     
 
     // set to true once we get a decent result
     bool m_solved;
+    
+    // see get_json_str:
+    mutable boost::mutex m_json_mut;
+    mutable std::string m_json_str;
+    mutable bool m_json_solved;
 
     // set to true if trying to cancel/delete this query (if so, don't bother working with it)
     bool m_cancelled;
@@ -299,9 +615,154 @@ private:
 
     // true if query initiated by user of this computer
     bool m_origin_local;
+    
+    // not_a_date_time unless the client gave us a deadline
+    boost::posix_time::ptime m_deadline;
 };
 
+/*
+    A query for a track, the usual kind. artist, album and track are kept
+    in fields of their own rather than the param map, which scoring and
+    the resolvers read far more often than anything else. Any other params
+    still go in the map, and get_json puts everything in the same order a 
+    plain ResolverQuery would.
+*/
+class TrackQuery : public ResolverQuery
+{
+public:
+    TrackQuery() {}
+    
+    TrackQuery( const std::string& artist, const std::string& album, 
+                const std::string& track )
+        : m_artist( artist ), m_album( album ), m_track( track )
+    {}
+    
+    /// empty if not set, or set to something that isn't a string
+    const std::string& artist() const { return str_or_empty( m_artist ); }
+    const std::string& album()  const { return str_or_empty( m_album ); }
+    const std::string& track()  const { return str_or_empty( m_track ); }
+    
+    virtual bool param_exists( const std::string& param ) const
+    {
+        const json_spirit::Value* v = field( param );
+        return v ? v->type() != json_spirit::null_type : ResolverQuery::param_exists( param );
+    }
+    
+    virtual const json_spirit::Value& param( const std::string& param ) const
+    {
+        const json_spirit::Value* v = field( param );
+        return v ? *v : ResolverQuery::param( param );
+    }
+    
+    virtual void set_param_value( const std::string& param, const json_spirit::Value& value )
+    {
+        json_spirit::Value* v = field( param );
+        if( !v ) 
+        {
+            ResolverQuery::set_param_value( param, value );
+            return;
+        }
+        *v = value;
+        json_changed();
+    }
+    
+    virtual bool isValidTrack()
+    {
+        return artist().length() && track().length();
+    }
+
+protected:
+    virtual void append_params( json_spirit::Object& j ) const
+    {
+        // our fields, merged in to the map's params by name:
+        const char* names[] = { "album", "artist", "track" };
+        const json_spirit::Value* values[] = { &m_album, &m_artist, &m_track };
+        std::map<std::string,json_spirit::Value>::const_iterator i = m_qryobj_map.begin();
+        for( int f = 0; f < 3; ++f )
+        {
+            for( ; i != m_qryobj_map.end() && i->first < names[f]; ++i )
+            {
+                if( !internal_param( i->first ) )
+                    j.push_back( json_spirit::Pair( i->first, i->second ) );
+            }
+            if( values[f]->type() != json_spirit::null_type )
+                j.push_back( json_spirit::Pair( names[f], *values[f] ) );
+        }
+        for( ; i != m_qryobj_map.end(); ++i )
+        {
+            if( !internal_param( i->first ) )
+                j.push_back( json_spirit::Pair( i->first, i->second ) );
+        }
+    }
+    
+    virtual size_t params_bytes() const
+    {
+        return ResolverQuery::params_bytes() + 
+               ResolvedItem::approx_bytes( m_artist ) +
+               ResolvedItem::approx_bytes( m_album ) +
+               ResolvedItem::approx_bytes( m_track );
+    }
+
+private:
+    const json_spirit::Value* field( const std::string& param ) const
+    {
+        if( param == "artist" ) return &m_artist;
+        if( param == "track" )  return &m_track;
+        if( param == "album" )  return &m_album;
+        return 0;
+    }
+    json_spirit::Value* field( const std::string& param )
+    {
+        return const_cast<json_spirit::Value*>( 
+            static_cast<const TrackQuery*>( this )->field( param ) );
+    }
+    
+    static const std::string& str_or_empty( const json_spirit::Value& v )
+    {
+        static const std::string empty;
+        return v.type() == json_spirit::str_type ? v.get_str() : empty;
+    }
+    
+    // null until set
+    json_spirit::Value m_artist, m_album, m_track;
+};
+
+inline boost::shared_ptr<ResolverQuery> 
+ResolverQuery::from_json(json_spirit::Object qryobj)
+{
+    using namespace json_spirit;
+    std::map<std::string,Value> qryobj_map;
+    obj_to_map(qryobj, qryobj_map);
+    
+    std::map<std::string,Value>::const_iterator it;
+    std::map<std::string,Value>::const_iterator end( qryobj_map.end() );
+    boost::shared_ptr<ResolverQuery> rq;
+    if( (it = qryobj_map.find("artist")) != end && it->second.type() == str_type &&
+        (it = qryobj_map.find("track")) != end && it->second.type() == str_type )
+    {
+        boost::shared_ptr<TrackQuery> tq( new TrackQuery );
+        for( it = qryobj_map.begin(); it != end; ++it )
+            tq->set_param_value( it->first, it->second );
+        rq = tq;
+    }
+    else
+    {
+        rq.reset( new ResolverQuery );
+        rq->m_qryobj_map = qryobj_map;
+        rq->json_changed();
+    }
+
+    if((it = qryobj_map.find("qid")) != end) 
+        rq->set_id( it->second.get_str() );
+    if((it = qryobj_map.find("from_name")) != end) 
+        rq->set_from_name( it->second.get_str() );
+    if((it = qryobj_map.find("deadline")) != end && 
+       it->second.type() == int_type && it->second.get_int() >= 0) 
+        rq->set_deadline_ms( it->second.get_int() );
+                
+    return rq;
 }
 
-#endif
+}
 
+#endif
@@ -0,0 +1,107 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __RESULT_CACHE_H__
+#define __RESULT_CACHE_H__
+
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "json_spirit/json_spirit.h"
+#include "playdar/resolved_item.h"
+
+namespace playdar {
+
+/*
+    Remembers scored results for track queries, keyed on the normalized
+    artist/album/track, so popular tracks don't go through the whole
+    pipeline every time.
+    Each result has its own expiry time, depending on which resolver found
+    it. Local files are checked against the filesystem when served, so
+    anything the scanner changed or removed since is dropped.
+    Results are stored without their sid, the resolver gives them fresh ones.
+*/
+class ResultCache
+{
+public:
+    enum lookup_result { MISS, HIT, STALE };
+
+    ResultCache( const std::string& filename, size_t max_entries );
+    ~ResultCache();
+
+    /// results for key in out. STALE if any of them has expired, or none
+    /// of them scores solve_threshold, as then the pipeline might still
+    /// find something better.
+    lookup_result get( const std::string& key,
+                       std::vector< json_spirit::Object >& out,
+                       float solve_threshold );
+    /// remember a result for key for ttl seconds, replacing any
+    /// previous result with the same url.
+    void add( const std::string& key, const ResolvedItem& ri, time_t ttl );
+    /// false if a refresh for key was started recently.
+    bool begin_refresh( const std::string& key, time_t within );
+
+    bool load();
+    bool save();
+    /// save() on a thread of its own, so the caller doesn't wait on the
+    /// disk. does nothing if the last one is still going.
+    void save_async();
+
+    json_spirit::Object stats();
+
+private:
+    struct cached_item
+    {
+        json_spirit::Object item;
+        std::string url;
+        float score;
+        time_t cached;
+        time_t expires;
+    };
+    struct entry
+    {
+        std::string key;
+        std::vector< cached_item > items;
+        time_t refreshing;
+    };
+    typedef std::list< entry > lru_t;
+
+    static bool still_valid( const cached_item& ci );
+    void erase( lru_t::iterator it );
+
+    std::string m_filename;
+    size_t m_max_entries;
+
+    boost::mutex m_save_mut;    // one save at a time
+    boost::mutex m_saver_mut;   // protects m_saver
+    boost::thread * m_saver;
+
+    boost::mutex m_mut;
+    lru_t m_lru; // most recently used first
+    boost::unordered_map< std::string, lru_t::iterator > m_index;
+
+    size_t m_hits, m_misses, m_stale, m_invalidated, m_stored, m_evicted;
+};
+
+} // ns
+
+#endif
@@ -0,0 +1,114 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __RESULT_DELIVERY_H__
+#define __RESULT_DELIVERY_H__
+
+#include <deque>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+#include "json_spirit/json_spirit.h"
+#include "playdar/types.h"
+
+namespace playdar {
+
+/*
+    Calls result callbacks (comet sessions, LAN replies, coalesced queries)
+    on a few threads of its own, so reporting a result never waits on
+    whoever is listening for it.
+
+    Each subscriber has its own backlog, which is delivered in order by one
+    thread at a time. A subscriber that falls more than max_backlog results
+    behind has new results dropped (and counted) until it catches up, so a
+    stalled comet client only ever loses its own results. Internal ones, 
+    like a coalesced query following its leader, are never dropped from.
+
+    Make one with create(). Queries hold on to it, so the last reference 
+    can go in a callback on one of our own threads; it's deleted on another
+    thread then, as the destructor joins them all.
+*/
+class ResultDelivery
+{
+public:
+    class Subscriber
+    {
+        friend class ResultDelivery;
+    public:
+        Subscriber( rq_callback_t cb, bool internal = false )
+            : m_cb( cb ), m_internal( internal ),
+              m_queued( false ), m_closed( false ), m_dropped( 0 )
+        {}
+        /// stop delivering, anything still in the backlog is discarded.
+        void close()
+        {
+            boost::mutex::scoped_lock lk( m_mut );
+            m_closed = true;
+            m_backlog.clear();
+        }
+        /// call straight away, on this thread. for when there's no
+        /// ResultDelivery to queue on.
+        void call( const query_uid & qid, const ri_ptr & rip )
+        {
+            if( !m_closed ) m_cb( qid, rip );
+        }
+    private:
+        rq_callback_t m_cb;
+        const bool m_internal; // exempt from max_backlog
+        boost::mutex m_mut; // protects the following:
+        std::deque< std::pair<query_uid, ri_ptr> > m_backlog;
+        bool m_queued;      // in the ready queue, or being drained
+        bool m_closed;
+        size_t m_dropped;
+    };
+    typedef boost::shared_ptr<Subscriber> sub_ptr;
+
+    static boost::shared_ptr<ResultDelivery> create( unsigned int nthreads, 
+                                                     size_t max_backlog );
+
+    /// queue a result for sub, never blocks on the callback itself.
+    void deliver( const sub_ptr & sub, const query_uid & qid, const ri_ptr & rip );
+
+    json_spirit::Object stats();
+
+private:
+    ResultDelivery( unsigned int nthreads, size_t max_backlog );
+    ~ResultDelivery();
+
+    static void release( ResultDelivery * d );
+    static void destroy( ResultDelivery * d ) { delete d; }
+    bool on_own_thread() const;
+
+    void run();
+
+    size_t m_max_backlog;
+    std::vector< boost::thread* > m_threads;
+
+    boost::mutex m_mut;             // protects the following:
+    boost::condition m_cond;
+    std::deque< sub_ptr > m_ready;  // subscribers with something to deliver
+    bool m_exiting;
+    size_t m_delivered, m_dropped, m_max_seen;
+};
+
+} // ns
+
+#endif
@@ -86,6 +86,9 @@ private:
     void init_worker();
     void process_output();
     void process_stderr();
+    void send(const json_spirit::Object& o);
+    void send(const std::string& msg);
+    void query_solved(const query_uid& qid);
     
     bool m_dead;
     bool m_got_settings;
@@ -99,6 +102,7 @@ private:
     bool m_exiting;
     boost::thread * m_dt;
     std::deque<rq_ptr> m_pending;
+    std::deque<query_uid> m_cancels;    // solved queries to tell the script about
     boost::mutex m_mutex;
     boost::condition m_cond;
     
@@ -0,0 +1,99 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace playdar {
+
+/*
+    Hierarchical timing wheel, driven by a single deadline_timer on the
+    given io_service. Callbacks fire on the io_service thread.
+
+    Level 0 has 256 slots of one tick each, the three levels above it have
+    64 slots each and cascade down as the wheel turns. With the default 10ms
+    tick that gives 10ms resolution for pipeline targettimes and reaches out
+    to ~186 hours, plenty for the query lifetime.
+    Scheduling and cancelling are O(1), cancelling is lazy: the entry stays
+    in its slot and is dropped when the wheel reaches it.
+    The ticking timer only runs while something is scheduled.
+*/
+class TimerWheel
+{
+public:
+    typedef boost::function<void()> callback_t;
+
+    class Entry
+    {
+        friend class TimerWheel;
+    public:
+        Entry() : m_cancelled(false), m_expires(0) {}
+        /// true once cancelled or fired
+        bool done() const { return m_cancelled; }
+    private:
+        callback_t m_cb;
+        volatile bool m_cancelled;
+        unsigned long long m_expires; // absolute tick
+    };
+    typedef boost::shared_ptr<Entry> handle;
+
+    TimerWheel( boost::asio::io_service & ios, unsigned int tick_ms = 10 );
+
+    /// run cb after delay_ms, rounded up to the next tick. thread safe.
+    handle schedule( unsigned int delay_ms, callback_t cb );
+    /// stops the callback firing, if it hasn't already.
+    void cancel( const handle & h );
+
+    /// number of entries in the wheel, including lazily cancelled ones.
+    size_t size() const;
+    unsigned int tick_ms() const { return m_tick_ms; }
+
+private:
+    enum { L0_BITS = 8, LN_BITS = 6, LEVELS = 4 };
+
+    typedef std::vector< handle > slot_t;
+
+    void insert( const handle & h );
+    void cascade( unsigned int level );
+    void advance( std::vector< callback_t > & fire );
+    void start_ticking();
+    void on_tick( const boost::system::error_code & e );
+    unsigned long long ticks_now() const;
+
+    boost::asio::io_service & m_ios;
+    boost::asio::deadline_timer m_timer;
+    unsigned int m_tick_ms;
+    boost::posix_time::ptime m_epoch;
+
+    mutable boost::mutex m_mut;
+    std::vector< slot_t > m_levels[LEVELS];
+    unsigned long long m_current; // last tick processed
+    size_t m_count;
+    bool m_running;
+};
+
+} // ns
+
+#endif
@@ -26,11 +26,7 @@ namespace playdar {
 namespace TrackRQBuilder {
     static rq_ptr build( const std::string& artist, const std::string& album, const std::string& track )
     {
-        rq_ptr rq = rq_ptr( new ResolverQuery );
-        rq->set_param( "artist", artist );
-        rq->set_param( "album", album );
-        rq->set_param( "track", track );
-        return rq;
+        return rq_ptr( new TrackQuery( artist, album, track ) );
     }
 
 } //namespace TrackRQBuilder
@@ -53,6 +53,8 @@ typedef boost::shared_ptr<StreamingStrategy> ss_ptr;
 // Callback type for observing new RQ results:
 class PlayableItem; // fwd
 typedef boost::function< void (const query_uid& qid, ri_ptr rip)> rq_callback_t;
+// ..and for the query being solved:
+typedef boost::function< void (const query_uid& qid)> rq_solved_callback_t;
 
 /// Handlers for web requests:
 typedef boost::function< void ( const std::string& url,
@@ -0,0 +1,52 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_ID_GEN_H_
+#define _PLAYDAR_UTILS_ID_GEN_H_
+
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace playdar {
+namespace utils { 
+
+/*
+    Cheap unique ids, for sids and qids: a random prefix picked once, 
+    a counter, and a keyed hash (SipHash-2-4, random key) of the counter,
+    all in [0-9a-zA-Z]. /sid streams files with no auth, so knowing one
+    sid mustn't give away any others; the hash's 64 bits see to that.
+    Auth and form tokens still use uuid_gen. Thread safe.
+*/
+class id_gen
+{
+public:
+    id_gen();
+    std::string operator()();
+private:
+    std::string m_prefix;
+    const boost::uint64_t m_k0, m_k1;
+    // atomic_count is a long, only 32 bits on windows, so the counter
+    // would wrap and repeat ids. a 64 bit one under a lock never will:
+    boost::mutex m_mut;
+    boost::uint64_t m_count;
+};
+
+}} // ns
+
+#endif
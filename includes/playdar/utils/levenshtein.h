@@ -23,7 +23,11 @@
 #include <vector>
 namespace playdar { namespace utils {
 
-int levenshtein(const std::string & source, const std::string & target);
+/// edit distance between source and target, counting transpositions.
+/// if max_dist isn't negative, anything over it is returned as max_dist+1,
+/// which is quicker as it can stop once it knows it'll be over.
+int levenshtein(const std::string & source, const std::string & target,
+                int max_dist = -1);
 
 }}
 
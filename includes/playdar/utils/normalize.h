@@ -0,0 +1,45 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_NORMALIZE_H_
+#define _PLAYDAR_UTILS_NORMALIZE_H_
+
+#include <string>
+
+namespace playdar { namespace utils {
+
+enum normalize_flags
+{
+    NORMALIZE_THE  = 1,   // "the beatles" and "beatles, the" -> "beatles"
+    NORMALIZE_FEAT = 2    // "song (feat. someone)" -> "song"
+};
+
+/// a name (artist, album, track, tag) the way we compare and store them:
+/// lower case, accents stripped, apostrophes and dots dropped, other
+/// punctuation and whitespace runs turned in to a single space, trimmed.
+/// input is UTF-8. Latin, Greek and Cyrillic are case folded, anything
+/// else is passed through as is. a name that's all punctuation ("!!!") 
+/// is just lower cased and trimmed, rather than coming out empty.
+/// writes to out, reusing its buffer.
+void normalize(const std::string & in, std::string & out, int flags = 0);
+
+std::string normalize(const std::string & in, int flags = 0);
+
+}}
+
+#endif
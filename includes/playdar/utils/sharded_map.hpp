@@ -0,0 +1,169 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_SHARDED_MAP_HPP_
+#define _PLAYDAR_UTILS_SHARDED_MAP_HPP_
+
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace playdar { namespace utils {
+
+/*
+    Hash map split into a number of independently locked shards.
+    Threads working on different keys rarely touch the same lock, and every
+    operation is atomic with respect to its key.
+    Values are handed out by copy, so use it with shared_ptrs.
+*/
+template < class K, class V, class H = boost::hash<K> >
+class sharded_map : private boost::noncopyable
+{
+public:
+    explicit sharded_map( size_t nshards = 32 )
+    {
+        if( nshards == 0 ) nshards = 1;
+        for( size_t i = 0; i < nshards; ++i )
+        {
+            m_shards.push_back( boost::shared_ptr<shard>(new shard) );
+        }
+    }
+
+    /// copies value for key into out, false if not found.
+    bool get( const K & k, V & out ) const
+    {
+        shard & s = shard_for( k );
+        boost::mutex::scoped_lock lk( s.mut );
+        typename map_t::const_iterator it = s.map.find( k );
+        if( it == s.map.end() ) return false;
+        out = it->second;
+        return true;
+    }
+
+    bool contains( const K & k ) const
+    {
+        shard & s = shard_for( k );
+        boost::mutex::scoped_lock lk( s.mut );
+        return s.map.find( k ) != s.map.end();
+    }
+
+    /// insert or overwrite
+    void set( const K & k, const V & v )
+    {
+        shard & s = shard_for( k );
+        boost::mutex::scoped_lock lk( s.mut );
+        s.map[k] = v;
+    }
+
+    /// false (and does nothing) if key already exists.
+    bool insert( const K & k, const V & v )
+    {
+        shard & s = shard_for( k );
+        boost::mutex::scoped_lock lk( s.mut );
+        return s.map.insert( std::make_pair(k, v) ).second;
+    }
+
+    /// overwrite only if key exists, false if it didn't.
+    bool replace( const K & k, const V & v )
+    {
+        shard & s = shard_for( k );
+        boost::mutex::scoped_lock lk( s.mut );
+        typename map_t::iterator it = s.map.find( k );
+        if( it == s.map.end() ) return false;
+        it->second = v;
+        return true;
+    }
+
+    bool erase( const K & k )
+    {
+        shard & s = shard_for( k );
+        boost::mutex::scoped_lock lk( s.mut );
+        return s.map.erase( k ) > 0;
+    }
+
+    /// remove and return the value, false if not found.
+    /// only one caller can ever win a take() for a given insert.
+    bool take( const K & k, V & out )
+    {
+        shard & s = shard_for( k );
+        boost::mutex::scoped_lock lk( s.mut );
+        typename map_t::iterator it = s.map.find( k );
+        if( it == s.map.end() ) return false;
+        out = it->second;
+        s.map.erase( it );
+        return true;
+    }
+
+    /// total across all shards, not a consistent snapshot.
+    size_t size() const
+    {
+        size_t n = 0;
+        for( size_t i = 0; i < m_shards.size(); ++i )
+        {
+            boost::mutex::scoped_lock lk( m_shards[i]->mut );
+            n += m_shards[i]->map.size();
+        }
+        return n;
+    }
+
+    /// copy of all values, one shard locked at a time.
+    template <class OutIt>
+    void values( OutIt out ) const
+    {
+        for( size_t i = 0; i < m_shards.size(); ++i )
+        {
+            boost::mutex::scoped_lock lk( m_shards[i]->mut );
+            typename map_t::const_iterator it = m_shards[i]->map.begin();
+            for( ; it != m_shards[i]->map.end(); ++it )
+                *out++ = it->second;
+        }
+    }
+
+    void clear()
+    {
+        for( size_t i = 0; i < m_shards.size(); ++i )
+        {
+            boost::mutex::scoped_lock lk( m_shards[i]->mut );
+            m_shards[i]->map.clear();
+        }
+    }
+
+private:
+    typedef boost::unordered_map< K, V, H > map_t;
+
+    struct shard
+    {
+        boost::mutex mut;
+        map_t map;
+    };
+
+    shard & shard_for( const K & k ) const
+    {
+        return *m_shards[ m_hasher( k ) % m_shards.size() ];
+    }
+
+    std::vector< boost::shared_ptr<shard> > m_shards;
+    H m_hasher;
+};
+
+}} // namespaces
+
+#endif
@@ -0,0 +1,161 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_STMT_CACHE_HPP_
+#define _PLAYDAR_UTILS_STMT_CACHE_HPP_
+
+#include <map>
+#include <string>
+#include <boost/noncopyable.hpp>
+
+#include "sqlite3pp.h"
+
+namespace playdar { namespace utils {
+
+/*
+    Prepared statements for one connection, kept by their SQL text so each
+    is only parsed and planned once. Not thread safe, use it wherever the
+    connection itself is used, under the same lock.
+
+    Statements are borrowed with stmt_cache::query or stmt_cache::command,
+    and reset with their bindings cleared when that goes out of scope, so
+    a half read query doesn't keep a read transaction open. If the same SQL
+    is already borrowed further up the stack, a one-off statement is made.
+*/
+class stmt_cache : private boost::noncopyable
+{
+    template <class Stmt>
+    class reusable : public Stmt
+    {
+    public:
+        reusable( sqlite3pp::database& db, const char* sql )
+            : Stmt( db, sql ), busy( false )
+        {}
+        void release()
+        {
+            this->reset();
+            sqlite3_clear_bindings( this->stmt_ );
+            busy = false;
+        }
+        bool busy;
+    };
+
+    typedef reusable<sqlite3pp::query> query_t;
+    typedef reusable<sqlite3pp::command> command_t;
+
+public:
+    // SQL built on the fly (one per number of ngrams, say) could fill the
+    // cache up forever, so it's emptied when it gets this big:
+    static const size_t max_statements = 128;
+
+    explicit stmt_cache( sqlite3pp::database& db )
+        : m_db( db ), m_prepared( 0 ), m_reused( 0 )
+    {}
+
+    ~stmt_cache()
+    {
+        clear();
+    }
+
+    sqlite3pp::database& db() { return m_db; }
+
+    /// statements prepared, and times one was reused instead.
+    size_t prepared() const { return m_prepared; }
+    size_t reused() const { return m_reused; }
+
+    /// finalize everything that isn't borrowed right now.
+    void clear()
+    {
+        clear( m_queries );
+        clear( m_commands );
+    }
+
+    template <class Stmt>
+    class scoped : private boost::noncopyable
+    {
+    public:
+        scoped( stmt_cache& c, const char* sql )
+            : m_stmt( c.get( c.map_for( (Stmt*)0 ), sql ) ),
+              m_oneoff( m_stmt->busy )
+        {
+            if( m_oneoff ) m_stmt = new reusable<Stmt>( c.m_db, sql );
+            m_stmt->busy = true;
+        }
+        scoped( stmt_cache& c, const std::string& sql )
+            : m_stmt( c.get( c.map_for( (Stmt*)0 ), sql.c_str() ) ),
+              m_oneoff( m_stmt->busy )
+        {
+            if( m_oneoff ) m_stmt = new reusable<Stmt>( c.m_db, sql.c_str() );
+            m_stmt->busy = true;
+        }
+        ~scoped()
+        {
+            if( m_oneoff ) delete m_stmt;
+            else m_stmt->release();
+        }
+        Stmt& operator*() { return *m_stmt; }
+        Stmt* operator->() { return m_stmt; }
+    private:
+        reusable<Stmt>* m_stmt;
+        bool m_oneoff;
+    };
+    typedef scoped<sqlite3pp::query> query;
+    typedef scoped<sqlite3pp::command> command;
+
+private:
+    std::map< std::string, query_t* >& map_for( sqlite3pp::query* ) { return m_queries; }
+    std::map< std::string, command_t* >& map_for( sqlite3pp::command* ) { return m_commands; }
+
+    template <class T>
+    T* get( std::map< std::string, T* >& m, const char* sql )
+    {
+        typename std::map< std::string, T* >::iterator it = m.find( sql );
+        if( it != m.end() )
+        {
+            ++m_reused;
+            return it->second;
+        }
+        if( m_queries.size() + m_commands.size() >= max_statements ) clear();
+        // throws database_error if the sql is bad, like sqlite3pp does:
+        T* s = new T( m_db, sql );
+        ++m_prepared;
+        m[sql] = s;
+        return s;
+    }
+
+    template <class T>
+    static void clear( std::map< std::string, T* >& m )
+    {
+        typename std::map< std::string, T* >::iterator it = m.begin();
+        while( it != m.end() )
+        {
+            if( it->second->busy ) { ++it; continue; }
+            delete it->second;
+            m.erase( it++ );
+        }
+    }
+
+    sqlite3pp::database& m_db;
+    std::map< std::string, query_t* > m_queries;
+    std::map< std::string, command_t* > m_commands;
+    size_t m_prepared, m_reused;
+};
+
+}} // ns
+
+#endif
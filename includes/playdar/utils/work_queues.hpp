@@ -0,0 +1,140 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_WORK_QUEUES_HPP_
+#define _PLAYDAR_UTILS_WORK_QUEUES_HPP_
+
+#include <deque>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace playdar { namespace utils {
+
+/*
+    One queue per worker thread. Work pushed to a queue is normally taken by
+    its own worker, oldest first, and idle workers steal the newest item
+    from other queues. 
+    The count of queued items changes under the lock of the queue the item
+    went in to or came out of, so it's never more than what's really there:
+    a worker only sleeps when there's nothing to take, and never spins.
+*/
+template <class T>
+class work_queues : private boost::noncopyable
+{
+public:
+    explicit work_queues( size_t n )
+        : m_pending( 0 ), m_exiting( false )
+    {
+        if( n == 0 ) n = 1;
+        for( size_t i = 0; i < n; ++i )
+            m_queues.push_back( boost::shared_ptr<queue>(new queue) );
+    }
+
+    size_t size() const { return m_queues.size(); }
+
+    /// queue t for worker idx (modulo the number of workers).
+    void push( size_t idx, const T & t )
+    {
+        {
+            queue & q = *m_queues[ idx % m_queues.size() ];
+            boost::mutex::scoped_lock lk( q.mut );
+            q.pending.push_front( t );
+            boost::mutex::scoped_lock lkp( m_mut );
+            ++m_pending;
+        }
+        m_cond.notify_one();
+    }
+
+    /// for worker idx: wait for an item and take it.
+    /// false once shutdown() is called, anything still queued is dropped.
+    bool take( size_t idx, T & out )
+    {
+        while( true )
+        {
+            {
+                boost::mutex::scoped_lock lk( m_mut );
+                while( m_pending == 0 && !m_exiting ) m_cond.wait( lk );
+                if( m_exiting ) return false;
+            }
+            // fails if another worker got there first, then we wait again:
+            if( try_take( idx, out ) ) return true;
+        }
+    }
+
+    /// wake every worker, and have take() return false from now on.
+    void shutdown()
+    {
+        {
+            boost::mutex::scoped_lock lk( m_mut );
+            m_exiting = true;
+        }
+        m_cond.notify_all();
+    }
+
+    /// items queued right now, across all the queues.
+    size_t pending() const
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        return m_pending;
+    }
+
+private:
+    struct queue
+    {
+        std::deque< T > pending;
+        boost::mutex mut;
+    };
+
+    /// oldest item from our own queue, or the newest from someone else's.
+    bool try_take( size_t idx, T & out )
+    {
+        for( size_t i = 0; i < m_queues.size(); ++i )
+        {
+            queue & q = *m_queues[ (idx + i) % m_queues.size() ];
+            boost::mutex::scoped_lock lk( q.mut );
+            if( q.pending.empty() ) continue;
+            if( i == 0 )
+            {
+                out = q.pending.back();
+                q.pending.pop_back();
+            }
+            else
+            {
+                out = q.pending.front();
+                q.pending.pop_front();
+            }
+            boost::mutex::scoped_lock lkp( m_mut );
+            --m_pending;
+            return true;
+        }
+        return false;
+    }
+
+    std::vector< boost::shared_ptr<queue> > m_queues;
+    mutable boost::mutex m_mut; // protects m_pending and m_exiting
+    boost::condition m_cond;
+    size_t m_pending;
+    bool m_exiting;
+};
+
+}} // namespaces
+
+#endif
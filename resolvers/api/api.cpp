@@ -121,6 +121,17 @@ api::authed_http_handler(const playdar_request& req, playdar_response& resp, pla
             {
                 rq->set_comet_session_id(req.getvar("comet"));
             }
+            // only interested in results within this many ms:
+            if(req.getvar_exists("deadline"))
+            {
+                int ms = atoi(req.getvar("deadline").c_str());
+                if( ms > 0 ) rq->set_deadline_ms( ms );
+            }
+            // start lower weighted resolvers early, for a faster answer:
+            if(req.getvar_exists("hedge"))
+            {
+                rq->set_hedge( req.getvar("hedge") != "0" );
+            }
             if( !rq->isValidTrack() ) // usually caused by empty track name or something.
             {
                 cout << "Tried to dispatch an invalid query, failing." << endl;
@@ -153,19 +164,29 @@ api::authed_http_handler(const playdar_request& req, playdar_response& resp, pla
                 resp = r;
                 return true;
             }
-            Object r;
-            Array qresults;
-            vector< ri_ptr > results = m_pap->get_results(req.getvar("qid"));
+            // optional paging, results are best first:
+            int limit = req.getvar_exists("limit") ? atoi(req.getvar("limit").c_str()) : 0;
+            int offset = req.getvar_exists("offset") ? atoi(req.getvar("offset").c_str()) : 0;
+            vector< ri_ptr > results = m_pap->get_results(req.getvar("qid"), 
+                                                          limit > 0 ? limit : 0,
+                                                          offset > 0 ? offset : 0);
+            // this gets polled a lot, so it's put together from the 
+            // query's and results' cached JSON rather than serialized again:
+            response << "{\"qid\":" << write( Value( req.getvar("qid") ) )
+                     << ",\"refresh_interval\":1000" //TODO something better?
+                     << ",\"query\":" << m_pap->rq(req.getvar("qid"))->get_json_str()
+                     << ",\"results\":[";
+            bool first = true;
             BOOST_FOREACH(ri_ptr rip, results)
             {
-                qresults.push_back( rip->get_json());
+                if( !first ) response << ",";
+                first = false;
+                response << rip->get_json_str();
             }   
-            r.push_back( Pair("qid", req.getvar("qid")) );
-            r.push_back( Pair("refresh_interval", 1000) ); //TODO something better?
-            r.push_back( Pair("query", m_pap->rq(req.getvar("qid"))->get_json()) );
-            r.push_back( Pair("results", qresults) );
-            
-            write_formatted( r, response );
+            response << "]";
+            if( limit > 0 || offset > 0 )
+                response << ",\"num_results\":" << m_pap->num_results(req.getvar("qid"));
+            response << "}";
         }
         else
         {
@@ -17,6 +17,7 @@
 */
 #include "BoffinDb.h"
 #include "boffin_sql.h"
+#include "playdar/utils/normalize.h"
 
 #include <string>
 #include <boost/algorithm/string/trim.hpp>
@@ -26,6 +27,7 @@ using namespace std;
 
 BoffinDb::BoffinDb(const std::string& boffinDbFilePath, const std::string& playdarDbFilePath)
 : m_db( boffinDbFilePath.c_str() )
+, m_stmts( m_db )
 {
     // confirm DB is correct version, or create schema if first run
     check_db();
@@ -35,6 +37,7 @@ BoffinDb::BoffinDb(const std::string& boffinDbFilePath, const std::string& playd
 void
 BoffinDb::check_db()
 {
+    bool upgrade = false;
     try
     {
       sqlite3pp::query qry(m_db, "SELECT value FROM boffin_system WHERE key = 'schema_version'");
@@ -52,7 +55,11 @@ BoffinDb::check_db()
       cout << "Boffin database schema detected as version " << val << endl;
       // check the schema version is what we expect
       // TODO auto-upgrade to newest schema version as needed.
-      if( val != "1" )
+      if( val == "1" )
+      {
+        upgrade = true;
+      }
+      else if( val != "2" )
       {
         cerr << "Boffin schema version too old. TODO handle auto-upgrades" << endl;
         throw; // not caught here
@@ -66,7 +73,60 @@ BoffinDb::check_db()
       cout << "database_error: " << err.what() << endl;
       create_db_schema();
     }
-    
+    if( upgrade ) upgrade_tags();
+}
+
+/// schema 1 -> 2. tag names are stored as sortname(), which is now
+/// utils::normalize, so redo them. tags that end up with the same name
+/// are merged in to the oldest one.
+void
+BoffinDb::upgrade_tags()
+{
+    cout << "Upgrading boffin database schema to version 2, redoing tag names.." << endl;
+    static const char * const merge_sql[] = {
+        "CREATE TEMP TABLE merge AS SELECT a.rowid AS dup, "
+            "(SELECT MIN(b.rowid) FROM tag b WHERE b.name = a.name) AS keep FROM tag a",
+        "DELETE FROM merge WHERE dup = keep",
+        "UPDATE track_tag SET tag = (SELECT keep FROM merge WHERE dup = track_tag.tag) "
+            "WHERE tag IN (SELECT dup FROM merge)",
+        "DELETE FROM tag WHERE rowid IN (SELECT dup FROM merge)",
+        "DROP TABLE merge",
+        // a track tagged with both will have it twice now:
+        "DELETE FROM track_tag WHERE rowid NOT IN "
+            "(SELECT MIN(rowid) FROM track_tag GROUP BY track, tag)",
+        "CREATE UNIQUE INDEX tag_name_idx ON tag(name)",
+        "UPDATE boffin_system SET value = '2' WHERE key = 'schema_version'",
+        0 };
+
+    sqlite3pp::transaction tx(m_db);
+    m_db.execute( "DROP INDEX IF EXISTS tag_name_idx" );
+    std::vector< std::pair<int, std::string> > names;
+    {
+        sqlite3pp::query qry(m_db, "SELECT rowid, name FROM tag");
+        for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+            names.push_back( std::make_pair( (*i).get<int>(0), (*i).get<std::string>(1) ) );
+        }
+    }
+    sqlite3pp::command cmd(m_db, "UPDATE tag SET name = ? WHERE rowid = ?");
+    for( size_t i = 0; i < names.size(); ++i )
+    {
+        std::string sn = sortname(names[i].second);
+        cmd.bind(1, sn.c_str(), true);
+        cmd.bind(2, names[i].first);
+        cmd.execute();
+        cmd.reset();
+    }
+    for( int i = 0; merge_sql[i]; ++i )
+    {
+        if( m_db.execute( merge_sql[i] ) != SQLITE_OK )
+        {
+            cerr << "Upgrade failed at: " << merge_sql[i] << endl;
+            tx.rollback();
+            throw sqlite3pp::database_error( m_db );
+        }
+    }
+    tx.commit();
+    cout << "Boffin database upgraded to version 2" << endl;
 }
 
 void
@@ -99,17 +159,15 @@ BoffinDb::get_tag_cloud(int limit /* = 0 */)
         "INNER JOIN pd.file ON pd.file_join.file = pd.file.id "
         "GROUP BY tag.rowid ";
 
-    sqlite3pp::query qry(m_db);
-    if (limit <= 0) {
-        qry.prepare(query);
-    } else {
-        qry.prepare(string(query).append(" ORDER BY count(weight) LIMIT ?").data());
-        qry.bind(1, limit);
+    playdar::utils::stmt_cache::query qry(m_stmts,
+        limit <= 0 ? string(query) : string(query).append(" ORDER BY count(weight) LIMIT ?"));
+    if (limit > 0) {
+        qry->bind(1, limit);
     }
 
     boost::shared_ptr<TagCloudVec> p( new TagCloudVec() );
     float maxWeight = 0;
-    for(sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
+    for(sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
         p->push_back( i->get_columns<string, float, int, int>(0, 1, 2, 3) );
         maxWeight = max( maxWeight, p->back().get<1>() );
     }
@@ -121,9 +179,9 @@ BoffinDb::get_tag_cloud(int limit /* = 0 */)
 boost::tuple<int, int>
 BoffinDb::summary()
 {
-    sqlite3pp::query qry(m_db, "SELECT count(duration), sum(duration) FROM pd.file");
-    sqlite3pp::query::iterator i = qry.begin();
-    if (i != qry.end()) {
+    playdar::utils::stmt_cache::query qry(m_stmts, "SELECT count(duration), sum(duration) FROM pd.file");
+    sqlite3pp::query::iterator i = qry->begin();
+    if (i != qry->end()) {
         return i->get_columns<int, int>(0, 1);
     }
     return boost::tuple<int, int>(-1, -1);
@@ -174,16 +232,18 @@ BoffinDb::get_tag_id(const std::string& tag, BoffinDb::CreateFlag create /* = Bo
 {
     std::string tag_sortname(sortname(tag));
 
-    sqlite3pp::query qry(m_db, "SELECT rowid FROM tag WHERE name = ?");
-    qry.bind(1, tag_sortname.data());
-    sqlite3pp::query::iterator it = qry.begin();
-    if (it != qry.end())
-        return it->get<int>(0);
+    {
+        playdar::utils::stmt_cache::query qry(m_stmts, "SELECT rowid FROM tag WHERE name = ?");
+        qry->bind(1, tag_sortname.data());
+        sqlite3pp::query::iterator it = qry->begin();
+        if (it != qry->end())
+            return it->get<int>(0);
+    }
 
     if (create == BoffinDb::Create) {
-        sqlite3pp::command cmd(m_db, "INSERT INTO tag (name) VALUES (?)");
-        cmd.bind(1, tag_sortname.data());
-        int result = cmd.execute();
+        playdar::utils::stmt_cache::command cmd(m_stmts, "INSERT INTO tag (name) VALUES (?)");
+        cmd->bind(1, tag_sortname.data());
+        int result = cmd->execute();
         if (SQLITE_OK == result)
             return (int) m_db.last_insert_rowid();
     }
@@ -198,10 +258,10 @@ BoffinDb::get_artist_id(const std::string& artist)
     std::string artist_sortname(sortname(artist));
 
     {
-        sqlite3pp::query qry(m_db, "SELECT id FROM pd.artist WHERE sortname = ?");
-        qry.bind(1, artist_sortname.data());
-        sqlite3pp::query::iterator it = qry.begin();
-        if (it != qry.end()) {
+        playdar::utils::stmt_cache::query qry(m_stmts, "SELECT id FROM pd.artist WHERE sortname = ?");
+        qry->bind(1, artist_sortname.data());
+        sqlite3pp::query::iterator it = qry->begin();
+        if (it != qry->end()) {
             return it->get<int>(0);
         }
     }
@@ -212,8 +272,6 @@ BoffinDb::get_artist_id(const std::string& artist)
 string
 BoffinDb::sortname(const string& name)
 {
-    string data(name);
-    std::transform(data.begin(), data.end(), data.begin(), ::tolower);
-    boost::trim(data);
-    return data;
+    // must match Library::sortname, we look up its artists by it:
+    return playdar::utils::normalize(name);
 }
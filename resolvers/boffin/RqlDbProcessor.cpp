@@ -214,12 +214,12 @@ RqlDbProcessor::process(
         RqlDbProcessor(begin, end, library, similarArtists).process(params) + 
         ") " + query2;
 //    cout << sql << endl;  // debug
-    sqlite3pp::query qry(library.db(), sql.data());
+    playdar::utils::stmt_cache::query qry(library.stmts(), sql);
     int i = 1;
     BOOST_FOREACH(const string& s, params) {
-        qry.bind(i, s.data());
+        qry->bind(i, s.data());
         i++;
     }
-    cb(qry);
+    cb(*qry);
 }
 
@@ -206,6 +206,8 @@ void
 boffin::start_resolving(boost::shared_ptr<ResolverQuery> rq)
 {
     queue_work( boost::bind( &boffin::resolve, this, rq ) );
+    // one worker thread, so this runs once resolve has finished:
+    queue_work( boost::bind( &PluginAdaptor::report_done, m_pap, rq->id() ) );
 }
 
 
@@ -240,6 +242,11 @@ query_to_summary(boost::tuple<int, int>& summary, sqlite3pp::query& qry)
 void
 boffin::resolve(boost::shared_ptr<ResolverQuery> rq)
 {
+    if (rq->finished()) {
+        // solved or cancelled while it was queued
+        m_pap->report_skipped(rq->id());
+        return;
+    }
     if (rq->param_exists("boffin_tracks") && rq->param_type("boffin_tracks") == json_spirit::str_type) {
         parser p;
         if (p.parse(rq->param("boffin_tracks").get_str())) {
@@ -252,29 +259,35 @@ boffin::resolve(boost::shared_ptr<ResolverQuery> rq)
 
             string hostname( m_pap->hostname() );   // cache this because we can have many many results
 
-            const int reportingChunkSize = 100;      // report x at a time to the resolver
+            const size_t reportingChunkSize = 100;   // report x at a time to the resolver
             std::vector< json_spirit::Object > results;
             results.reserve(reportingChunkSize);    // avoid vector resizing
 
-            BOOST_FOREACH(const TrackResult& t, *rqlResults) {
-                json_spirit::Object js;
-                js.reserve(13);
-                playdar::ResolvedItemBuilder::createFromFid( m_db->db(), t.trackId, js );
-                js.push_back( json_spirit::Pair( "sid", m_pap->gen_uuid()) );
-                js.push_back( json_spirit::Pair( "source", hostname) );
-                js.push_back( json_spirit::Pair( "weight", t.weight) );
-                results.push_back( js );
-
-                if ((results.size() % reportingChunkSize) == 0) {
+            // build each chunk's items in one go:
+            ResultSet::const_iterator it = rqlResults->begin();
+            while (it != rqlResults->end()) {
+                std::vector<int> fids;
+                std::vector<float> weights;
+                for (; it != rqlResults->end() && fids.size() < reportingChunkSize; ++it) {
+                    fids.push_back( it->trackId );
+                    weights.push_back( it->weight );
+                }
+                std::vector< json_spirit::Object > items;
+                playdar::ResolvedItemBuilder::createFromFids( m_db->stmts(), fids, items );
+                for (size_t i = 0; i < items.size(); ++i) {
+                    json_spirit::Object& js = items[i];
+                    if (js.empty()) continue;
+                    js.push_back( json_spirit::Pair( "sid", m_pap->gen_sid()) );
+                    js.push_back( json_spirit::Pair( "source", hostname) );
+                    js.push_back( json_spirit::Pair( "weight", weights[i]) );
+                    results.push_back( js );
+                }
+                if (results.size()) {
                     bool cancel = !m_pap->report_results(rq->id(), results);
                     results.clear();
-                    results.reserve(reportingChunkSize);
-                    if (cancel) break;
+                    if (cancel || rq->finished()) break;
                 }
             }
-            if (results.size()) {
-                m_pap->report_results(rq->id(), results);  // left-overs
-            }
             return;
         } 
         parseFail(p.getErrorLine(), p.getErrorOffset());
@@ -297,7 +310,7 @@ boffin::resolve(boost::shared_ptr<ResolverQuery> rq)
                     "SELECT name, sum(weight), count(weight), sum(pd.file.duration) "
                     "FROM track_tag "
                     "INNER JOIN tag ON track_tag.tag = tag.rowid "
-                    "INNER JOIN pd.file_join ON track_tag.track = pd.file_join.track "
+                    "INNER JOIN pd.file_join ON track_tag.track = pd.file_join.track "
                     "INNER JOIN pd.file ON pd.file_join.file = pd.file.id "
                     "WHERE track_tag.track IN ",
                     "GROUP BY tag.rowid",
@@ -338,7 +351,7 @@ boffin::resolve(boost::shared_ptr<ResolverQuery> rq)
                 bool ok = RqlDbProcessor::parseAndProcess(
                     rql, 
                     "SELECT count(pd.file.duration), sum(pd.file.duration) "
-                    "FROM pd.file_join "
+                    "FROM pd.file_join "
                     "INNER JOIN pd.file ON pd.file_join.file = pd.file.id "
                     "WHERE pd.file_join.track IN ",
                     "",
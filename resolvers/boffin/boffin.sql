@@ -22,4 +22,4 @@ CREATE TABLE IF NOT EXISTS boffin_system (
     key TEXT NOT NULL PRIMARY KEY,
     value TEXT NOT NULL DEFAULT ''
 );
-INSERT INTO boffin_system(key,value) VALUES('schema_version', '1');
+INSERT INTO boffin_system(key,value) VALUES('schema_version', '2');
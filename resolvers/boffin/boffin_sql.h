@@ -36,7 +36,7 @@ static const char * boffin_schema_sql =
 "    key TEXT NOT NULL PRIMARY KEY,"
 "    value TEXT NOT NULL DEFAULT ''"
 ");"
-"INSERT INTO boffin_system(key,value) VALUES('schema_version', '1');"
+"INSERT INTO boffin_system(key,value) VALUES('schema_version', '2');"
     ;
 
 const char * get_boffin_sql()
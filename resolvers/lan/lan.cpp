@@ -129,11 +129,14 @@ lan::setup_endpoints()
 void
 lan::start_resolving(boost::shared_ptr<ResolverQuery> rq)
 {
-    using namespace json_spirit;
-    ostringstream querystr;
-    write_formatted( rq->get_json(), querystr );
-    //cout << "Resolving: " << querystr.str() << " through the LAN plugin" << endl;
-    async_send(querystr.str());
+    if( rq->finished() )
+    {
+        // solved by a hedged tier above us, save the broadcast
+        m_pap->report_skipped( rq->id() );
+        return;
+    }
+    // the query's JSON is cached, so fanning out doesn't serialize it again:
+    async_send( rq->get_json_str() );
 }
 
 void 
@@ -202,13 +205,13 @@ lan::async_send( const string& message )
 {
     BOOST_FOREACH( boost::asio::ip::udp::endpoint * ep, m_endpoints )
     {
-        async_send( ep, message ); 
+        async_send( *ep, message ); 
     }
 }
 
 /// send to specific endpoints:
 void 
-lan::async_send(boost::asio::ip::udp::endpoint * remote_endpoint,
+lan::async_send(boost::asio::ip::udp::endpoint remote_endpoint,
                        const string& message)                       
 {
     if(message.length()>max_length)
@@ -221,9 +224,20 @@ lan::async_send(boost::asio::ip::udp::endpoint * remote_endpoint,
     //     << "(" << message << ")" << endl;
     char * buf = (char*)malloc(message.length());
     memcpy(buf, message.data(), message.length());
+    // queries arrive from several pipeline dispatch threads, so hand the 
+    // actual send to our io_service thread rather than touch the socket here.
+    // the endpoint is bound by value, the caller's is gone by then:
+    m_io_service->post( boost::bind(&lan::do_send, this, 
+                                    remote_endpoint, buf, message.length()) );
+}
+
+void
+lan::do_send(boost::asio::ip::udp::endpoint remote_endpoint,
+             char * buf, size_t len)
+{
     socket_->async_send_to(     
-            boost::asio::buffer(buf,message.length()), 
-            *remote_endpoint,
+            boost::asio::buffer(buf,len), 
+            remote_endpoint,
             boost::bind(&lan::handle_send, this,
                 boost::asio::placeholders::error,
                 boost::asio::placeholders::bytes_transferred,
@@ -402,17 +416,12 @@ lan::send_response( query_uid qid,
     //     << " score: " << rip->score()
     //     << endl;
     using namespace json_spirit;
-    Object response;
-    response.reserve(3);
-    response.push_back( Pair("_msgtype", "result") );
-    response.push_back( Pair("qid", qid) );
-    
-    // strip the url from _a copy_ of the result_item
-    ResolvedItem tmp( *rip );
-    tmp.rm_json_value( "url" );
-    response.push_back( Pair("result", tmp.get_json()) );
+    // the result's cached JSON, without its url:
+    ostringstream response;
+    response << "{\"_msgtype\":\"result\",\"qid\":" << write( Value( qid ) )
+             << ",\"result\":" << rip->get_json_str( true ) << "}";
 
-    async_send( &sep, write_formatted( response ) );
+    async_send( sep, response.str() );
 }
 
 // LAN presence stuff.
@@ -444,7 +453,7 @@ lan::send_pong(boost::asio::ip::udp::endpoint sender_endpoint)
     o.push_back( Pair("http_port", m_pap->get("http_port", 8888)) );//TODO get from config?
     ostringstream os;
     write_formatted( o, os );
-    async_send( &sender_endpoint, os.str() );
+    async_send( sender_endpoint, os.str() );
 }
 
 /// called when we shutdown - uses a blocking send due to shutdown mechanics.
@@ -99,8 +99,10 @@ private:
                       char * scratch );
 
     void async_send( const std::string& message ); 
-    void async_send( boost::asio::ip::udp::endpoint * remote_endpoint,
+    void async_send( boost::asio::ip::udp::endpoint remote_endpoint,
                      const std::string& message );
+    void do_send( boost::asio::ip::udp::endpoint remote_endpoint,
+                  char * buf, size_t len );
 
     boost::asio::ip::udp::socket * socket_;
     boost::asio::ip::udp::endpoint sender_endpoint_;
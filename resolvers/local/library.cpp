@@ -26,29 +26,98 @@
 #include <boost/algorithm/string.hpp>
 
 #include "library_sql.h"
+#include "playdar/utils/normalize.h"
 
 using namespace std;
 
 namespace playdar {
 
+// how long a connection waits on another's lock before giving up:
+static const int busy_timeout_ms = 5000;
+// for each reader. mmap'd pages are shared between them, the cache isn't:
+static const int reader_mmap_bytes = 256 * 1024 * 1024;
+static const int reader_cache_pages = 4000;
 
-Library::Library(const string& dbfilepath)
- : m_db( dbfilepath.c_str() )
+Library::Library(const string& dbfilepath, unsigned int readers)
+ : m_db( dbfilepath.c_str() ), m_stmts( m_db )
 {
     m_dbfilepath = dbfilepath;
     // confirm DB is correct version, or create schema if first run
     check_db();
-    cout << "library DB opened ok" << endl;
+    m_db.set_busy_timeout( busy_timeout_ms );
+    // files are looked up by id in file_join, dbs made before that was
+    // indexed get it here:
+    m_db.execute( "CREATE INDEX IF NOT EXISTS file_join_file ON file_join(file)" );
+    // WAL lets the scanner write while playdar's reading, without either
+    // waiting on the other. it sticks to the db file once set. sqlites
+    // older than 3.7 don't have it, and just say what mode they're in.
+    string mode;
+    {
+        sqlite3pp::query qry(m_db, "PRAGMA journal_mode=WAL");
+        for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+            mode = (*i).get<string>(0);
+        }
+    }
+    for( unsigned int i = 0; i < readers; ++i )
+    {
+        sqlite3pp::database* db = new sqlite3pp::database( dbfilepath.c_str() );
+        tune_reader( *db );
+        m_readers.push_back( db );
+        m_reader_stmts.push_back( new utils::stmt_cache( *db ) );
+    }
+    m_free_readers = m_reader_stmts;
+    cout << "library DB opened ok, journal mode " << mode 
+         << ", " << readers << " readers" << endl;
 }
 
 Library::~Library()
 {
+    BOOST_FOREACH( utils::stmt_cache* c, m_reader_stmts ) delete c;
+    BOOST_FOREACH( sqlite3pp::database* db, m_readers ) delete db;
     cout << "DTOR library" << endl;
 }
 
+// static
+void
+Library::tune_reader( sqlite3pp::database& db )
+{
+    db.set_busy_timeout( busy_timeout_ms );
+    // pragmas sqlite doesn't know are ignored. query_only is 3.8, 
+    // mmap_size 3.7.17:
+    db.execute( "PRAGMA query_only=1" );
+    db.executef( "PRAGMA mmap_size=%d", reader_mmap_bytes );
+    db.executef( "PRAGMA cache_size=%d", reader_cache_pages );
+}
+
+Library::reader::reader( Library& lib )
+ : m_lib( lib ), m_conn( 0 ), m_lock( lib.m_mut, boost::defer_lock )
+{
+    if( lib.m_readers.empty() )
+    {
+        m_lock.lock();
+        m_conn = &lib.m_stmts;
+        return;
+    }
+    boost::mutex::scoped_lock lk( lib.m_readers_mut );
+    while( lib.m_free_readers.empty() ) lib.m_readers_cond.wait( lk );
+    m_conn = lib.m_free_readers.back();
+    lib.m_free_readers.pop_back();
+}
+
+Library::reader::~reader()
+{
+    if( m_lock.owns_lock() ) return; // main connection, unlocked as we go
+    {
+        boost::mutex::scoped_lock lk( m_lib.m_readers_mut );
+        m_lib.m_free_readers.push_back( m_conn );
+    }
+    m_lib.m_readers_cond.notify_one();
+}
+
 void
 Library::check_db()
 {
+    bool upgrade = false;
     try
     {
       sqlite3pp::query qry(m_db, "SELECT value FROM playdar_system WHERE key = 'schema_version'");
@@ -66,7 +135,11 @@ Library::check_db()
       cout << "Database schema detected as version " << val << endl;
       // check the schema version is what we expect
       // TODO auto-upgrade to newest schema version as needed.
-      if( val != "2" )
+      if( val == "2" )
+      {
+        upgrade = true;
+      }
+      else if( val != "3" )
       {
         cerr << "Schema version too old. TODO handle auto-upgrades" << endl;
         cerr << "To upgrade from 1->2, run this: alter table playdar_auth add column ua text not null default \"\"; update playdar_system set value=\"2\" where key=\"schema_version\";"
@@ -83,7 +156,106 @@ Library::check_db()
       cout << "database_error: " << err.what() << endl;
       create_db_schema();
     }
+    if( upgrade ) upgrade_sortnames();
+}
+
+/// schema 2 -> 3. sortnames are made by utils::normalize now, which folds
+/// accents and punctuation, so work them all out again. names that now 
+/// have the same sortname are merged in to the oldest one, and the ngram
+/// search indexes are rebuilt from the new sortnames. all or nothing.
+void
+Library::upgrade_sortnames()
+{
+    cout << "Upgrading database schema to version 3, redoing sortnames.." << endl;
+    static const char * const tables[] = { "artist", "album", "track", 0 };
+    // unique indexes go while there are duplicates, back at the end:
+    static const char * const drop_sql[] = {
+        "DROP INDEX IF EXISTS artist_sortname",
+        "DROP INDEX IF EXISTS album_artist_sortname",
+        "DROP INDEX IF EXISTS track_artist_sortname",
+        0 };
+    static const char * const merge_sql[] = {
+        "CREATE TEMP TABLE merge AS SELECT a.id AS dup, "
+            "(SELECT MIN(b.id) FROM artist b WHERE b.sortname = a.sortname) AS keep FROM artist a",
+        "DELETE FROM merge WHERE dup = keep",
+        "UPDATE album SET artist = (SELECT keep FROM merge WHERE dup = album.artist) "
+            "WHERE artist IN (SELECT dup FROM merge)",
+        "UPDATE track SET artist = (SELECT keep FROM merge WHERE dup = track.artist) "
+            "WHERE artist IN (SELECT dup FROM merge)",
+        "UPDATE file_join SET artist = (SELECT keep FROM merge WHERE dup = file_join.artist) "
+            "WHERE artist IN (SELECT dup FROM merge)",
+        "DELETE FROM artist WHERE id IN (SELECT dup FROM merge)",
+        "DROP TABLE merge",
+        
+        "CREATE TEMP TABLE merge AS SELECT a.id AS dup, "
+            "(SELECT MIN(b.id) FROM album b WHERE b.artist = a.artist AND b.sortname = a.sortname) AS keep FROM album a",
+        "DELETE FROM merge WHERE dup = keep",
+        "UPDATE file_join SET album = (SELECT keep FROM merge WHERE dup = file_join.album) "
+            "WHERE album IN (SELECT dup FROM merge)",
+        "DELETE FROM album WHERE id IN (SELECT dup FROM merge)",
+        "DROP TABLE merge",
+        
+        "CREATE TEMP TABLE merge AS SELECT a.id AS dup, "
+            "(SELECT MIN(b.id) FROM track b WHERE b.artist = a.artist AND b.sortname = a.sortname) AS keep FROM track a",
+        "DELETE FROM merge WHERE dup = keep",
+        "UPDATE file_join SET track = (SELECT keep FROM merge WHERE dup = file_join.track) "
+            "WHERE track IN (SELECT dup FROM merge)",
+        "DELETE FROM track WHERE id IN (SELECT dup FROM merge)",
+        "DROP TABLE merge",
+        
+        "CREATE UNIQUE INDEX artist_sortname ON artist(sortname)",
+        "CREATE UNIQUE INDEX album_artist_sortname ON album(artist,sortname)",
+        "CREATE UNIQUE INDEX track_artist_sortname ON track(artist,sortname)",
+        "UPDATE playdar_system SET value = '3' WHERE key = 'schema_version'",
+        0 };
     
+    sqlite3pp::transaction tx(m_db);
+    for( int i = 0; drop_sql[i]; ++i ) m_db.execute( drop_sql[i] );
+    for( int t = 0; tables[t]; ++t )
+    {
+        vector< pair<int, string> > names;
+        {
+            sqlite3pp::query qry(m_db, (string("SELECT id, name FROM ") + tables[t]).c_str());
+            for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+                names.push_back( make_pair( (*i).get<int>(0), (*i).get<string>(1) ) );
+            }
+        }
+        string sql = string("UPDATE ") + tables[t] + " SET sortname = ? WHERE id = ?";
+        sqlite3pp::command cmd(m_db, sql.c_str());
+        for( size_t i = 0; i < names.size(); ++i )
+        {
+            string sn = sortname(names[i].second);
+            cmd.bind(1, sn.c_str(), true);
+            cmd.bind(2, names[i].first);
+            if( cmd.execute() != SQLITE_OK )
+            {
+                cerr << "Upgrade failed updating " << tables[t] << " " << names[i].first << endl;
+                tx.rollback();
+                throw sqlite3pp::database_error( m_db );
+            }
+            cmd.reset();
+        }
+    }
+    for( int i = 0; merge_sql[i]; ++i )
+    {
+        if( m_db.execute( merge_sql[i] ) != SQLITE_OK )
+        {
+            cerr << "Upgrade failed at: " << merge_sql[i] << endl;
+            tx.rollback();
+            throw sqlite3pp::database_error( m_db );
+        }
+    }
+    for( int t = 0; tables[t]; ++t )
+    {
+        if( !build_index_nolock( tables[t] ) )
+        {
+            cerr << "Upgrade failed indexing " << tables[t] << endl;
+            tx.rollback();
+            throw sqlite3pp::database_error( m_db );
+        }
+    }
+    tx.commit();
+    cout << "Database upgraded to version 3" << endl;
 }
 
 void
@@ -108,20 +280,22 @@ bool
 Library::remove_file( const string& url )
 {
     boost::mutex::scoped_lock lock(m_mut);
-    sqlite3pp::query qry(m_db, "SELECT id FROM file WHERE url = ?");
-    qry.bind(1, url.c_str(), true);
     int fileid = 0;
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
-        fileid = (*i).get<int>(0);
-        break; // should only be one row
+    {
+        utils::stmt_cache::query qry(m_stmts, "SELECT id FROM file WHERE url = ?");
+        qry->bind(1, url.c_str(), true);
+        for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
+            fileid = (*i).get<int>(0);
+            break; // should only be one row
+        }
     }
     if(fileid==0) return false;
-    sqlite3pp::command cmd1(m_db, "DELETE FROM file_join WHERE file = ?");
-    sqlite3pp::command cmd2(m_db, "DELETE FROM file WHERE id = ?");
-    cmd1.bind(1, fileid);
-    cmd2.bind(1, fileid);
-    cmd1.execute();
-    cmd2.execute();
+    utils::stmt_cache::command cmd1(m_stmts, "DELETE FROM file_join WHERE file = ?");
+    utils::stmt_cache::command cmd2(m_stmts, "DELETE FROM file WHERE id = ?");
+    cmd1->bind(1, fileid);
+    cmd2->bind(1, fileid);
+    cmd1->execute();
+    cmd2->execute();
     return true;
 }
 
@@ -144,19 +318,23 @@ Library::add_file(  const string& url, int mtime, int size, const string& md5, c
     int fileid = 0;
     remove_file(url);
 
-    sqlite3pp::command cmd(m_db, "INSERT INTO file(url, size, mtime, md5, mimetype, duration, bitrate) VALUES (?, ?, ?, ?, ?, ?, ?)");
-    cmd.bind(1, url.c_str(), true);
-    cmd.bind(2, size);
-    cmd.bind(3, mtime);
-    cmd.bind(4, md5.c_str(), true);
-    cmd.bind(5, mimetype.c_str(), true);
-    cmd.bind(6, duration);
-    cmd.bind(7, bitrate);
-    if(cmd.execute() != SQLITE_OK){
-        cerr<<"Error inserting into file table"<<endl;
-        return 0;
+    {
+        // the statement cache is the main connection's, so lock for it:
+        boost::mutex::scoped_lock lock(m_mut);
+        utils::stmt_cache::command cmd(m_stmts, "INSERT INTO file(url, size, mtime, md5, mimetype, duration, bitrate) VALUES (?, ?, ?, ?, ?, ?, ?)");
+        cmd->bind(1, url.c_str(), true);
+        cmd->bind(2, size);
+        cmd->bind(3, mtime);
+        cmd->bind(4, md5.c_str(), true);
+        cmd->bind(5, mimetype.c_str(), true);
+        cmd->bind(6, duration);
+        cmd->bind(7, bitrate);
+        if(cmd->execute() != SQLITE_OK){
+            cerr<<"Error inserting into file table"<<endl;
+            return 0;
+        }
+        fileid = static_cast<int>( m_db.last_insert_rowid() );
     }
-    fileid = static_cast<int>( m_db.last_insert_rowid() );
     int artid = get_artist_id(artist);
     if(artid<1){
         return 0;
@@ -167,13 +345,13 @@ Library::add_file(  const string& url, int mtime, int size, const string& md5, c
     }
     int albid = get_album_id(artid, album);
     // Now add the association
-    sqlite3pp::command cmd2(m_db, "INSERT INTO file_join(file, artist ,album, track) VALUES (?,?,?,?)");
-    cmd2.bind(1, fileid);
-    cmd2.bind(2, artid);
-    cmd2.bind(3, albid);
-    cmd2.bind(4, trkid);
     boost::mutex::scoped_lock lock(m_mut);
-    if(cmd2.execute() != SQLITE_OK){
+    utils::stmt_cache::command cmd2(m_stmts, "INSERT INTO file_join(file, artist ,album, track) VALUES (?,?,?,?)");
+    cmd2->bind(1, fileid);
+    cmd2->bind(2, artid);
+    cmd2->bind(3, albid);
+    cmd2->bind(4, trkid);
+    if(cmd2->execute() != SQLITE_OK){
         cerr<<"Error inserting into file_join table"<<endl;
         return 0;
     }
@@ -187,9 +365,9 @@ Library::get_artist_id(const string& name_orig)
     int id = 0;
     string sortname = Library::sortname(name_orig);
     if((id = m_artistcache[sortname])) return id;
-    sqlite3pp::query qry(m_db, "SELECT id FROM artist WHERE sortname = ?");
-    qry.bind(1, sortname.c_str(), true);
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::stmt_cache::query qry(m_stmts, "SELECT id FROM artist WHERE sortname = ?");
+    qry->bind(1, sortname.c_str(), true);
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         id = (*i).get<int>(0);
         break; // should only be one row
     }
@@ -199,10 +377,10 @@ Library::get_artist_id(const string& name_orig)
         return id;
     }
     // not found, insert it.
-    sqlite3pp::command cmd(m_db, "INSERT INTO artist(id,name,sortname) VALUES(NULL,?,?)");
-    cmd.bind(1,name_orig.c_str(),true);
-    cmd.bind(2,sortname.c_str(),true);
-    if(SQLITE_OK != cmd.execute()){
+    utils::stmt_cache::command cmd(m_stmts, "INSERT INTO artist(id,name,sortname) VALUES(NULL,?,?)");
+    cmd->bind(1,name_orig.c_str(),true);
+    cmd->bind(2,sortname.c_str(),true);
+    if(SQLITE_OK != cmd->execute()){
         cerr << "Failed to insert artist: " << name_orig << endl;
         return 0;
     }
@@ -219,10 +397,10 @@ Library::get_track_id(int artistid, const string& name_orig)
     int id = 0;
     string sortname = Library::sortname(name_orig);
     if((id = m_trackcache[artistid][sortname])) return id;
-    sqlite3pp::query qry(m_db, "SELECT id FROM track WHERE artist = ? AND sortname = ?");
-    qry.bind(1, artistid);
-    qry.bind(2, sortname.c_str(), true);
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::stmt_cache::query qry(m_stmts, "SELECT id FROM track WHERE artist = ? AND sortname = ?");
+    qry->bind(1, artistid);
+    qry->bind(2, sortname.c_str(), true);
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         id = (*i).get<int>(0);
         break; // should only be one row
     }
@@ -232,11 +410,11 @@ Library::get_track_id(int artistid, const string& name_orig)
         return id;
     }
     // not found, insert it.
-    sqlite3pp::command cmd(m_db, "INSERT INTO track(id,artist,name,sortname) VALUES(NULL,?,?,?)");
-    cmd.bind(1, artistid);
-    cmd.bind(2, name_orig.c_str(), true);
-    cmd.bind(3, sortname.c_str(), true);
-    if(SQLITE_OK != cmd.execute()){
+    utils::stmt_cache::command cmd(m_stmts, "INSERT INTO track(id,artist,name,sortname) VALUES(NULL,?,?,?)");
+    cmd->bind(1, artistid);
+    cmd->bind(2, name_orig.c_str(), true);
+    cmd->bind(3, sortname.c_str(), true);
+    if(SQLITE_OK != cmd->execute()){
         cerr << "Failed to insert track: " << name_orig << endl;
         return 0;
     }
@@ -253,10 +431,10 @@ Library::get_album_id(int artistid, const string& name_orig)
     int id = 0;
     string sortname = Library::sortname(name_orig);
     if((id = m_albumcache[artistid][sortname])) return id;
-    sqlite3pp::query qry(m_db, "SELECT id FROM album WHERE artist = ? AND sortname = ?");
-    qry.bind(1, artistid);
-    qry.bind(2, sortname.c_str(), true);
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::stmt_cache::query qry(m_stmts, "SELECT id FROM album WHERE artist = ? AND sortname = ?");
+    qry->bind(1, artistid);
+    qry->bind(2, sortname.c_str(), true);
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         id = (*i).get<int>(0);
         break; // should only be one row
     }
@@ -266,11 +444,11 @@ Library::get_album_id(int artistid, const string& name_orig)
         return id;
     }
     // not found, insert it.
-    sqlite3pp::command cmd(m_db, "INSERT INTO album(id,artist,name,sortname) VALUES(NULL,?,?,?)");
-    cmd.bind(1, artistid);
-    cmd.bind(2, name_orig.c_str(), true);
-    cmd.bind(3, sortname.c_str(), true);
-    if(SQLITE_OK != cmd.execute()){
+    utils::stmt_cache::command cmd(m_stmts, "INSERT INTO album(id,artist,name,sortname) VALUES(NULL,?,?,?)");
+    cmd->bind(1, artistid);
+    cmd->bind(2, name_orig.c_str(), true);
+    cmd->bind(3, sortname.c_str(), true);
+    if(SQLITE_OK != cmd->execute()){
         cerr << "Failed to insert album: " << name_orig << endl;
         return 0;
     }
@@ -283,7 +461,7 @@ Library::get_album_id(int artistid, const string& name_orig)
 vector<scorepair>
 Library::search_catalogue(string table, string name_orig)
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader rd(*this);
     vector<scorepair> results;
     if(table != "artist" && table != "track" && table != "album") return results;
     if(name_orig.length()<3) return results;
@@ -300,12 +478,12 @@ Library::search_catalogue(string table, string name_orig)
     sql +=       "FROM " + table + "_search_index as s ";
     sql +=       "WHERE ngram IN (" + q + ") ";
     sql +=       "GROUP BY s.id ORDER BY sum(s.num) DESC LIMIT 10";
-    sqlite3pp::query qry(m_db, sql.c_str());
+    utils::stmt_cache::query qry(rd.stmts(), sql.c_str());
     int numn = 0;
     for(iter = ngrammap.begin(); iter!=ngrammap.end(); ++iter){
-        qry.bind(++numn, iter->first.c_str(), true);
+        qry->bind(++numn, iter->first.c_str(), true);
     }
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
+    for (sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
         scorepair sp;
         sp.id = (*i).get<int>(0);
         sp.score = (float) (*i).get<int>(1);
@@ -317,7 +495,7 @@ Library::search_catalogue(string table, string name_orig)
 vector<scorepair>
 Library::search_catalogue_for_artist(int artistid, string table, string name_orig)
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader rd(*this);
     vector<scorepair> results;
     if(table != "track" && table != "album") return results;
     if(name_orig.length()<3) return results;
@@ -336,13 +514,13 @@ Library::search_catalogue_for_artist(int artistid, string table, string name_ori
     sql +=       "WHERE " + table +".artist = ? AND ";
     sql +=       "ngram IN (" + q + ") ";
     sql +=       "GROUP BY s.id ORDER BY sum(s.num) DESC LIMIT 10";
-    sqlite3pp::query qry(m_db, sql.c_str());
-    qry.bind(1, artistid);
+    utils::stmt_cache::query qry(rd.stmts(), sql.c_str());
+    qry->bind(1, artistid);
     int numn = 1;
     for(iter = ngrammap.begin(); iter!=ngrammap.end(); ++iter){
-        qry.bind(++numn, iter->first.c_str(), true);
+        qry->bind(++numn, iter->first.c_str(), true);
     }
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
+    for (sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
         scorepair sp;
         sp.id = (*i).get<int>(0);
         sp.score = (float) (*i).get<int>(1);
@@ -355,14 +533,14 @@ Library::search_catalogue_for_artist(int artistid, string table, string name_ori
 vector<artist_ptr>
 Library::list_artists()
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader rd(*this);
     vector<artist_ptr> results;
     string sql = "SELECT id ";
     sql +=       "FROM artist ";
     sql +=       "ORDER BY sortname ASC";
-    sqlite3pp::query qry(m_db, sql.c_str());
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
-        results.push_back( load_artist((*i).get<int>(0)) );
+    utils::stmt_cache::query qry(rd.stmts(), sql.c_str());
+    for (sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
+        results.push_back( load_artist(rd.stmts(), (*i).get<int>(0)) );
     }
     return results;
 }
@@ -370,16 +548,16 @@ Library::list_artists()
 vector<track_ptr> 
 Library::list_artist_tracks(artist_ptr artist)
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader rd(*this);
     vector< boost::shared_ptr<Track> > results;
     string sql = "SELECT id ";
     sql +=       "FROM track ";
     sql +=       "WHERE artist = ? ";
     sql +=       "ORDER BY sortname ASC";
-    sqlite3pp::query qry(m_db, sql.c_str());
-    qry.bind(1, artist->id());
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
-        results.push_back( load_track( (*i).get<int>(0) ) );
+    utils::stmt_cache::query qry(rd.stmts(), sql.c_str());
+    qry->bind(1, artist->id());
+    for (sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
+        results.push_back( load_track( rd.stmts(), (*i).get<int>(0) ) );
     }
     return results;
 }
@@ -387,14 +565,8 @@ Library::list_artist_tracks(artist_ptr artist)
 vector<int>
 Library::get_fids_for_tid(int tid)
 {
-    boost::mutex::scoped_lock lock(m_mut);
-    vector<int> results;
-    sqlite3pp::query qry(m_db, "SELECT file.id FROM file, file_join WHERE file_join.file=file.id AND file_join.track = ? ORDER BY bitrate DESC");
-    qry.bind(1, tid);
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
-        results.push_back( (*i).get<int>(0) );
-    }
-    return results;
+    reader rd(*this);
+    return get_fids_for_tid( rd.stmts(), tid );
 }
 
 bool 
@@ -403,10 +575,17 @@ Library::build_index(string table)
     if(table != "artist" && table != "track" && table != "album") return false;
     
     boost::mutex::scoped_lock lock(m_mut);
-    
+    return build_index_nolock(table);
+}
+
+/// build_index, for when the caller holds m_mut or has the db to itself
+/// (the schema upgrade, in its transaction).
+bool
+Library::build_index_nolock(const string& table)
+{
     cout << "Building index for " << table << endl;
     string searchtable = table + "_search_index";
-        m_db.execute(string("DELETE FROM "+searchtable).c_str());
+    if(m_db.execute(string("DELETE FROM "+searchtable).c_str()) != SQLITE_OK) return false;
     sqlite3pp::query qry(m_db, string("SELECT id, sortname FROM "+table).c_str());
     int num_names = 0;
     int num_ngrams = 0;
@@ -431,12 +610,12 @@ Library::build_index(string table)
             num_ngrams++;
             cmd_u.bind(1, it->second);
             cmd_u.bind(2, it->first.c_str());
-            cmd_u.execute();
+            if(cmd_u.execute() != SQLITE_OK) return false;
             cmd_u.reset();
             if(m_db.changes()==0) { // update failed, do insert
                 cmd_i.bind(1, it->first.c_str());
                 cmd_i.bind(3, it->second);
-                cmd_i.execute();
+                if(cmd_i.execute() != SQLITE_OK) return false;
                 cmd_i.reset();
             }            
         }
@@ -484,10 +663,18 @@ Library::num_tracks()
     return db_get_one(string("SELECT count(*) FROM track"), 0);
 }
 
+/// goes up whenever a file is added, or rescanned (which re-adds it)
+int 
+Library::max_file_id()
+{
+    return db_get_one(string("SELECT max(id) FROM file"), 0);
+}
+
 LibraryFile_ptr
 Library::file_from_fid(int fid)
 {
-    return file_from_fid( m_db, fid );
+    reader rd(*this);
+    return file_from_fid( rd.stmts(), fid );
 }
 
 
@@ -495,10 +682,10 @@ Library::file_from_fid(int fid)
 map<string, int>
 Library::file_mtimes()
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader rd(*this);
     map<string, int> ret;
-    sqlite3pp::query qry(m_db, "SELECT url, mtime FROM file");
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::stmt_cache::query qry(rd.stmts(), "SELECT url, mtime FROM file");
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         ret[ string((*i).get<const char *>(0)) ] = (*i).get<int>(1);
     }
     return ret;
@@ -508,10 +695,10 @@ Library::file_mtimes()
 template <typename T> T
 Library::db_get_one(string sql, T def)
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader rd(*this);
     T val;
-    sqlite3pp::query qry(m_db, sql.c_str());
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::stmt_cache::query qry(rd.stmts(), sql.c_str());
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         val = (*i).get<T>(def);
         return val;
     }
@@ -527,48 +714,21 @@ Library::get_name(string table, int id)
 string
 Library::get_field(string table, int id, string field)
 {
-    boost::mutex::scoped_lock lock(m_mut);
-    sqlite3pp::query qry(m_db, string("SELECT "+field+" FROM "+table+" WHERE id = ?").c_str() );
-    qry.bind(1, id);
+    reader rd(*this);
+    utils::stmt_cache::query qry(rd.stmts(), string("SELECT "+field+" FROM "+table+" WHERE id = ?").c_str() );
+    qry->bind(1, id);
     string result("");
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         result = string((*i).get<const char *>(0));
         break; // should only be one row
     }
     return result;
 }
 
-
-// replace whitespace and other control codes with ' ' and replace multiple spaces with single
-static
-string 
-fixspaces(const string& s)
-{
-    string r;
-    bool prevWasSpace = false;
-    r.reserve(s.length());
-    for (string::const_iterator i = s.begin(); i != s.end(); i++) {
-        if (*i > 0 && *i <= ' ') {
-            if (!prevWasSpace) {
-                r += ' ';
-                prevWasSpace = true;
-            }
-        } else {
-            r += *i;
-            prevWasSpace = false;
-        }
-    }
-    return r;
-}
-
-
 string
 Library::sortname(const string& name)
 {
-    string data(name);
-    std::transform(data.begin(), data.end(), data.begin(), ::tolower);
-    boost::trim(data);
-    return fixspaces(data);
+    return playdar::utils::normalize(name);
 }
 
 // CATALOGUE LOADING (TODO) some factory of singletons->shared pointers, so only one lookup
@@ -577,11 +737,12 @@ Library::sortname(const string& name)
 artist_ptr
 Library::load_artist(string n)
 {
+    reader rd(*this);
     string sortname = Library::sortname(n);
-    sqlite3pp::query qry(m_db, "SELECT id,name FROM artist WHERE sortname = ?");
-    qry.bind(1, sortname.c_str(), true);
+    utils::stmt_cache::query qry(rd.stmts(), "SELECT id,name FROM artist WHERE sortname = ?");
+    qry->bind(1, sortname.c_str(), true);
     artist_ptr ptr;
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         ptr = artist_ptr(new Artist((*i).get<int>(0), (*i).get<string>(1)));
         break;
     }
@@ -591,18 +752,20 @@ Library::load_artist(string n)
 artist_ptr
 Library::load_artist(int n)
 {
-    return load_artist( m_db, n );
+    reader rd(*this);
+    return load_artist( rd.stmts(), n );
 }
 
 track_ptr
 Library::load_track(artist_ptr artp, string n)
 {
+    reader rd(*this);
     string sortname = Library::sortname(n);
-    sqlite3pp::query qry(m_db, "SELECT id,name FROM track WHERE artist = ? AND sortname = ?");
-    qry.bind(1, artp->id());
-    qry.bind(2, sortname.c_str(), true);
+    utils::stmt_cache::query qry(rd.stmts(), "SELECT id,name FROM track WHERE artist = ? AND sortname = ?");
+    qry->bind(1, artp->id());
+    qry->bind(2, sortname.c_str(), true);
     track_ptr ptr;
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         ptr = track_ptr(new Track((*i).get<int>(0), (*i).get<string>(1), artp));
         break;
     }
@@ -612,18 +775,20 @@ Library::load_track(artist_ptr artp, string n)
 track_ptr
 Library::load_track(int n)
 {
-    return load_track( m_db, n );
+    reader rd(*this);
+    return load_track( rd.stmts(), n );
 }
 
 album_ptr
 Library::load_album(artist_ptr artp, string n)
 {
+    reader rd(*this);
     string sortname = Library::sortname(n);
-    sqlite3pp::query qry(m_db, "SELECT id,name FROM album WHERE artist = ? AND sortname = ?");
-    qry.bind(1, artp->id());
-    qry.bind(2, sortname.c_str(), true);
+    utils::stmt_cache::query qry(rd.stmts(), "SELECT id,name FROM album WHERE artist = ? AND sortname = ?");
+    qry->bind(1, artp->id());
+    qry->bind(2, sortname.c_str(), true);
     album_ptr ptr;
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         ptr = album_ptr(new Album((*i).get<int>(0), (*i).get<string>(1), artp));
         break;
     }
@@ -633,7 +798,8 @@ Library::load_album(artist_ptr artp, string n)
 album_ptr
 Library::load_album(int n)
 {
-    return load_album( m_db, n );
+    reader rd(*this);
+    return load_album( rd.stmts(), n );
 }
 
 }
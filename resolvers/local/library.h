@@ -21,8 +21,12 @@
 
 #include <cstdio>
 #include <map>
+#include <set>
 #include <vector>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/utility.hpp>
+#include <boost/foreach.hpp>
 
 
 #include "playdar/types.h"
@@ -32,6 +36,7 @@
 #include "library_file.h"
 
 #include "sqlite3pp.h"
+#include "playdar/utils/stmt_cache.hpp"
 
 namespace playdar {
 
@@ -40,9 +45,29 @@ class MyApplication;
 class Library
 {
 public:
-    Library(const std::string& dbfilepath);
+    /// readers is how many read only connections to pool, for searching
+    /// and browsing from several threads at once. with none, reads share
+    /// the main connection (and its lock) with the writes.
+    Library(const std::string& dbfilepath, unsigned int readers = 0);
     ~Library();
 
+    /// a connection to read with, for as long as this is around. one from
+    /// the pool, waiting for one to be free if need be, or the main 
+    /// connection, locked, if there's no pool. don't make two at once on
+    /// one thread.
+    class reader : boost::noncopyable
+    {
+    public:
+        explicit reader( Library& lib );
+        ~reader();
+        sqlite3pp::database& db() { return m_conn->db(); }
+        utils::stmt_cache& stmts() { return *m_conn; }
+    private:
+        Library& m_lib;
+        utils::stmt_cache* m_conn;
+        boost::mutex::scoped_lock m_lock; // main connection's, if no pool
+    };
+
     int add_dir( const std::string& url, int mtime);
     int add_file( const std::string& url, int mtime, int size, const std::string& md5, const std::string& mimetype,
                   int duration, int bitrate,
@@ -59,6 +84,7 @@ public:
     int num_artists();
     int num_albums();
     int num_tracks();
+    int max_file_id();
 
     bool build_index(std::string);
     static std::string sortname(const std::string& name);
@@ -70,12 +96,12 @@ public:
     // catalogue items
     artist_ptr  load_artist(std::string n);
     artist_ptr  load_artist(int n);
-    inline static artist_ptr load_artist( sqlite3pp::database& db, int n )
+    inline static artist_ptr load_artist( utils::stmt_cache& db, int n )
     {
-        sqlite3pp::query qry(db, "SELECT id,name FROM artist WHERE id = ?");
-        qry.bind(1, n);
+        utils::stmt_cache::query qry(db, "SELECT id,name FROM artist WHERE id = ?");
+        qry->bind(1, n);
         artist_ptr ptr;
-        for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+        for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
             ptr = artist_ptr(new Artist((*i).get<int>(0), (*i).get<std::string>(1)));
             break;
         }
@@ -84,12 +110,12 @@ public:
     
     album_ptr   load_album(artist_ptr artp, std::string n);
     album_ptr   load_album(int n);
-    inline static album_ptr load_album( sqlite3pp::database& db, int n )
+    inline static album_ptr load_album( utils::stmt_cache& db, int n )
     {
-        sqlite3pp::query qry(db, "SELECT id,name,artist FROM album WHERE id = ?");
-        qry.bind(1, n);
+        utils::stmt_cache::query qry(db, "SELECT id,name,artist FROM album WHERE id = ?");
+        qry->bind(1, n);
         album_ptr ptr;
-        for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+        for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
             ptr = album_ptr(new Album((*i).get<int>(0), (*i).get<std::string>(1), load_artist( db, (*i).get<int>(2))));
             break;
         }
@@ -98,12 +124,12 @@ public:
     
     track_ptr   load_track(artist_ptr artp, std::string n);
     track_ptr   load_track(int n);
-    inline static track_ptr load_track( sqlite3pp::database& db, int n )
+    inline static track_ptr load_track( utils::stmt_cache& db, int n )
     {
-        sqlite3pp::query qry(db, "SELECT id,name,artist FROM track WHERE id = ?");
-        qry.bind(1, n);
+        utils::stmt_cache::query qry(db, "SELECT id,name,artist FROM track WHERE id = ?");
+        qry->bind(1, n);
         track_ptr ptr;
-        for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+        for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
             ptr = track_ptr(new Track((*i).get<int>(0), (*i).get<std::string>(1), load_artist(db, (*i).get<int>(2))));
             break;
         }
@@ -118,19 +144,29 @@ public:
     std::string get_field(std::string, int, std::string);
 
     std::vector<int> get_fids_for_tid(int tid);
+    inline static std::vector<int> get_fids_for_tid( utils::stmt_cache& db, int tid )
+    {
+        std::vector<int> results;
+        utils::stmt_cache::query qry(db, "SELECT file.id FROM file, file_join WHERE file_join.file=file.id AND file_join.track = ? ORDER BY bitrate DESC");
+        qry->bind(1, tid);
+        for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
+            results.push_back( (*i).get<int>(0) );
+        }
+        return results;
+    }
     LibraryFile_ptr file_from_fid(int fid);
 
-    inline static LibraryFile_ptr file_from_fid( sqlite3pp::database& db, int fid )
+    inline static LibraryFile_ptr file_from_fid( utils::stmt_cache& db, int fid )
     {
-        sqlite3pp::query qry(db,
+        utils::stmt_cache::query qry(db,
                              "SELECT file.url, file.size, file.mimetype, file.duration, file.bitrate, "
                              "file_join.artist, file_join.album, file_join.track "
                              "FROM file, file_join "
                              "WHERE file.id = file_join.file "
                              "AND file.id = ?");
-        qry.bind(1, fid);
-        sqlite3pp::query::iterator i( qry.begin() );
-        if (i == qry.end())
+        qry->bind(1, fid);
+        sqlite3pp::query::iterator i( qry->begin() );
+        if (i == qry->end())
             return LibraryFile_ptr((LibraryFile*)0);
         
         LibraryFile_ptr p(new LibraryFile);
@@ -144,6 +180,60 @@ public:
         p->pitrkid = (*i).get<int>(7);
         return p;   
     }
+
+    /// ids that go in to one IN (...) query. short batches are padded
+    /// with their last id, so there's only one statement to prepare.
+    static const size_t id_batch_size = 64;
+
+    /// like file_from_fid, for many files at a time. files that don't
+    /// exist are left out of out.
+    inline static void files_from_fids( utils::stmt_cache& db, const std::vector<int>& fids,
+                                        std::map<int, LibraryFile_ptr>& out )
+    {
+        std::string sql = "SELECT file.id, file.url, file.size, file.mimetype, file.duration, file.bitrate, "
+                          "file_join.artist, file_join.album, file_join.track "
+                          "FROM file, file_join "
+                          "WHERE file.id = file_join.file "
+                          "AND file_join.file IN (" + id_params() + ")";
+        for( size_t from = 0; from < fids.size(); from += id_batch_size )
+        {
+            utils::stmt_cache::query qry(db, sql);
+            bind_ids( *qry, fids, from );
+            for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
+                LibraryFile_ptr p(new LibraryFile);
+                p->url = std::string((*i).get<const char *>(1));
+                p->size = (*i).get<int>(2);
+                p->mimetype = std::string((*i).get<const char *>(3));
+                p->duration = (*i).get<int>(4);
+                p->bitrate = (*i).get<int>(5);
+                p->piartid = (*i).get<int>(6);
+                p->pialbid = (*i).get<int>(7);
+                p->pitrkid = (*i).get<int>(8);
+                out[ (*i).get<int>(0) ] = p;
+            }
+        }
+    }
+
+    /// names of artists, albums or tracks, by id. only looks up the ids
+    /// that aren't in names already.
+    inline static void names_from_ids( utils::stmt_cache& db, const std::string& table,
+                                       const std::set<int>& ids, std::map<int, std::string>& names )
+    {
+        std::vector<int> want;
+        BOOST_FOREACH( int id, ids )
+        {
+            if( names.find( id ) == names.end() ) want.push_back( id );
+        }
+        std::string sql = "SELECT id, name FROM " + table + " WHERE id IN (" + id_params() + ")";
+        for( size_t from = 0; from < want.size(); from += id_batch_size )
+        {
+            utils::stmt_cache::query qry(db, sql);
+            bind_ids( *qry, want, from );
+            for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
+                names[ (*i).get<int>(0) ] = (*i).get<std::string>(1);
+            }
+        }
+    }
     
     sqlite3pp::database& db() { return m_db; }
     std::string dbfilepath() const { return m_dbfilepath; }
@@ -152,10 +242,38 @@ public:
     template <typename T> T db_get_one(std::string sql, T def);
     
 private:
+    static std::string id_params()
+    {
+        std::string q( "?" );
+        for( size_t i = 1; i < id_batch_size; ++i ) q += ",?";
+        return q;
+    }
+
+    // ids[from] on, padded out to id_batch_size
+    static void bind_ids( sqlite3pp::query& qry, const std::vector<int>& ids, size_t from )
+    {
+        for( size_t i = 0; i < id_batch_size; ++i )
+        {
+            size_t j = from + i < ids.size() ? from + i : ids.size() - 1;
+            qry.bind( (int) i + 1, ids[j] );
+        }
+    }
+
     void check_db();
     void create_db_schema();
+    void upgrade_sortnames();
+    bool build_index_nolock(const std::string& table);
+    static void tune_reader( sqlite3pp::database& db );
     sqlite3pp::database m_db;
+    utils::stmt_cache m_stmts;
     boost::mutex m_mut;
+    // read only connections, each with its own statements, and which of
+    // them aren't in use:
+    std::vector< sqlite3pp::database* > m_readers;
+    std::vector< utils::stmt_cache* > m_reader_stmts;
+    std::vector< utils::stmt_cache* > m_free_readers;
+    boost::mutex m_readers_mut;
+    boost::condition m_readers_cond;
     std::string m_dbfilepath;
     // name -> id caches
     std::map< std::string, int > m_artistcache;
@@ -60,6 +60,7 @@ static const char * playdar_schema_sql =
 "    album INTEGER REFERENCES album(id) ON DELETE CASCADE ON UPDATE CASCADE"
 ");"
 "CREATE INDEX file_join_track ON file_join(track);"
+"CREATE INDEX file_join_file ON file_join(file);"
 "DROP TABLE IF EXISTS playdar_auth;"
 "CREATE TABLE IF NOT EXISTS playdar_auth ("
 "    token TEXT NOT NULL PRIMARY KEY,"
@@ -73,7 +74,7 @@ static const char * playdar_schema_sql =
 "    key TEXT NOT NULL PRIMARY KEY,"
 "    value TEXT NOT NULL DEFAULT ''"
 ");"
-"INSERT INTO playdar_system(key,value) VALUES('schema_version', '2');"
+"INSERT INTO playdar_system(key,value) VALUES('schema_version', '3');"
     ;
 
 const char * get_playdar_sql()
@@ -0,0 +1,367 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "memory_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <boost/foreach.hpp>
+
+#include "library.h"
+
+using namespace std;
+
+namespace playdar {
+
+namespace {
+
+/// keeps the best k scores it's offered, in a heap with the worst on top.
+/// equal scores go to the lower id, so results don't depend on the order
+/// candidates were looked at.
+class top_k
+{
+public:
+    top_k( size_t k ) : m_k( k ? k : (size_t) -1 ) {}
+
+    void offer( int id, float score )
+    {
+        scorepair sp;
+        sp.id = id;
+        sp.score = score;
+        if( m_heap.size() < m_k )
+        {
+            m_heap.push_back( sp );
+            push_heap( m_heap.begin(), m_heap.end(), &top_k::better );
+        }
+        else if( better( sp, m_heap.front() ) )
+        {
+            pop_heap( m_heap.begin(), m_heap.end(), &top_k::better );
+            m_heap.back() = sp;
+            push_heap( m_heap.begin(), m_heap.end(), &top_k::better );
+        }
+    }
+
+    /// best first. 
+    vector<scorepair> results()
+    {
+        sort_heap( m_heap.begin(), m_heap.end(), &top_k::better );
+        return m_heap;
+    }
+
+private:
+    static bool better( const scorepair& a, const scorepair& b )
+    {
+        return a.score > b.score || ( a.score == b.score && a.id < b.id );
+    }
+
+    size_t m_k;
+    vector<scorepair> m_heap;
+};
+
+// how much a trigram found in n of total names is worth:
+float idf( size_t total, size_t n )
+{
+    return (float) log( 1.0 + (double) total / n );
+}
+
+}
+
+MemoryIndex::MemoryIndex()
+{
+}
+
+// 64 bit FNV-1a of artist, a tab, then track:
+// static
+boost::uint64_t
+MemoryIndex::exact_key( const string& artist_sortname, const string& track_sortname )
+{
+    boost::uint64_t h = 14695981039346656037ULL;
+    const string* parts[] = { &artist_sortname, &track_sortname };
+    for( int p = 0; p < 2; ++p )
+    {
+        if( p ) h = ( h ^ '\t' ) * 1099511628211ULL;
+        BOOST_FOREACH( char c, *parts[p] )
+            h = ( h ^ (unsigned char) c ) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// static
+bool
+MemoryIndex::by_track( const pair<int,int>& a, const pair<int,int>& b )
+{
+    return a.first < b.first;
+}
+
+// static
+bool
+MemoryIndex::by_gram( const pair<gram_t, boost::uint32_t>& a, 
+                      const pair<gram_t, boost::uint32_t>& b )
+{
+    return ( a.first >> 8 ) < ( b.first >> 8 );
+}
+
+/// trigrams of " sortname ", the same ones Library::ngrams makes, sorted
+/// and with their counts (up to 255) in the low byte.
+// static
+void
+MemoryIndex::grams( const string& sortname, vector<gram_t>& out )
+{
+    out.clear();
+    string str = " " + sortname + " ";
+    for( size_t i = 0; i + 3 <= str.length(); ++i )
+    {
+        out.push_back( ( (gram_t)(unsigned char) str[i]   << 16 |
+                         (gram_t)(unsigned char) str[i+1] << 8  |
+                         (gram_t)(unsigned char) str[i+2] ) << 8 );
+    }
+    sort( out.begin(), out.end() );
+    // collapse repeats in to a count:
+    size_t n = 0;
+    for( size_t i = 0; i < out.size(); )
+    {
+        size_t j = i;
+        while( j < out.size() && out[j] == out[i] ) ++j;
+        out[n++] = out[i] | (gram_t) min( j - i, (size_t) 255 );
+        i = j;
+    }
+    out.resize( n );
+}
+
+void
+MemoryIndex::build( sqlite3pp::database& db )
+{
+    m_artist_index.clear();
+    m_artist_postings.clear();
+    m_artist_ids.clear();
+    m_tracks.clear();
+    m_track_grams.clear();
+    m_artist_tracks.clear();
+    m_track_idf.clear();
+    m_exact.clear();
+    m_track_files.clear();
+
+    vector<gram_t> g;
+
+    // artists, as (trigram, artist number) pairs sorted in to posting lists:
+    vector< pair<gram_t, boost::uint32_t> > entries;
+    vector< string > artist_names; // sortnames, for the exact lookup
+    sqlite3pp::query qa( db, "SELECT id, sortname FROM artist ORDER BY id" );
+    for( sqlite3pp::query::iterator i = qa.begin(); i != qa.end(); ++i )
+    {
+        boost::uint32_t num = m_artist_ids.size();
+        m_artist_ids.push_back( (*i).get<int>(0) );
+        artist_names.push_back( (*i).get<string>(1) );
+        grams( artist_names.back(), g );
+        BOOST_FOREACH( gram_t x, g )
+            entries.push_back( make_pair( x, num ) );
+    }
+    // artist numbers are already in order within each trigram:
+    stable_sort( entries.begin(), entries.end(), &MemoryIndex::by_gram );
+    for( size_t i = 0; i < entries.size(); )
+    {
+        gram_t key = entries[i].first >> 8;
+        posting_list pl;
+        pl.offset = m_artist_postings.size();
+        boost::uint32_t prev = 0;
+        size_t j = i;
+        for( ; j < entries.size() && ( entries[j].first >> 8 ) == key; ++j )
+        {
+            // delta as a varint, 7 bits a byte, then the count:
+            boost::uint32_t d = entries[j].second - prev;
+            prev = entries[j].second;
+            while( d >= 0x80 )
+            {
+                m_artist_postings.push_back( (unsigned char)( d | 0x80 ) );
+                d >>= 7;
+            }
+            m_artist_postings.push_back( (unsigned char) d );
+            m_artist_postings.push_back( (unsigned char)( entries[j].first & 0xff ) );
+        }
+        pl.len = m_artist_postings.size() - pl.offset;
+        pl.idf = idf( m_artist_ids.size(), j - i );
+        m_artist_index[key] = pl;
+        i = j;
+    }
+
+    // tracks, grouped by artist:
+    boost::unordered_map< gram_t, boost::uint32_t > df;
+    sqlite3pp::query qt( db, "SELECT id, artist, sortname FROM track ORDER BY artist, id" );
+    bool first = true;
+    int artist = 0;
+    const string* artist_name = 0;
+    for( sqlite3pp::query::iterator i = qt.begin(); i != qt.end(); ++i )
+    {
+        int a = (*i).get<int>(1);
+        if( first || a != artist )
+        {
+            if( !first ) m_artist_tracks[artist].second = m_tracks.size();
+            m_artist_tracks[a].first = m_tracks.size();
+            artist = a;
+            first = false;
+            vector<int>::const_iterator ai = 
+                lower_bound( m_artist_ids.begin(), m_artist_ids.end(), a );
+            artist_name = ( ai != m_artist_ids.end() && *ai == a ) ? 
+                          &artist_names[ ai - m_artist_ids.begin() ] : 0;
+        }
+        track_entry e;
+        e.id = (*i).get<int>(0);
+        e.grams = m_track_grams.size();
+        m_tracks.push_back( e );
+        string name = (*i).get<string>(2);
+        if( artist_name ) m_exact[ exact_key( *artist_name, name ) ] = e.id;
+        grams( name, g );
+        m_track_grams.insert( m_track_grams.end(), g.begin(), g.end() );
+        BOOST_FOREACH( gram_t x, g ) ++df[ x >> 8 ];
+    }
+    if( !first ) m_artist_tracks[artist].second = m_tracks.size();
+    size_t ntracks = m_tracks.size();
+    track_entry end;
+    end.id = 0;
+    end.grams = m_track_grams.size();
+    m_tracks.push_back( end );
+    for( boost::unordered_map< gram_t, boost::uint32_t >::const_iterator i = df.begin();
+         i != df.end(); ++i )
+    {
+        m_track_idf[i->first] = idf( ntracks, i->second );
+    }
+
+    sqlite3pp::query qf( db, "SELECT file_join.track, file.id FROM file, file_join "
+                             "WHERE file_join.file = file.id "
+                             "ORDER BY file_join.track, file.bitrate DESC" );
+    for( sqlite3pp::query::iterator i = qf.begin(); i != qf.end(); ++i )
+    {
+        m_track_files.push_back( make_pair( (*i).get<int>(0), (*i).get<int>(1) ) );
+    }
+
+    cout << "Local library memory index: " << num_artists() << " artists, "
+         << num_tracks() << " tracks, " << footprint() / 1024 << "KB" << endl;
+}
+
+vector<scorepair>
+MemoryIndex::search_artists( const string& name, size_t limit ) const
+{
+    // same cut off as the SQL search:
+    if( name.length() < 3 || m_artist_ids.empty() ) return vector<scorepair>();
+    vector<gram_t> q;
+    grams( Library::sortname( name ), q );
+
+    vector<float> acc( m_artist_ids.size(), 0.0f );
+    vector<boost::uint32_t> touched;
+    BOOST_FOREACH( gram_t x, q )
+    {
+        boost::unordered_map< gram_t, posting_list >::const_iterator it = 
+            m_artist_index.find( x >> 8 );
+        if( it == m_artist_index.end() ) continue;
+        const unsigned char* p = &m_artist_postings[ it->second.offset ];
+        const unsigned char* end = p + it->second.len;
+        const float w = it->second.idf;
+        boost::uint32_t num = 0;
+        while( p < end )
+        {
+            boost::uint32_t d = 0;
+            int shift = 0;
+            while( *p & 0x80 )
+            {
+                d |= (boost::uint32_t)( *p++ & 0x7f ) << shift;
+                shift += 7;
+            }
+            d |= (boost::uint32_t)( *p++ ) << shift;
+            num += d;
+            if( acc[num] == 0.0f ) touched.push_back( num );
+            acc[num] += *p++ * w;
+        }
+    }
+    top_k best( limit );
+    BOOST_FOREACH( boost::uint32_t num, touched )
+        best.offer( m_artist_ids[num], acc[num] );
+    return best.results();
+}
+
+vector<scorepair>
+MemoryIndex::search_artist_tracks( int artistid, const string& name, size_t limit ) const
+{
+    if( name.length() < 3 ) return vector<scorepair>();
+    boost::unordered_map< int, pair<boost::uint32_t, boost::uint32_t> >::const_iterator ait = 
+        m_artist_tracks.find( artistid );
+    if( ait == m_artist_tracks.end() ) return vector<scorepair>();
+
+    // the query's trigrams and their weights, in order to merge against:
+    vector<gram_t> q;
+    grams( Library::sortname( name ), q );
+    vector< pair<gram_t, float> > qw;
+    BOOST_FOREACH( gram_t x, q )
+    {
+        boost::unordered_map< gram_t, float >::const_iterator it = m_track_idf.find( x >> 8 );
+        if( it != m_track_idf.end() ) qw.push_back( make_pair( x >> 8, it->second ) );
+    }
+    if( qw.empty() ) return vector<scorepair>();
+
+    top_k best( limit );
+    const gram_t* base = &m_track_grams[0];
+    for( boost::uint32_t t = ait->second.first; t < ait->second.second; ++t )
+    {
+        const gram_t* g = base + m_tracks[t].grams;
+        const gram_t* gend = base + m_tracks[t+1].grams;
+        float score = 0;
+        size_t i = 0;
+        while( g < gend && i < qw.size() )
+        {
+            gram_t key = *g >> 8;
+            if( key < qw[i].first ) ++g;
+            else if( key > qw[i].first ) ++i;
+            else score += ( *g++ & 0xff ) * qw[i++].second;
+        }
+        if( score > 0 ) best.offer( m_tracks[t].id, score );
+    }
+    return best.results();
+}
+
+vector<int>
+MemoryIndex::exact( const string& artist, const string& track ) const
+{
+    vector<int> fids;
+    boost::unordered_map< boost::uint64_t, int >::const_iterator it = 
+        m_exact.find( exact_key( Library::sortname( artist ), Library::sortname( track ) ) );
+    if( it == m_exact.end() ) return fids;
+    vector< pair<int,int> >::const_iterator f = 
+        lower_bound( m_track_files.begin(), m_track_files.end(), 
+                     make_pair( it->second, 0 ), &MemoryIndex::by_track );
+    for( ; f != m_track_files.end() && f->first == it->second; ++f )
+        fids.push_back( f->second );
+    return fids;
+}
+
+size_t
+MemoryIndex::footprint() const
+{
+    // hash map nodes are roughly key, value and a couple of pointers:
+    return m_artist_postings.capacity() +
+           m_artist_ids.capacity() * sizeof(int) +
+           m_artist_index.size() * ( sizeof(gram_t) + sizeof(posting_list) + 2 * sizeof(void*) ) +
+           m_tracks.capacity() * sizeof(track_entry) +
+           m_track_grams.capacity() * sizeof(gram_t) +
+           m_artist_tracks.size() * ( sizeof(int) + 2 * sizeof(boost::uint32_t) + 2 * sizeof(void*) ) +
+           m_track_idf.size() * ( sizeof(gram_t) + sizeof(float) + 2 * sizeof(void*) ) +
+           m_exact.size() * ( sizeof(boost::uint64_t) + sizeof(int) + 2 * sizeof(void*) ) +
+           m_track_files.capacity() * sizeof( pair<int,int> );
+}
+
+}
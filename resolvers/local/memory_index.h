@@ -0,0 +1,114 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __PLAYDAR_MEMORY_INDEX_H__
+#define __PLAYDAR_MEMORY_INDEX_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "playdar/types.h"
+
+#include "sqlite3pp.h"
+
+namespace playdar {
+
+/*
+    In-memory version of the library's artist and track ngram search, 
+    see Library::search_catalogue. Built from the db at startup, read 
+    only after that so it needs no locking. Also has an exact lookup of 
+    (artist, track) -> files, for queries we have exactly.
+
+    Trigrams are packed in to 24 bits. Artists have an inverted index, 
+    each trigram's posting list being delta encoded artist numbers and a
+    count. Tracks are searched one artist at a time, so they're grouped by
+    artist instead, each with its sorted trigrams.
+    A candidate scores the sum over the query's trigrams of how often it
+    has each one, weighted by how rare the trigram is (idf). So a match on
+    "zep" counts for more than one on " th".
+*/
+class MemoryIndex
+{
+public:
+    MemoryIndex();
+
+    /// (re)load every artist and track name from the library db.
+    void build( sqlite3pp::database& db );
+
+    /// best limit artists for name, best first.
+    std::vector<scorepair> search_artists( const std::string& name, 
+                                           size_t limit = 10 ) const;
+    /// best limit of artistid's tracks for name, best first.
+    std::vector<scorepair> search_artist_tracks( int artistid, 
+                                                 const std::string& name, 
+                                                 size_t limit = 10 ) const;
+
+    /// files for the track with exactly these names (once sortnamed), 
+    /// best bitrate first. empty if there's no such track.
+    std::vector<int> exact( const std::string& artist, 
+                            const std::string& track ) const;
+
+    size_t num_artists() const { return m_artist_ids.size(); }
+    size_t num_tracks() const { return m_tracks.empty() ? 0 : m_tracks.size() - 1; }
+    /// rough number of bytes the index is holding on to.
+    size_t footprint() const;
+
+private:
+    // trigram in the top 24 bits, how many times it's in the name below:
+    typedef boost::uint32_t gram_t;
+    static void grams( const std::string& sortname, std::vector<gram_t>& out );
+    static boost::uint64_t exact_key( const std::string& artist_sortname, 
+                                      const std::string& track_sortname );
+    static bool by_track( const std::pair<int,int>& a, const std::pair<int,int>& b );
+    static bool by_gram( const std::pair<gram_t, boost::uint32_t>& a, 
+                         const std::pair<gram_t, boost::uint32_t>& b );
+
+    struct posting_list
+    {
+        boost::uint32_t offset; // in to m_artist_postings
+        boost::uint32_t len;    // bytes
+        float idf;
+    };
+    boost::unordered_map< gram_t, posting_list > m_artist_index; // key is gram >> 8
+    std::vector< unsigned char > m_artist_postings;
+    std::vector< int > m_artist_ids; // artist number in posting lists -> id
+
+    struct track_entry
+    {
+        int id;
+        boost::uint32_t grams;  // offset in to m_track_grams, ends where the next starts
+    };
+    std::vector< track_entry > m_tracks;   // grouped by artist, plus an end marker
+    std::vector< gram_t > m_track_grams;
+    // artist id -> [begin, end) of its tracks in m_tracks
+    boost::unordered_map< int, std::pair<boost::uint32_t, boost::uint32_t> > m_artist_tracks;
+    boost::unordered_map< gram_t, float > m_track_idf;  // key is gram >> 8
+
+    // hash of artist and track sortname -> track id. it's 64 bits, so we
+    // don't bother keeping the names to check against.
+    boost::unordered_map< boost::uint64_t, int > m_exact;
+    // (track id, file id), by track and then best bitrate first
+    std::vector< std::pair<int,int> > m_track_files;
+};
+
+}
+
+#endif
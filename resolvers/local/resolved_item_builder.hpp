@@ -33,14 +33,17 @@ class ResolvedItemBuilder
 {
 public:
 
-    static void createFromFid(Library& lib, int fid, json_spirit::Object& out)
+    /// false if there's no such file (any more).
+    static bool createFromFid(Library& lib, int fid, json_spirit::Object& out)
     {
-        createFromFid( lib.db(), fid, out );
+        Library::reader rd( lib );
+        return createFromFid( rd.stmts(), fid, out );
     }
     
-    static void createFromFid( sqlite3pp::database& db, int fid, Object& out)
+    static bool createFromFid( utils::stmt_cache& db, int fid, Object& out)
     {
         LibraryFile_ptr file( Library::file_from_fid(db, fid) );
+        if( !file ) return false;
         
         out.push_back( Pair("mimetype", file->mimetype) );
         out.push_back( Pair("size", file->size) );
@@ -56,6 +59,60 @@ public:
             out.push_back( Pair("album", albobj->name()) );
         }
         out.push_back( Pair("url", file->url) );
+        return true;
+    }
+
+    /// items for many files at once, out[i] being fids[i]'s. a few
+    /// queries for the lot, instead of five for each file: the files a
+    /// batch at a time, then each artist, album and track name just once.
+    /// items for files that don't exist are left empty.
+    /// returns how many were found.
+    static size_t createFromFids( utils::stmt_cache& db, const std::vector<int>& fids,
+                                  std::vector<Object>& out )
+    {
+        out.clear();
+        out.resize( fids.size() );
+        std::map<int, LibraryFile_ptr> files;
+        Library::files_from_fids( db, fids, files );
+
+        std::set<int> artists, albums, tracks;
+        typedef std::pair<const int, LibraryFile_ptr> file_t;
+        BOOST_FOREACH( const file_t& f, files )
+        {
+            artists.insert( f.second->piartid );
+            tracks.insert( f.second->pitrkid );
+            if( f.second->pialbid ) albums.insert( f.second->pialbid );
+        }
+        std::map<int, std::string> artist_names, album_names, track_names;
+        Library::names_from_ids( db, "artist", artists, artist_names );
+        Library::names_from_ids( db, "album", albums, album_names );
+        Library::names_from_ids( db, "track", tracks, track_names );
+
+        size_t found = 0;
+        for( size_t i = 0; i < fids.size(); ++i )
+        {
+            std::map<int, LibraryFile_ptr>::const_iterator f = files.find( fids[i] );
+            if( f == files.end() ) continue;
+            const LibraryFile& file = *f->second;
+            std::map<int, std::string>::const_iterator art = artist_names.find( file.piartid );
+            std::map<int, std::string>::const_iterator trk = track_names.find( file.pitrkid );
+            if( art == artist_names.end() || trk == track_names.end() ) continue;
+
+            Object& js = out[i];
+            js.reserve(13);
+            js.push_back( Pair("mimetype", file.mimetype) );
+            js.push_back( Pair("size", file.size) );
+            js.push_back( Pair("duration", file.duration) );
+            js.push_back( Pair("bitrate", file.bitrate) );
+            js.push_back( Pair("artist", art->second) );
+            js.push_back( Pair("track", trk->second) );
+            if (file.pialbid) {
+                js.push_back( Pair("album", album_names[file.pialbid]) );
+            }
+            js.push_back( Pair("url", file.url) );
+            ++found;
+        }
+        return found;
     }
     
 };
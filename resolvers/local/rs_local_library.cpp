@@ -20,6 +20,7 @@
 #include <boost/foreach.hpp>
 
 #include "library.h"
+#include "memory_index.h"
 #include "playdar/utils/levenshtein.h"
 #include "resolved_item_builder.hpp"
 #include "playdar/resolver_query.hpp"
@@ -30,6 +31,9 @@ using namespace std;
 
 namespace playdar { namespace resolvers {
 
+// how often to check if the scanner's changed the library under us:
+static const time_t index_check_secs = 60;
+
 /*
     I want to integrate the ngram2/l implementation done by erikf
     in moost here. This is a bit hacky, but gets the job done 99% for now.
@@ -42,7 +46,24 @@ local::init(pa_ptr pap)
 {
     m_pap = pap;
    
-    m_library = new Library( pap->getstring( "db", "" ).get_str());
+    // queries are worked on by plugins.local.workers threads, each with
+    // its own db connection, plus one more connection for the http 
+    // handlers. one by default, as it always was; more may help on a 
+    // multi-core machine with a big library, measure before turning it up:
+    int workers = pap->get<int>( "plugins.local.workers", 1 );
+    if( workers < 1 ) workers = 1;
+    m_library = new Library( pap->getstring( "db", "" ).get_str(), workers + 1 );
+
+    // answer searches from memory rather than the ngram tables. it's 
+    // rebuilt when the scanner changes the library, see index().
+    if( pap->get<bool>( "plugins.local.memory_index", true ) )
+    {
+        m_index_stamp = library_stamp();
+        time( &m_index_checked );
+        m_index.reset( new MemoryIndex() );
+        Library::reader rd( *m_library );
+        m_index->build( rd.db() );
+    }
 
     m_exiting = false;
     cout << "Local library resolver: " << m_library->num_files() 
@@ -52,8 +73,11 @@ local::init(pa_ptr pap)
         cout << endl << "WARNING! You don't have any files in your database!"
              << "Run the scanner, then restart Playdar." << endl << endl;
     }
-    // worker thread for doing actual resolving:
-    m_t = new boost::thread(boost::bind(&local::run, this));
+    // worker threads for doing actual resolving:
+    for( int i = 0; i < workers; ++i )
+    {
+        m_threads.push_back( new boost::thread(boost::bind(&local::run, this)) );
+    }
     
     return true;
 }
@@ -77,15 +101,22 @@ local::run()
             rq_ptr rq;
             {
                 boost::mutex::scoped_lock lk(m_mutex);
-                if(m_pending.size() == 0) m_cond.wait(lk);
+                while(m_pending.size() == 0 && !m_exiting) m_cond.wait(lk);
                 if(m_exiting) break;
                 rq = m_pending.back();
                 m_pending.pop_back();
             }
-            if(rq && !rq->cancelled())
+            if(!rq) continue;
+            // no point starting on it if it's already solved, or the
+            // client's deadline has passed:
+            if(!rq->finished() && !rq->past_deadline())
             {
                 process( rq );
             }
+            else
+            {
+                m_pap->report_skipped( rq->id() );
+            }
         }
     }
     catch(...)
@@ -96,35 +127,138 @@ local::run()
 
 // 
 
+/// num files and highest file id, one or the other changes whenever
+/// the scanner adds, removes or rescans a file.
+pair<int,int>
+local::library_stamp()
+{
+    return make_pair( m_library->num_files(), m_library->max_file_id() );
+}
+
+/// the memory index, 0 if it's turned off. every so often this starts 
+/// a thread to check if the library's changed and rebuild it if so, 
+/// searches carry on with the one we have meanwhile.
+boost::shared_ptr<MemoryIndex>
+local::index()
+{
+    boost::mutex::scoped_lock lk( m_index_mut );
+    time_t now;
+    time( &now );
+    if( !m_index || m_rebuilding || now - m_index_checked < index_check_secs ) 
+        return m_index;
+    m_index_checked = now;
+    m_rebuilding = true;
+    if( m_rebuilder )
+    {
+        // done with the last one, or just about:
+        m_rebuilder->join();
+        delete m_rebuilder;
+    }
+    m_rebuilder = new boost::thread( boost::bind( &local::rebuild_index, this ) );
+    return m_index;
+}
+
+/// rebuilder thread, one at a time.
+void
+local::rebuild_index()
+{
+    pair<int,int> stamp;
+    boost::shared_ptr<MemoryIndex> mi;
+    try
+    {
+        stamp = library_stamp();
+        {
+            boost::mutex::scoped_lock lk( m_index_mut );
+            if( stamp == m_index_stamp )
+            {
+                m_rebuilding = false;
+                return;
+            }
+        }
+        cout << "Local library changed, rebuilding memory index" << endl;
+        mi.reset( new MemoryIndex() );
+        Library::reader rd( *m_library );
+        mi->build( rd.db() );
+    }
+    catch( const std::exception& e )
+    {
+        cerr << "Rebuilding memory index failed: " << e.what() << endl;
+        boost::mutex::scoped_lock lk( m_index_mut );
+        m_rebuilding = false;
+        return;
+    }
+    boost::mutex::scoped_lock lk( m_index_mut );
+    m_index = mi;
+    m_index_stamp = stamp;
+    m_rebuilding = false;
+}
+
 /// this is some what fugly atm, but gets the job done for now.
-/// it does the fuzzy library search using the ngram table from the db:
+/// it does the fuzzy library search using the ngram table from the db,
+/// unless we have exactly the artist and track asked for.
 void
 local::process( rq_ptr rq )
 {
     vector< json_spirit::Object > final_results;
+    boost::shared_ptr<MemoryIndex> mi = index();
+    if( mi && rq->isValidTrack() )
+    {
+        vector<int> fids = mi->exact( rq->param( "artist" ).get_str(), 
+                                      rq->param( "track" ).get_str() );
+        vector< json_spirit::Object > items;
+        {
+            Library::reader rd( *m_library );
+            ResolvedItemBuilder::createFromFids( rd.stmts(), fids, items );
+        }
+        BOOST_FOREACH(json_spirit::Object& js, items)
+        {
+            if( js.empty() ) continue;
+            js.push_back( json_spirit::Pair( "sid", m_pap->gen_sid()) );
+            js.push_back( json_spirit::Pair( "source", m_pap->hostname()) );
+            // same names, so as good as it gets. solves the query:
+            js.push_back( json_spirit::Pair( "score", 1.0 ) );
+            final_results.push_back( js );
+        }
+        boost::mutex::scoped_lock lk( m_index_mut );
+        ++m_exact_lookups;
+        if( final_results.size() ) ++m_exact_hits;
+    }
+    if( final_results.size() )
+    {
+        m_pap->report_results( rq->id(), final_results );
+        m_pap->report_done( rq->id() );
+        return;
+    }
     // get candidates (rough potential matches):
-    vector<scorepair> candidates = find_candidates(rq, 10);
+    vector<scorepair> candidates = find_candidates(rq, mi.get(), 10);
     // now do the "real" scoring of candidate results:
     string reason; // for scoring debug.
-    BOOST_FOREACH(scorepair &sp, candidates)
+    vector< json_spirit::Object > items;
     {
+        Library::reader rd( *m_library );
         // multiple files in our collection may have matching metadata.
         // add them all to the results.
-        vector<int> fids = m_library->get_fids_for_tid(sp.id);
-        BOOST_FOREACH(int fid, fids)
+        vector<int> fids;
+        BOOST_FOREACH(scorepair &sp, candidates)
         {
-            json_spirit::Object js;
-            js.reserve(12);
-            ResolvedItemBuilder::createFromFid( *m_library, fid, js );
-            js.push_back( json_spirit::Pair( "sid", m_pap->gen_uuid()) );
-            js.push_back( json_spirit::Pair( "source", m_pap->hostname()) );
-            final_results.push_back( js );
+            vector<int> tfids = Library::get_fids_for_tid(rd.stmts(), sp.id);
+            fids.insert( fids.end(), tfids.begin(), tfids.end() );
         }
+        ResolvedItemBuilder::createFromFids( rd.stmts(), fids, items );
+    }
+    BOOST_FOREACH(json_spirit::Object& js, items)
+    {
+        if( js.empty() ) continue;
+        js.push_back( json_spirit::Pair( "sid", m_pap->gen_sid()) );
+        js.push_back( json_spirit::Pair( "source", m_pap->hostname()) );
+        final_results.push_back( js );
     }
     if(final_results.size())
     {
         m_pap->report_results( rq->id(), final_results );
     }
+    // let the pipeline move on without waiting for our targettime:
+    m_pap->report_done( rq->id() );
 }
 
 /// Search library for candidates roughly matching the query.
@@ -134,7 +268,7 @@ local::process( rq_ptr rq )
 ///
 /// First find suitable artists, then collect matching tracks for each artist.
 vector<scorepair> 
-local::find_candidates(rq_ptr rq, unsigned int limit)
+local::find_candidates(rq_ptr rq, const MemoryIndex* index, unsigned int limit)
 { 
     vector<scorepair> candidates;
     float maxartscore = 0;
@@ -144,17 +278,19 @@ local::find_candidates(rq_ptr rq, unsigned int limit)
         !rq->param_exists( "track" ))
         return candidates;
     
-    vector<scorepair> artistresults =
-        m_library->search_catalogue("artist", rq->param( "artist" ).get_str());
+    const string& artist = rq->param( "artist" ).get_str();
+    const string& track = rq->param( "track" ).get_str();
+    vector<scorepair> artistresults = index ?
+        index->search_artists( artist ) :
+        m_library->search_catalogue( "artist", artist );
     BOOST_FOREACH( scorepair & sp, artistresults )
     {
         if(maxartscore==0) maxartscore = sp.score;
         float artist_multiplier = (float)sp.score / maxartscore;
         float maxtrkscore = 0;
-        vector<scorepair> trackresults = 
-            m_library->search_catalogue_for_artist(sp.id, 
-                                                          "track",
-                                                          rq->param( "track" ).get_str());
+        vector<scorepair> trackresults = index ?
+            index->search_artist_tracks( sp.id, track ) :
+            m_library->search_catalogue_for_artist( sp.id, "track", track );
         BOOST_FOREACH( scorepair & sptrk, trackresults )
         {
             if(maxtrkscore==0) maxtrkscore = sptrk.score;
@@ -239,6 +375,13 @@ local::anon_http_handler(const playdar_request& req, playdar_response& resp, pla
    if( req.parts().size() > 1 &&
        (req.parts()[1] == "config" || req.parts()[1] == "stats") )
    {
+       size_t index_kb, lookups, hits;
+       {
+           boost::mutex::scoped_lock lk( m_index_mut );
+           index_kb = m_index ? m_index->footprint() / 1024 : 0;
+           lookups = m_exact_lookups;
+           hits = m_exact_hits;
+       }
        std::ostringstream reply; 
        reply   << "<h2>Local Library Stats</h2>" 
                << "<table>" 
@@ -246,6 +389,9 @@ local::anon_http_handler(const playdar_request& req, playdar_response& resp, pla
                            << "<tr><td>Artists</td><td>" << m_library->num_artists() << "</td></tr>\n" 
                            << "<tr><td>Albums</td><td>" << m_library->num_albums() << "</td></tr>\n" 
                            << "<tr><td>Tracks</td><td>" << m_library->num_tracks() << "</td></tr>\n" 
+                           << "<tr><td>Memory index</td><td>" << index_kb << " KB</td></tr>\n" 
+                           << "<tr><td>Exact matches</td><td>" << hits << " of " << lookups 
+                           << " (" << ( lookups ? 100 * hits / lookups : 0 ) << "%)</td></tr>\n" 
                << "</table>";
        resp = reply.str();
        return true;
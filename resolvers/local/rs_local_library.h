@@ -20,23 +20,29 @@
 #define __RS_LOCAL_LIBRARY_H__
 
 #include <deque>
+#include <vector>
 
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
+#include <boost/foreach.hpp>
 
 // All resolver plugins should include this header: 
 #include "playdar/playdar_plugin_include.h"
 
 namespace playdar {
     class Library;
+    class MemoryIndex;
 namespace resolvers {
 
 
 class local : public ResolverPlugin<local>
 {
 public:
-    local(){}
+    local() 
+        : m_index_checked(0), m_rebuilding(false), m_rebuilder(0),
+          m_exact_lookups(0), m_exact_hits(0)
+    {}
     bool init(pa_ptr pap);
     void start_resolving(rq_ptr rq);
     void run();
@@ -69,24 +75,48 @@ protected:
 
     ~local() throw() 
     {
-        m_exiting = true;
+        {
+            boost::mutex::scoped_lock lk(m_mutex);
+            m_exiting = true;
+        }
         m_cond.notify_all();
-        m_t->join();
+        BOOST_FOREACH( boost::thread* t, m_threads )
+        {
+            t->join();
+            delete t;
+        }
+        if( m_rebuilder )
+        {
+            m_rebuilder->join();
+            delete m_rebuilder;
+        }
     };
     
 private:
     Library* m_library;
+
+    boost::mutex m_index_mut;   // protects the following:
+    boost::shared_ptr<MemoryIndex> m_index; // unless plugins.local.memory_index is off
+    std::pair<int,int> m_index_stamp;       // num files and max file id it was built at
+    time_t m_index_checked;
+    bool m_rebuilding;              // m_rebuilder is checking/building
+    boost::thread* m_rebuilder;
+    size_t m_exact_lookups, m_exact_hits;
     pa_ptr m_pap;
 
     bool m_exiting;
 
     std::deque<rq_ptr> m_pending;
 
-    boost::thread* m_t;
+    std::vector<boost::thread*> m_threads;
     boost::mutex m_mutex;
     boost::condition m_cond;
 
-    std::vector<scorepair> find_candidates(rq_ptr rq, unsigned int limit = 0);
+    boost::shared_ptr<MemoryIndex> index();
+    void rebuild_index();
+    std::pair<int,int> library_stamp();
+    std::vector<scorepair> find_candidates(rq_ptr rq, const MemoryIndex* index, 
+                                           unsigned int limit = 0);
 
 };
 
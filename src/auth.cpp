@@ -27,7 +27,7 @@ namespace playdar {
 using namespace std;
 
 auth::auth(const string& dbfilepath)
-    : m_db(dbfilepath.c_str())
+    : m_db(dbfilepath.c_str()), m_stmts(m_db)
 {
     check_db();
 }
@@ -36,9 +36,9 @@ bool
 auth::is_valid(const string& token, string& whom)
 {
     boost::mutex::scoped_lock lock(m_mut);
-    sqlite3pp::query qry(m_db, "SELECT name FROM playdar_auth WHERE token = ?" );
-    qry.bind(1, token.c_str(), true);
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::stmt_cache::query qry(m_stmts, "SELECT name FROM playdar_auth WHERE token = ?" );
+    qry->bind(1, token.c_str(), true);
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         whom = string((*i).get<const char *>(0));
         return true;
     }
@@ -50,8 +50,8 @@ auth::get_all_authed()
 {
     boost::mutex::scoped_lock lock(m_mut);
     vector< map<string, string> > ret;
-    sqlite3pp::query qry(m_db, "SELECT token, website, name, ua FROM playdar_auth ORDER BY mtime DESC");
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::stmt_cache::query qry(m_stmts, "SELECT token, website, name, ua FROM playdar_auth ORDER BY mtime DESC");
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         map<string, string> m;
         m["token"]   = string((*i).get<const char *>(0));
         m["website"] = string((*i).get<const char *>(1));
@@ -66,27 +66,25 @@ void
 auth::deauth(const string& token)
 {
     boost::mutex::scoped_lock lock(m_mut);
-    string sql = "DELETE FROM playdar_auth WHERE token = ?";
-    sqlite3pp::command cmd(m_db, sql.c_str());
-    cmd.bind(1, token.c_str(), true);
-    cmd.execute();
+    utils::stmt_cache::command cmd(m_stmts, "DELETE FROM playdar_auth WHERE token = ?");
+    cmd->bind(1, token.c_str(), true);
+    cmd->execute();
 }
 
 void 
 auth::create_new(const string& token, const string& website, const string& name, const string& ua )
 {
     boost::mutex::scoped_lock lock(m_mut);
-    string sql = "INSERT INTO playdar_auth "
-                 "(token, website, name, ua, mtime, permissions) "
-                 "VALUES(?, ?, ?, ?, ?, ?)";
-    sqlite3pp::command cmd(m_db, sql.c_str());
-    cmd.bind(1, token.c_str(), true);
-    cmd.bind(2, website.c_str(), true);
-    cmd.bind(3, name.c_str(), true);
-    cmd.bind(4, ua.c_str(), true);
-    cmd.bind(5, 0);
-    cmd.bind(6, "*", true);
-    cmd.execute();
+    utils::stmt_cache::command cmd(m_stmts, "INSERT INTO playdar_auth "
+                                   "(token, website, name, ua, mtime, permissions) "
+                                   "VALUES(?, ?, ?, ?, ?, ?)");
+    cmd->bind(1, token.c_str(), true);
+    cmd->bind(2, website.c_str(), true);
+    cmd->bind(3, name.c_str(), true);
+    cmd->bind(4, ua.c_str(), true);
+    cmd->bind(5, 0);
+    cmd->bind(6, "*", true);
+    cmd->execute();
 }
 
 void 
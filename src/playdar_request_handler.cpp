@@ -63,6 +63,7 @@ playdar_request_handler::init(MyApplication * app)
     m_urlHandlers[ "shutdown" ] = boost::bind( &playdar_request_handler::handle_shutdown, this, _1, _2 );
     m_urlHandlers[ "settings" ] = boost::bind( &playdar_request_handler::handle_settings, this, _1, _2 );
     m_urlHandlers[ "queries" ] = boost::bind( &playdar_request_handler::handle_queries, this, _1, _2 );
+    m_urlHandlers[ "stats" ] = boost::bind( &playdar_request_handler::handle_stats, this, _1, _2 );
     m_urlHandlers[ "static" ] = boost::bind( &playdar_request_handler::serve_static_file, this, _1, _2 );
     m_urlHandlers[ "sid" ] = boost::bind( &playdar_request_handler::handle_sid, this, _1, _2 );
     m_urlHandlers[ "comet" ] = boost::bind( &playdar_request_handler::handle_comet, this, _1, _2 );
@@ -256,6 +257,8 @@ playdar_request_handler::handle_root( const playdar_request& req,
            "<td>Weight</td>"
            "<td>Preference</td>"
            "<td>Target Time</td>"
+           "<td>Latency p50 / p90</td>"
+           "<td>Latency Histogram</td>"
            "<td>Scope</td>"
            "<td>Configuration</td>"
            "</tr>"
@@ -274,8 +277,9 @@ playdar_request_handler::handle_root( const playdar_request& req,
             "<td>" << htmlentities(pap->rs()->name()) << "</td>"
             "<td>" << pap->weight() << "</td>"
             "<td>" << pap->preference() << "</td>"
-            "<td>" << pap->targettime() << "ms</td>"
-            "<td>" << (pap->localonly()?"local":"global") << "</td>"
+            "<td>" << pap->targettime() << "ms</td>";
+        latency_cells( app()->resolver()->latency_stats( pap->rs() ), os );
+        os  << "<td>" << (pap->localonly()?"local":"global") << "</td>"
             "<td>";
         string name = pap->rs()->name();
         boost::algorithm::to_lower( name );
@@ -310,6 +314,40 @@ playdar_request_handler::handle_root( const playdar_request& req,
 
 }
 
+/// observed latency columns for a resolver on the root page.
+/// the histogram is a row of bars, hover for the bucket and count.
+void
+playdar_request_handler::latency_cells( const json_spirit::Object& lat, 
+                                        ostringstream& os )
+{
+    using namespace json_spirit;
+    map< string, Value > m;
+    obj_to_map( lat, m );
+    if( m.find("samples") == m.end() || m["samples"].get_int() == 0 )
+    {
+        os << "<td>-</td><td>-</td>";
+        return;
+    }
+    os  << "<td>" << m["p50"].get_int() << "ms / " << m["p90"].get_int() << "ms"
+        << " <small>(n=" << m["samples"].get_int() 
+        << ", configured " << m["configured"].get_int() << "ms)</small></td>"
+        << "<td style=\"white-space: nowrap;\">";
+    int most = 0;
+    BOOST_FOREACH( const Value& b, m["buckets"].get_array() )
+        most = max( most, b.get_array()[1].get_int() );
+    BOOST_FOREACH( const Value& b, m["buckets"].get_array() )
+    {
+        int upto = b.get_array()[0].get_int();
+        int n = b.get_array()[1].get_int();
+        os  << "<span title=\"" << (upto ? "&lt;= " : "&gt; 60000") ;
+        if( upto ) os << upto;
+        os  << "ms: " << n << "\" style=\"display: inline-block; width: 4px; "
+               "background-color: #557; vertical-align: bottom; height: "
+            << ( 1 + 24 * n / most ) << "px;\"></span>";
+    }
+    os  << "</td>";
+}
+
 void
 playdar_request_handler::handle_pluginurl( const playdar_request& req,
                                            moost::http::reply& rep )
@@ -462,8 +500,18 @@ playdar_request_handler::handle_queries_root(const playdar_request& req)
     deque< query_uid > queries;
     app()->resolver()->qids(queries);
 
+    json_spirit::Object stats = app()->resolver()->stats();
+    map<string, json_spirit::Value> sm;
+    json_spirit::obj_to_map( stats, sm );
+
     ostringstream os;
-    os  << "<h2>Current Queries (" << queries.size() << ")</h2>"
+    os  << "<h2>Current Queries (" << sm["queries"].get_int64() << ")</h2>"
+        "<p>Approx. memory used: " << sm["footprint_bytes"].get_int64()/1024 << " KB, "
+        "evicted: " << sm["evicted"].get_int64() << ", "
+        "expired: " << sm["expired"].get_int64() << ", "
+        "coalesced: " << sm["coalesce_followers"].get_int64() << ". "
+        "Showing the " << queries.size() << " most recent. "
+        "<a href=\"/stats\">Stats</a></p>"
         "<table>"
         "<tr style=\"font-weight:bold;\">"
         "<td>QID</td>"
@@ -516,6 +564,17 @@ playdar_request_handler::handle_queries_root(const playdar_request& req)
     return os.str();
 }
 
+void 
+playdar_request_handler::handle_stats( const playdar_request& req,
+                                       moost::http::reply& rep )
+{
+    string body = json_spirit::write_formatted( app()->resolver()->stats() );
+    rep.add_header( "Content-Type", "text/javascript; charset=utf-8" );
+    rep.add_header( "Content-Length", body.length() );
+    rep.write_content( body );
+    rep.write_finish();
+}
+
 void 
 playdar_request_handler::handle_queries( const playdar_request& req,
                                          moost::http::reply& rep )
@@ -636,13 +695,26 @@ playdar_request_handler::handle_quickplay( const playdar_request& req,
     boost::shared_ptr<ResolverQuery> rq = TrackRQBuilder::build(artist, album, track);
     rq->set_from_name(app()->conf()->name());
     rq->set_origin_local( true );
+    // wait a couple of seconds for results, or less if asked to:
+    int wait_ms = 2000;
+    if( req.getvar_exists("deadline") )
+    {
+        int ms = atoi( req.getvar("deadline").c_str() );
+        if( ms > 0 && ms < wait_ms ) wait_ms = ms;
+        rq->set_deadline_ms( wait_ms );
+    }
     query_uid qid = app()->resolver()->dispatch(rq);
-    // wait a couple of seconds for results
     boost::xtime time; 
     boost::xtime_get(&time,boost::TIME_UTC); 
-    time.sec += 2;
+    time.sec += wait_ms / 1000;
+    time.nsec += (wait_ms % 1000) * 1000000;
+    if( time.nsec >= 1000000000 )
+    {
+        time.sec += 1;
+        time.nsec -= 1000000000;
+    }
     boost::thread::sleep(time);
-    vector< ri_ptr > results = app()->resolver()->get_results(qid);
+    vector< ri_ptr > results = app()->resolver()->get_results(qid, 1, 0);
     
     if (results.size() && !results[0]->json_value( "url", "" ).empty()) {
         json_spirit::Object ro = results[0]->get_json();
@@ -28,14 +28,17 @@
 #include <boost/version.hpp>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
+#include <boost/functional/hash.hpp>
 
 #include "playdar/resolver.h"
+#include "playdar/result_cache.h"
 #include "playdar/ss_curl.hpp"
 #include "playdar/rs_script.h"
 
 // Generic track calculation stuff:
 #include "playdar/track_rq_builder.hpp"
 #include "playdar/utils/levenshtein.h"
+#include "playdar/utils/normalize.h"
 #include "playdar/pluginadaptor_impl.hpp"
 
 // PDL stuff:
@@ -53,12 +56,59 @@ using namespace resolvers;
 using namespace std;
 
 Resolver::Resolver(MyApplication * app)
-    :m_app(app), m_exiting(false)
+    :m_app(app),
+     m_footprint(0), m_num_queries(0), m_num_evicted(0), m_num_expired(0),
+     m_num_leaders(0), m_num_followers(0), 
+     m_num_tiers_early(0), m_num_tiers_timeout(0), m_num_deadline_cut(0),
+     m_num_hedges(0), m_num_hedge_dispatches(0), m_num_hedge_cancels(0),
+     m_num_solved(0), m_num_skipped(0),
+     m_evicting(false), m_dispatch(0)
 {
     m_id_counter = 0;
     cout << "Resolver starting..." << endl;
     
-    m_t = new boost::thread(boost::bind(&Resolver::dispatch_runner, this));
+    // query retention limits, 0 means unlimited:
+    m_max_query_lifetime = m_app->conf()->get<int>("resolver.max_query_lifetime", 21600);
+    m_max_queries = m_app->conf()->get<int>("resolver.max_queries", 100000);
+    m_max_query_memory = (size_t) m_app->conf()->get<int>("resolver.max_query_memory_mb", 0) 
+                         * 1024 * 1024;
+    m_max_qidlist = m_app->conf()->get<int>("resolver.recent_queries", 1000);
+    // identical track queries this close together share one pipeline run, 0 disables:
+    m_coalesce_window = m_app->conf()->get<int>("resolver.coalesce_window", 30);
+    
+    // cache of results, persisted across restarts:
+    m_cache = 0;
+    if( m_app->conf()->get<bool>("resolver.cache.enabled", true) )
+    {
+        m_cache = new ResultCache( 
+            m_app->conf()->get<string>("resolver.cache.file", "resultcache.json"),
+            m_app->conf()->get<int>("resolver.cache.max_entries", 50000) );
+        m_cache->load();
+    }
+    m_cache_default_ttl = m_app->conf()->get<int>("resolver.cache.ttl", 3600);
+    m_cache_refresh = m_app->conf()->get<bool>("resolver.cache.refresh", true);
+    m_cache_refresh_time = m_app->conf()->get<int>("resolver.cache.refresh_time", 120);
+    m_cache_save_interval = m_app->conf()->get<int>("resolver.cache.save_interval", 300);
+    
+    // targettimes follow observed latency of each resolver:
+    m_adaptive_targettime = m_app->conf()->get<bool>("resolver.adaptive_targettime", true);
+    m_targettime_percentile = m_app->conf()->get<int>("resolver.targettime_percentile", 90);
+    m_targettime_min_samples = m_app->conf()->get<int>("resolver.targettime_min_samples", 20);
+    
+    // results scoring at least this solve a query, so the pipeline stops
+    // and resolvers can drop any work they still have queued for it:
+    json_spirit::Value st = m_app->conf()->get_json("resolver.solve_threshold");
+    if( st.type() == json_spirit::real_type ) 
+        m_solve_threshold = st.get_real();
+    else if( st.type() == json_spirit::int_type ) 
+        m_solve_threshold = st.get_int();
+    else
+        m_solve_threshold = 1.0f;
+    
+    // hedged pipeline for every query, not just those that ask for it:
+    m_hedge = m_app->conf()->get<bool>("resolver.hedge", false);
+    // percentage of a tier's targettime we wait before hedging:
+    m_hedge_fraction = m_app->conf()->get<int>("resolver.hedge_percent", 50) / 100.0;
     
     // set up io_service with work so it never ends:
     m_io_service = new boost::asio::io_service();
@@ -66,6 +116,31 @@ Resolver::Resolver(MyApplication * app)
     m_iothr = new boost::thread(boost::bind(
                     &boost::asio::io_service::run,
                     m_io_service));
+    m_wheel = new TimerWheel( *m_io_service,
+                    m_app->conf()->get<int>("resolver.timer_tick_ms", 10) );
+    
+    // result callbacks run on these, not on whatever thread found the result:
+    m_delivery = ResultDelivery::create( 
+                    m_app->conf()->get<int>("resolver.delivery_threads", 2),
+                    m_app->conf()->get<int>("resolver.delivery_backlog", 1000) );
+    
+    // pipeline dispatch threads, defaults to one per core:
+    int nthreads = m_app->conf()->get<int>("resolver.dispatch_threads", 
+                        boost::thread::hardware_concurrency());
+    if( nthreads < 1 ) nthreads = 1;
+    m_dispatch = new utils::work_queues< pipeline_work >( nthreads );
+    for( int i = 0; i < nthreads; ++i )
+    {
+        m_dthreads.push_back( new boost::thread(
+                    boost::bind(&Resolver::dispatch_runner, this, i)) );
+    }
+    cout << "Pipeline dispatch threads: " << nthreads << endl;
+    
+    if( m_cache )
+    {
+        m_wheel->schedule( m_cache_save_interval * 1000,
+                           boost::bind(&Resolver::save_cache, this) );
+    }
     
     // Initialize built-in curl SS facts:
     detect_curl_capabilities();
@@ -132,12 +207,24 @@ Resolver::detect_curl_capabilities()
 
 Resolver::~Resolver()
 {
-    m_exiting = true;
-    m_cond.notify_one();
-    m_t->join();
+    m_dispatch->shutdown();
+    BOOST_FOREACH( boost::thread * t, m_dthreads )
+    {
+        t->join();
+        delete t;
+    }
+    delete m_dispatch;
+    // live queries may still hold on to it, it goes when the last one does:
+    m_delivery.reset();
     delete m_work;
     m_io_service->stop();
     m_iothr->join();
+    delete m_wheel;
+    if( m_cache )
+    {
+        m_cache->save();
+        delete m_cache;
+    }
 }
 
 bool
@@ -200,6 +287,9 @@ Resolver::load_resolver_scripts()
                 (conf+".targettime", rs->target_time()) );
             pap->set_localonly( app()->conf()->get<bool>
                 (conf+".localonly", rs->localonly()) );
+            m_cache_ttls[ pap->rs()->name() ] = app()->conf()->get<int>
+                (conf+".cache_ttl", m_cache_default_ttl);
+            track_latency( pap, conf );
             // if weight == 0, it doesnt resolve, but may handle HTTP calls etc.
             if(pap->weight() > 0) 
             {
@@ -283,6 +373,9 @@ Resolver::load_resolver_plugins()
                 (rsopt + ".targettime", instance->target_time()) );
             pap->set_localonly( app()->conf()->get<bool>
                 (rsopt + ".localonly", instance->localonly()) );
+            m_cache_ttls[ pap->rs()->name() ] = app()->conf()->get<int>
+                (rsopt + ".cache_ttl", m_cache_default_ttl);
+            track_latency( pap, rsopt );
                 
             m_resolvers.push_back( pap );
             cout << "-> OK [w:" << pap->weight() 
@@ -318,13 +411,22 @@ Resolver::dispatch(rq_ptr rq)
 query_uid 
 Resolver::dispatch(rq_ptr rq, rq_callback_t cb) 
 {
-    boost::mutex::scoped_lock lk(m_mutex);
+    return dispatch_query(rq, cb, true);
+}
+
+query_uid 
+Resolver::dispatch_query(rq_ptr rq, rq_callback_t cb, bool usecache) 
+{
+    if( rq->isValidTrack() ) rq->set_score_terms( make_score_terms( rq ) );
+    rq->set_solve_threshold( m_solve_threshold );
+    rq->set_delivery( m_delivery );
     if(!add_new_query(rq))
     {
         // already running
         return rq->id();
     }
     if(cb) rq->register_callback(cb);
+    rq->on_solved( boost::bind(&Resolver::query_solved, this, _1) );
 
     // setup comet callback if the request has a valid comet session id
     const string& cometId(rq->comet_session_id());
@@ -336,34 +438,255 @@ Resolver::dispatch(rq_ptr rq, rq_callback_t cb)
         }
     }
 
-    m_pending.push_front( pair<rq_ptr, unsigned short>(rq, 999) );
-    m_cond.notify_one();
-    // set up timer to auto-cancel this query after a while:
-    boost::asio::deadline_timer * t = new boost::asio::deadline_timer(*m_io_service);
+    // set up timer to auto-cancel this query after a while.
     // give 5 mins additional time to allow setup/results, otherwise it would never be stale
     // at max_query_lifetime, because the first result updates the atime:
-    t->expires_from_now(boost::posix_time::seconds(max_query_lifetime()+300));
-    t->async_wait(boost::bind(&Resolver::cancel_query_timeout, this, rq->id()));
-    m_qidtimers[rq->id()] = t;
+    m_qidtimers.set( rq->id(), 
+        m_wheel->schedule( (max_query_lifetime()+300) * 1000,
+                           boost::bind(&Resolver::cancel_query_timeout, this, rq->id()) ) );
+    
+    if( usecache && serve_from_cache( rq ) )
+    {
+        return rq->id();
+    }
+    
+    rq_ptr leader;
+    if( coalesce( rq, leader ) )
+    {
+        // the same query is already in the pipeline, piggyback on it:
+        cout << "Coalescing query " << rq->id() << " with " << leader->id() << endl;
+        leader->subscribe( boost::bind(&Resolver::forward_result, this, rq->id(), _2), true );
+        return rq->id();
+    }
+    enqueue_pipeline( rq, 999 );
     return rq->id();
 }
 
-/// thread that loops forever dispatching stuff in the queue
+/// add cached results to a new query. true if that's all we need to do,
+/// false if it should go down the pipeline as normal.
+bool
+Resolver::serve_from_cache( rq_ptr rq )
+{
+    if( !m_cache || !rq->isValidTrack() ) return false;
+    const string key = coalesce_key( rq );
+    vector< json_spirit::Object > items;
+    ResultCache::lookup_result lr = m_cache->get( key, items, m_solve_threshold );
+    if( lr == ResultCache::MISS ) return false;
+    if( lr == ResultCache::STALE && !m_cache_refresh ) return false;
+    
+    size_t bytes = 0;
+    BOOST_FOREACH( const json_spirit::Object& o, items )
+    {
+        ri_ptr rip( new ResolvedItem( o ) );
+        rip->set_id( gen_sid() );
+        map_sid( rip );
+        bytes += rq->add_result( rip );
+    }
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        m_footprint += bytes;
+    }
+    cout << "Served " << items.size() << " cached results for " << rq->id() 
+         << ( lr == ResultCache::STALE ? " (stale, refreshing)" : "" ) << endl;
+    
+    if( lr == ResultCache::STALE && m_cache->begin_refresh( key, m_cache_refresh_time ) )
+    {
+        // run the same query down the pipeline in the background, its 
+        // results go in the cache when it's done, then it's thrown away:
+        rq_ptr r( new TrackQuery );
+        r->set_param( "artist", rq->param("artist").get_str() );
+        r->set_param( "track", rq->param("track").get_str() );
+        if( rq->param_exists("album") && rq->param_type("album") == json_spirit::str_type )
+            r->set_param( "album", rq->param("album").get_str() );
+        r->set_origin_local( rq->origin_local() );
+        r->set_from_name( m_app->conf()->name() );
+        dispatch_query( r, 0, false );
+        m_wheel->schedule( m_cache_refresh_time * 1000,
+                           boost::bind(&Resolver::cancel_query, this, r->id()) );
+    }
+    return true;
+}
+
+/// resolvers can have their own cache ttl, eg short for network sources.
+time_t
+Resolver::cache_ttl( const string& via ) const
+{
+    map< string, time_t >::const_iterator it = m_cache_ttls.find( via );
+    return it == m_cache_ttls.end() ? m_cache_default_ttl : it->second;
+}
+
+/// hold results for the cache until the query's run is over, see
+/// commit_cache. once it is, late results go straight in.
 void
-Resolver::dispatch_runner()
+Resolver::cache_results( const rq_ptr & rq, const vector< ri_ptr >& accepted,
+                         time_t ttl )
+{
+    if( !m_cache || ttl <= 0 || accepted.empty() ) return;
+    {
+        boost::mutex::scoped_lock lk( m_mut_cache_pending );
+        // cancel_query clears our entry after marking it cancelled:
+        if( rq->cancelled() ) return;
+        cache_pending & cp = m_cache_pending[ rq->id() ];
+        if( cp.state == cache_pending::dropped ) return;
+        if( cp.state == cache_pending::pending )
+        {
+            BOOST_FOREACH( const ri_ptr& rip, accepted )
+                cp.items.push_back( make_pair( rip, ttl ) );
+            return;
+        }
+    }
+    const string key = coalesce_key( rq );
+    BOOST_FOREACH( const ri_ptr& rip, accepted ) m_cache->add( key, *rip, ttl );
+}
+
+/// the query is solved, or its pipeline is done: put what it found in the
+/// cache. unless it ran out of time, then what it found is incomplete.
+void
+Resolver::commit_cache( const rq_ptr & rq )
+{
+    if( !m_cache || !rq->isValidTrack() ) return;
+    vector< pair<ri_ptr, time_t> > items;
+    {
+        boost::mutex::scoped_lock lk( m_mut_cache_pending );
+        if( rq->cancelled() ) return;
+        cache_pending & cp = m_cache_pending[ rq->id() ];
+        if( cp.state != cache_pending::pending ) return; // already done
+        if( rq->past_deadline() )
+        {
+            cp.state = cache_pending::dropped;
+            cp.items.clear();
+            return;
+        }
+        cp.state = cache_pending::committed;
+        items.swap( cp.items );
+    }
+    const string key = coalesce_key( rq );
+    typedef pair<ri_ptr, time_t> item_t;
+    BOOST_FOREACH( const item_t& i, items ) m_cache->add( key, *i.first, i.second );
+}
+
+void
+Resolver::save_cache()
+{
+    if( !m_cache ) return;
+    // not on the timer thread, pipeline continuations run there:
+    m_cache->save_async();
+    m_wheel->schedule( m_cache_save_interval * 1000,
+                       boost::bind(&Resolver::save_cache, this) );
+}
+
+/// normalized artist/album/track, and whether it's a local query as
+/// that decides which resolvers the pipeline uses.
+// static
+string
+Resolver::coalesce_key( const rq_ptr & rq )
+{
+    const ResolverQuery::score_terms& t = rq->terms();
+    if( t.ready )
+        return t.artist + "\t" + t.album + "\t" + t.track + "\t" +
+               ( rq->origin_local() ? "L" : "R" );
+    string alb;
+    if( rq->param_exists("album") && rq->param_type("album") == json_spirit::str_type )
+        alb = rq->param("album").get_str();
+    return sortname( rq->param("artist").get_str() ) + "\t" +
+           sortname( alb ) + "\t" +
+           sortname( rq->param("track").get_str() ) + "\t" +
+           ( rq->origin_local() ? "L" : "R" );
+}
+
+/// true if rq should follow an in-flight query (set in leader), otherwise 
+/// rq becomes the leader for its key.
+bool
+Resolver::coalesce( rq_ptr rq, rq_ptr & leader )
+{
+    if( !m_coalesce_window || !rq->isValidTrack() ) return false;
+    const string key = coalesce_key( rq );
+    time_t now;
+    time(&now);
+    
+    boost::mutex::scoped_lock lk(m_mut_inflight);
+    map< string, group_ptr >::iterator it = m_inflight.find( key );
+    if( it != m_inflight.end() && now - it->second->started <= m_coalesce_window &&
+        m_queries.get( it->second->leader, leader ) && !leader->cancelled() )
+    {
+        group_ptr g = it->second;
+        boost::mutex::scoped_lock glk(g->mut);
+        if( g->live > 0 )
+        {
+            ++g->live;
+            m_qid2group.set( rq->id(), g );
+            boost::mutex::scoped_lock slk(m_mut_stats);
+            ++m_num_followers;
+            return true;
+        }
+    }
+    // a pipeline run that may be cut short by a deadline can't lead others:
+    if( rq->has_deadline() ) return false;
+    group_ptr g( new coalesce_group );
+    g->key = key;
+    g->leader = rq->id();
+    g->started = now;
+    g->live = 1;
+    m_inflight[key] = g;
+    m_qid2group.set( rq->id(), g );
+    boost::mutex::scoped_lock slk(m_mut_stats);
+    ++m_num_leaders;
+    return false;
+}
+
+/// called when qid is cancelled. last is false if other queries in its 
+/// group are still alive, and so still using the same results (and sids).
+void
+Resolver::leave_group( const query_uid & qid, bool & last )
+{
+    last = true;
+    group_ptr g;
+    if( !m_qid2group.take( qid, g ) ) return;
+    {
+        boost::mutex::scoped_lock glk(g->mut);
+        last = --g->live == 0;
+    }
+    if( g->leader == qid )
+    {
+        // no new followers for a cancelled leader:
+        boost::mutex::scoped_lock lk(m_mut_inflight);
+        map< string, group_ptr >::iterator it = m_inflight.find( g->key );
+        if( it != m_inflight.end() && it->second == g ) m_inflight.erase( it );
+    }
+}
+
+/// leader found a result, pass it on to a follower.
+/// the result is already scored and its sid is already mapped.
+void
+Resolver::forward_result( const query_uid & follower, const ri_ptr & rip )
+{
+    rq_ptr rq;
+    if( !m_queries.get( follower, rq ) ) return;
+    size_t bytes = rq->add_result( rip );
+    boost::mutex::scoped_lock lk(m_mut_stats);
+    m_footprint += bytes;
+}
+
+/// queue the next step of the pipeline for this query.
+/// a query always lands on the same dispatch queue, so unless it gets stolen
+/// it's run by the same thread each time.
+void
+Resolver::enqueue_pipeline( rq_ptr rq, unsigned short lastweight )
+{
+    m_dispatch->push( boost::hash<string>()( rq->id() ), 
+                      pipeline_work(rq, lastweight) );
+}
+
+/// thread that loops forever dispatching stuff in the queues
+void
+Resolver::dispatch_runner( size_t idx )
 {
     try
     {
         while(true)
         {
-            pair<rq_ptr, unsigned short> p;
-            {
-                boost::mutex::scoped_lock lk(m_mutex);
-                if(m_pending.size() == 0) m_cond.wait(lk);
-                if(m_exiting) break;
-                p = m_pending.back();
-                m_pending.pop_back();
-            }
+            pipeline_work p;
+            if( !m_dispatch->take( idx, p ) ) break; // shutting down
             run_pipeline( p.first, p.second );
         }
     }
@@ -371,17 +694,21 @@ Resolver::dispatch_runner()
     {
         cout << "Error exiting Resolver::dispatch_runner" << endl;
     }
-    cout << "Resolver dispatch_runner terminating" << endl;
+    cout << "Resolver dispatch_runner " << idx << " terminating" << endl;
 }
 
 /// go thru list of resolversservices and dispatch in order
 /// lastweight is the weight of the last resolver we dispatched to.
+/// the next tier starts once everything at this one reported done, 
+/// or after the shortest targettime at this tier, whichever is first.
 void
 Resolver::run_pipeline( rq_ptr rq, unsigned short lastweight )
 {
     unsigned short atweight = 0;
     unsigned int mintime = 0;
     bool started = false;
+    bool more = false; // are there lower weighted tiers after this one
+    vector< pa_ptr > tier;
     BOOST_FOREACH( pa_ptr pap, m_resolvers )
     {
         if(pap->weight() >= lastweight) continue;
@@ -394,21 +721,45 @@ Resolver::run_pipeline( rq_ptr rq, unsigned short lastweight )
         }
         if(pap->weight() != atweight)
         {
-            // we've dispatched to everything of weight "atweight"
-            // and the shortest targettime at that weight is "mintime"
-            // so schedule a callaback after mintime to carry on down the
-            // chain and dispatch to the next lowest weighted resolver services.
-            //cout << "Will continue pipeline after " << mintime << "ms." << endl;
-            boost::shared_ptr<boost::asio::deadline_timer> 
-                t(new boost::asio::deadline_timer( m_work->get_io_service() ));
-            t->expires_from_now(boost::posix_time::milliseconds(mintime));
-            // pass the timer pointer to the handler so it doesnt autodestruct:
-            t->async_wait(boost::bind(&Resolver::run_pipeline_cont, this,
-                                      rq, atweight, t));
+            more = true;
             break;
         }
         if(pap->targettime() < mintime) mintime = pap->targettime();
-        
+        tier.push_back( pap );
+    }
+    if(!started)
+    {
+        // moved on from the last tier, the pipeline is done:
+        commit_cache( rq );
+        return;
+    }
+    
+    if( rq->past_deadline() )
+    {
+        // client has stopped caring, don't start any more tiers
+        commit_cache( rq ); // drops them, it's an incomplete run
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        ++m_num_deadline_cut;
+        return;
+    }
+    
+    // register who we're waiting on before dispatching, as a fast resolver
+    // may be done before we've finished dispatching to the rest:
+    vector< ResolverService* > pending;
+    BOOST_FOREACH( pa_ptr pap, tier )
+    {
+        if( !pap->localonly() || rq->origin_local() )
+            pending.push_back( pap->rs() );
+    }
+    if( rq->begin_tier( atweight, pending ) )
+    {
+        // this is extra load, the tier above may yet solve it
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        m_num_hedge_dispatches += pending.size();
+    }
+    
+    BOOST_FOREACH( pa_ptr pap, tier )
+    {
         if( pap->localonly() && !rq->origin_local() )
         {
             // Not dispatching (remote query, to local-only plugin)
@@ -418,28 +769,187 @@ Resolver::run_pipeline( rq_ptr rq, unsigned short lastweight )
             // dispatch to this resolver:
             //cout << "Pipeline dispatching to " << pap->rs()->name() 
             //     << " (lastweight: " << lastweight << ")" << endl;
+            rq->mark_dispatched( pap->rs() );
             pap->rs()->start_resolving(rq);
         }
     }
+    if( pending.empty() )
+    {
+        // nothing to wait for at this weight
+        run_pipeline_cont( rq, atweight );
+        return;
+    }
+    // we've dispatched to everything of weight "atweight"
+    // and the shortest targettime at that weight is "mintime"
+    // so schedule a callaback after mintime to carry on down the
+    // chain and dispatch to the next lowest weighted resolver services,
+    // or finish, after the last tier.
+    // no point if the deadline is before then, only an early finish 
+    // at this tier could still start the next one in time.
+    // hedged queries don't wait that long, they start the next tier 
+    // after a fraction of mintime unless solved by then.
+    unsigned int hedgetime = (unsigned int)( mintime * m_hedge_fraction );
+    if( more && (rq->hedge() || m_hedge) && hedgetime < mintime &&
+        !( rq->has_deadline() && (unsigned int) rq->remaining_ms() < hedgetime ) )
+    {
+        m_wheel->schedule( hedgetime,
+                           boost::bind(&Resolver::run_pipeline_hedge, this,
+                                       rq, atweight) );
+    }
+    if( rq->has_deadline() && (unsigned int) rq->remaining_ms() < mintime )
+        return;
+    //cout << "Will continue pipeline after " << mintime << "ms." << endl;
+    m_wheel->schedule( mintime, 
+                       boost::bind(&Resolver::run_pipeline_timeout, this,
+                                   rq, atweight) );
+}
+
+/// part way through a tier's targettime, and still not solved
+void
+Resolver::run_pipeline_hedge( rq_ptr rq, unsigned short lastweight )
+{
+    if( rq->solved() || rq->cancelled() ) return;
+    if( !rq->claim_tier( lastweight, true ) ) return;
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        ++m_num_hedges;
+    }
+    enqueue_pipeline( rq, lastweight );
 }
 
+/// query is solved, stop anything we dispatched to speculatively.
 void
-Resolver::run_pipeline_cont( rq_ptr rq, 
-                        unsigned short lastweight,
-                        boost::shared_ptr<boost::asio::deadline_timer> oldtimer)
+Resolver::query_solved( const query_uid & qid )
 {
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        ++m_num_solved;
+    }
+    rq_ptr rq;
+    if( !m_queries.get( qid, rq ) ) return;
+    commit_cache( rq );
+    vector< ResolverService* > spec = rq->take_speculative();
+    if( spec.empty() ) return;
+    BOOST_FOREACH( ResolverService* rs, spec )
+    {
+        rs->cancel_query( rq->id() );
+    }
+    boost::mutex::scoped_lock lk(m_mut_stats);
+    m_num_hedge_cancels += spec.size();
+}
+
+/// targettime for a tier is up
+void
+Resolver::run_pipeline_timeout( rq_ptr rq, unsigned short lastweight )
+{
+    if( run_pipeline_cont( rq, lastweight ) )
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        ++m_num_tiers_timeout;
+    }
+}
+
+/// a resolver dropped this query without working on it, as it was
+/// already solved or cancelled by the time it got to it.
+void
+Resolver::report_skipped( const query_uid & qid, ResolverService * rs )
+{
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        ++m_num_skipped;
+    }
+    report_done( qid, rs );
+}
+
+/// a resolver says it's finished with this query
+void
+Resolver::report_done( const query_uid & qid, ResolverService * rs )
+{
+    rq_ptr rq;
+    unsigned short weight;
+    if( !m_queries.get( qid, rq ) ) return;
+    if( rq->tier_done( rs, weight ) && run_pipeline_cont( rq, weight ) )
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        ++m_num_tiers_early;
+    }
+}
+
+/// set up latency tracking for a resolver, after its targettime is configured.
+/// bounds default to a quarter and four times the configured targettime.
+void
+Resolver::track_latency( pa_ptr pap, const string& conf )
+{
+    boost::shared_ptr<latency_tracker> lt( new latency_tracker );
+    lt->pap = pap;
+    lt->configured = pap->targettime();
+    lt->min = app()->conf()->get<int>( conf + ".targettime_min", lt->configured / 4 );
+    lt->max = app()->conf()->get<int>( conf + ".targettime_max", lt->configured * 4 );
+    if( lt->max > 65535 ) lt->max = 65535;
+    if( lt->min > lt->max ) lt->min = lt->max;
+    m_latency[ pap->rs() ] = lt;
+}
+
+/// a resolver reported results for a query, record how long the first
+/// ones took, and move its targettime to match.
+void
+Resolver::note_first_result( const query_uid & qid, ResolverService * rs )
+{
+    rq_ptr rq;
+    unsigned int ms;
+    if( !m_queries.get( qid, rq ) || !rq->first_result( rs, ms ) ) return;
+    std::map< ResolverService*, boost::shared_ptr<latency_tracker> >::iterator it =
+        m_latency.find( rs );
+    if( it == m_latency.end() ) return;
+    latency_tracker & lt = *it->second;
+    lt.hist.add( ms );
+    if( !m_adaptive_targettime || lt.hist.count() < m_targettime_min_samples ) 
+        return;
+    unsigned int t = lt.hist.percentile( m_targettime_percentile );
+    if( t < lt.min ) t = lt.min;
+    if( t > lt.max ) t = lt.max;
+    if( t != lt.pap->targettime() ) lt.pap->set_targettime( t );
+}
+
+json_spirit::Object
+Resolver::latency_stats( ResolverService * rs ) const
+{
+    using namespace json_spirit;
+    Object o;
+    std::map< ResolverService*, boost::shared_ptr<latency_tracker> >::const_iterator it =
+        m_latency.find( rs );
+    if( it == m_latency.end() ) return o;
+    const latency_tracker & lt = *it->second;
+    o.push_back( Pair("name", rs->name()) );
+    o.push_back( Pair("targettime", (int) lt.pap->targettime()) );
+    o.push_back( Pair("configured", (int) lt.configured) );
+    o.push_back( Pair("min", (int) lt.min) );
+    o.push_back( Pair("max", (int) lt.max) );
+    o.push_back( Pair("samples", (int) lt.hist.count()) );
+    o.push_back( Pair("p50", (int) lt.hist.percentile( 50 )) );
+    o.push_back( Pair("p90", (int) lt.hist.percentile( 90 )) );
+    o.push_back( Pair("p99", (int) lt.hist.percentile( 99 )) );
+    o.push_back( Pair("buckets", lt.hist.buckets()) );
+    return o;
+}
+
+/// move on from the tier at lastweight, if nobody else did already.
+/// false if that already happened.
+bool
+Resolver::run_pipeline_cont( rq_ptr rq, unsigned short lastweight )
+{
+    if(!rq->claim_tier(lastweight)) return false;
     //cout << "Pipeline continues.." << endl;
-    if(rq->solved())
+    if(rq->solved() || rq->cancelled())
     {
         //cout << "Bailing from pipeline: SOLVED @ lastweight: " << lastweight 
         //     << endl;
     }
     else
     {
-        boost::mutex::scoped_lock lk(m_mutex);
-        m_pending.push_front( pair<rq_ptr, unsigned short>(rq, lastweight) );
-        m_cond.notify_one();
+        enqueue_pipeline( rq, lastweight );
     }
+    return true;
 }
 
 /// a resolver will report results here
@@ -455,64 +965,119 @@ Resolver::add_results(query_uid qid, const vector< ri_ptr >& results, string via
     }
 
     rq_ptr rq;
+    if(!m_queries.get(qid, rq)) 
+        return false; // query was deleted
 
-    {
-        // scope lock to protect m_queries and m_sid2ri
-        boost::mutex::scoped_lock lock(m_mut_results);  
-        
-        if(!query_exists(qid)) 
-            return false; // query was deleted
-        rq = m_queries[qid];
-
-        // setup sid mappings
-        string sid;
-        BOOST_FOREACH(const ri_ptr& rip, results)
-        {
-            // update map of source id -> playable item
-            sid = rip->id();
-            if (sid.length()) {
-                m_sid2ri[sid] = rip;
-            }
-        }
-    }
-
+    // only results that get added to the query are mapped by sid, anything
+    // we reject would otherwise sit in m_sid2ri until the process exits.
+    size_t bytes = 0;
     if (rq->isValidTrack()) {
         // these results are for a track query, score the unscored results
-        string reason;
-        BOOST_FOREACH(const ri_ptr& rip, results) {
-            // resolver fixes the score using a standard algorithm
-            // unless a non-zero score was specified by resolver.
-            if (rip->score() < 0 &&
-                rip->has_json_value<string>( "artist" ) &&
-                rip->has_json_value<string>( "track" ) )
-            {
-                float score = calculate_score( rq, rip, reason );
-                if (score > 0) {
-                    rip->set_score( score );
-                    rq->add_result( rip );
-                }
-            } else if (rip->score() > 0) {
-                rq->add_result( rip );
-            }
-        }
+        // and add the ones that pass in one go:
+        vector< ri_ptr > accepted;
+        score_candidates( rq, results, accepted );
+        BOOST_FOREACH(const ri_ptr& rip, accepted) map_sid( rip );
+        // before adding them, one of them may solve it and commit the lot:
+        cache_results( rq, accepted, cache_ttl( via ) );
+        bytes += rq->add_results( accepted );
     } else {
         // some other type of query, doesn't need scoring.
-        rq->add_results( results );
+        BOOST_FOREACH(const ri_ptr& rip, results) map_sid( rip );
+        bytes += rq->add_results( results );
     }
-
+    
+    if (rq->cancelled()) {
+        // cancel_query ran while we were busy, it may have missed our sids:
+        BOOST_FOREACH(const ri_ptr& rip, results)
+        {
+            m_sid2ri.erase( rip->id() );
+        }
+    }
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        m_footprint += bytes;
+    }
+    if (rq->cancelled()) return false;
+    
+    evict_if_needed();
     return true;
 }
 
+/// update map of source id -> playable item
+void
+Resolver::map_sid( const ri_ptr& rip )
+{
+    const string& sid = rip->id();
+    if (sid.length()) {
+        m_sid2ri.set(sid, rip);
+    }
+}
+
 // static
 string 
 Resolver::sortname(const string& name) 
 { 
-    string data(name); 
-    std::transform(data.begin(), data.end(), data.begin(), ::tolower); 
-    boost::trim(data); 
-    return data; 
+    return playdar::utils::normalize(name);
+}
+
+
+// tolerances:
+static const float tol_art = 1.5;
+static const float tol_trk = 1.5;
+//static const float tol_alb = 1.5; // album rating unsed atm.
+// names less than this many chars aren't dismissed based on % edit-dist:
+static const unsigned int grace_len = 6; 
+
+/// the query's names as calculate_score wants them.
+// static
+ResolverQuery::score_terms
+Resolver::make_score_terms( const rq_ptr & rq )
+{
+    ResolverQuery::score_terms t;
+    t.artist = sortname( rq->param( "artist" ).get_str() );
+    t.track  = sortname( rq->param( "track" ).get_str() );
+    if( rq->param_exists( "album" ) && rq->param_type( "album" ) == json_spirit::str_type )
+        t.album = sortname( rq->param( "album" ).get_str() );
+    // most edits that can pass the checks in calculate_score. anything 
+    // over fails the same check whatever it is, so the edit distance can
+    // give up as soon as it knows it's over:
+    int len = t.artist.length();
+    t.max_artist = len > (int)grace_len ? (int)(len/tol_art) : len - 1;
+    len = t.track.length();
+    t.max_track  = len > (int)grace_len ? (int)(len/tol_trk) : len - 1;
+    if( t.max_artist < 0 ) t.max_artist = 0;
+    if( t.max_track < 0 ) t.max_track = 0;
+    t.ready = true;
+    return t;
 }
 
+/// score all the unscored candidates for a track query, and put the ones 
+/// that are any good, or came with a score of their own, in accepted.
+// static
+void
+Resolver::score_candidates( const rq_ptr & rq,
+                            const vector< ri_ptr >& candidates,
+                            vector< ri_ptr >& accepted )
+{
+    string reason;
+    accepted.reserve( accepted.size() + candidates.size() );
+    BOOST_FOREACH(const ri_ptr& rip, candidates) {
+        // resolver fixes the score using a standard algorithm
+        // unless a non-zero score was specified by resolver.
+        if (rip->score() < 0 &&
+            rip->has_json_value<string>( "artist" ) &&
+            rip->has_json_value<string>( "track" ) )
+        {
+            float score = calculate_score( rq, rip, reason );
+            if (score > 0) {
+                rip->set_score( score );
+                accepted.push_back( rip );
+            }
+        } else if (rip->score() > 0) {
+            accepted.push_back( rip );
+        }
+    }
+}
 
 /// caluclate score 0-1 based on how similar the names are.
 /// string similarity algo that combines art,alb,trk from the original
@@ -525,32 +1090,25 @@ Resolver::calculate_score( const rq_ptr & rq, // query
                                   const ri_ptr & ri, // candidate
                                   string & reason )  // fail reason
 {
-    using namespace boost;
-    // original names from the query:
-    string o_art    = trim_copy(to_lower_copy(rq->param( "artist" ).get_str()));
-    string o_trk    = trim_copy(to_lower_copy(rq->param( "track" ).get_str()));
-    string o_alb    = trim_copy(to_lower_copy(rq->param( "album" ).get_str()));
+    // original names from the query, normally done at dispatch:
+    ResolverQuery::score_terms made;
+    const ResolverQuery::score_terms * t = &rq->terms();
+    if( !t->ready )
+    {
+        made = make_score_terms( rq );
+        t = &made;
+    }
+    const string& o_art = t->artist;
+    const string& o_trk = t->track;
 
     // names from candidate result:
-    string art      = trim_copy(to_lower_copy(ri->json_value("artist", "" )));
-    string trk      = trim_copy(to_lower_copy(ri->json_value("track", "")));
-    string alb      = trim_copy(to_lower_copy(ri->json_value("album","")));
+    string art      = sortname( ri->json_value("artist", "") );
+    string trk      = sortname( ri->json_value("track", "") );
     // short-circuit for exact match
     if(o_art == art && o_trk == trk) return 1.0;
     // the real deal, with edit distances:
-    unsigned int trked = playdar::utils::levenshtein( 
-                                                     sortname(trk),
-                                                     sortname(o_trk));
-    unsigned int arted = playdar::utils::levenshtein( 
-                                                     sortname(art),
-                                                     sortname(o_art));
-    // tolerances:
-    float tol_art = 1.5;
-    float tol_trk = 1.5;
-    //float tol_alb = 1.5; // album rating unsed atm.
-    
-    // names less than this many chars aren't dismissed based on % edit-dist:
-    unsigned int grace_len = 6; 
+    unsigned int trked = playdar::utils::levenshtein( trk, o_trk, t->max_track );
+    unsigned int arted = playdar::utils::levenshtein( art, o_art, t->max_artist );
     
     // if % edit distance is greater than tolerance, fail them outright:
     if( o_art.length() > grace_len &&
@@ -595,24 +1153,32 @@ Resolver::cancel_query(const query_uid & qid)
         pap->rs()->cancel_query( qid );
     }
     rq_ptr cq;
+    // removing from m_queries means no-one can find and get a new shared_ptr given a qid.
+    // take() is atomic, so only one caller gets to do the cleanup:
+    if(!m_queries.take(qid, cq)) return;
+    // this disables callbacks and marks it as cancelled:
+    cq->cancel();
+    {
+        boost::mutex::scoped_lock lk(m_mut_cache_pending);
+        m_cache_pending.erase( qid );
+    }
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        --m_num_queries;
+        m_footprint -= cq->footprint();
+    }
+    // stop and cleanup timer:
+    TimerWheel::handle t;
+    if(m_qidtimers.take(qid, t))
+    {
+        m_wheel->cancel(t);
+    }
+    // cleanup registered source ids -> playable items, unless a query we
+    // were coalesced with is still using them:
+    bool last;
+    leave_group( qid, last );
+    if( last )
     {
-        // removing from m_queries map means no-one can find and get a new shared_ptr given a qid:
-        boost::mutex::scoped_lock lock(m_mut_results);
-        if(!query_exists(qid)) return;
-        cq = rq(qid);
-        if(!cq || cq->cancelled()) return;
-        // this disables callbacks and marks it as cancelled:
-        cq->cancel();
-        m_queries.erase(qid);
-        // stop and cleanup timer:
-        boost::asio::deadline_timer * t = m_qidtimers[qid];
-        if(t)
-        {
-            t->cancel();
-            delete(t);
-            m_qidtimers.erase(qid);
-        }
-        // cleanup registered source ids -> playable items:
         vector< ri_ptr > results = cq->results();
         BOOST_FOREACH( ri_ptr rip, results )
         {
@@ -629,25 +1195,27 @@ Resolver::cancel_query_timeout(query_uid qid)
 {
     cout << "Stale timeout reached for QID: " << qid << endl;
     rq_ptr rq;
-    {
-        boost::mutex::scoped_lock lock(m_mut_results);
-        if(!query_exists(qid)) return;
-        rq = this->rq(qid);
-        if(rq->cancelled()) return;
-    }
+    if(!m_queries.get(qid, rq) || rq->cancelled()) return;
     // check if it's stale enough to warrant cleaning up
     time_t now;
     time(&now);
     time_t diff = now - rq->atime();
     if( diff >= max_query_lifetime() ) // stale, clean it up
     {
+        {
+            boost::mutex::scoped_lock lk(m_mut_stats);
+            ++m_num_expired;
+        }
         cancel_query( qid );
     }
-    else if( m_qidtimers.find(qid) != m_qidtimers.end() ) // not stale, reset timer
+    else // not stale, reset timer
     {
         cout << "Not stale, resetting timer." << endl;
-        m_qidtimers[qid]->expires_from_now(boost::posix_time::seconds(max_query_lifetime()-diff));
-        m_qidtimers[qid]->async_wait(boost::bind(&Resolver::cancel_query_timeout, this, qid));
+        TimerWheel::handle t = m_wheel->schedule( 
+            (max_query_lifetime()-diff) * 1000,
+            boost::bind(&Resolver::cancel_query_timeout, this, qid) );
+        // query may have been cancelled meanwhile, don't resurrect its timer:
+        if( !m_qidtimers.replace(qid, t) ) m_wheel->cancel(t);
     }
 }
 
@@ -656,21 +1224,28 @@ Resolver::cancel_query_timeout(query_uid qid)
 vector< ri_ptr >
 Resolver::get_results(query_uid qid)
 {
-    boost::mutex::scoped_lock lock(m_mut_results);
-    if(!query_exists(qid)) throw; // query was deleted
-    return m_queries[qid]->results();
+    rq_ptr rq;
+    if(!m_queries.get(qid, rq)) throw; // query was deleted
+    return rq->results();
+}
+
+/// just the best limit results, after skipping offset.
+vector< ri_ptr >
+Resolver::get_results(query_uid qid, size_t limit, size_t offset)
+{
+    rq_ptr rq;
+    if(!m_queries.get(qid, rq)) throw; // query was deleted
+    return rq->results( limit, offset );
 }
 
 /// check how many results we found for this query id
 int 
 Resolver::num_results(query_uid qid)
 {
+    rq_ptr rq;
+    if(m_queries.get(qid, rq)) 
     {
-        boost::mutex::scoped_lock lock(m_mut_results);
-        if(query_exists(qid)) 
-        {
-            return m_queries[qid]->results().size();
-        }
+        return rq->num_results();
     }
     cerr << "Query id '"<< qid <<"' does not exist" << endl;
     return 0;
@@ -680,7 +1255,7 @@ Resolver::num_results(query_uid qid)
 bool 
 Resolver::query_exists(const query_uid & qid)
 {
-    return (m_queries.find(qid) != m_queries.end());
+    return m_queries.contains(qid);
 }
 
 /// true on success, false if it already exists.
@@ -689,24 +1264,124 @@ Resolver::add_new_query(boost::shared_ptr<ResolverQuery> rq)
 {
     if (rq->id().length() == 0) {
         // create and assign an id to the request
-        rq->set_id( gen_uuid() );
-    } else if (query_exists(rq->id())) {
+        rq->set_id( gen_sid() );
+    }
+    // atomic test-and-insert, a concurrent dispatch of the same qid loses:
+    if (!m_queries.insert(rq->id(), rq)) {
         return false;
     }
-
-    m_queries[rq->id()] = rq;
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        ++m_num_queries;
+        m_footprint += rq->footprint();
+    }
     {
         boost::mutex::scoped_lock lock(m_mut_qidlist);
         m_qidlist.push_front(rq->id());
+        // only a window of recent qids is kept, for the /queries page:
+        while( m_qidlist.size() > m_max_qidlist ) m_qidlist.pop_back();
     }
+    evict_if_needed();
     return true;
 }
 
+bool
+Resolver::over_limits( float fraction ) const
+{
+    return ( m_max_queries && 
+             m_num_queries > (long long)(m_max_queries * fraction) ) ||
+           ( m_max_query_memory && 
+             m_footprint > (long long)(m_max_query_memory * fraction) );
+}
+
+/// if we're over the query count or memory budget, cancel the least
+/// recently used queries until we're back under 90% of it.
+/// done in batches so we aren't sorting everything on every new query.
+void
+Resolver::evict_if_needed()
+{
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        if( m_evicting || !over_limits( 1.0f ) ) return;
+        m_evicting = true; // someone else will have to wait for the next one
+    }
+    vector< rq_ptr > all;
+    m_queries.values( back_inserter(all) );
+    vector< pair<time_t, query_uid> > byatime;
+    byatime.reserve( all.size() );
+    BOOST_FOREACH( const rq_ptr& rq, all )
+    {
+        byatime.push_back( make_pair( rq->atime(), rq->id() ) );
+    }
+    all.clear();
+    sort( byatime.begin(), byatime.end() );
+    
+    size_t evicted = 0;
+    for( size_t i = 0; i < byatime.size(); ++i )
+    {
+        {
+            boost::mutex::scoped_lock lk(m_mut_stats);
+            if( !over_limits( 0.9f ) ) break;
+        }
+        cancel_query( byatime[i].second );
+        ++evicted;
+    }
+    cout << "Evicted " << evicted << " least recently used queries" << endl;
+    
+    boost::mutex::scoped_lock lk(m_mut_stats);
+    m_num_evicted += evicted;
+    m_evicting = false;
+}
+
+/// counters about live queries and memory use
+json_spirit::Object
+Resolver::stats()
+{
+    using namespace json_spirit;
+    Object o;
+    {
+        boost::mutex::scoped_lock lk(m_mut_stats);
+        o.push_back( Pair("queries", (boost::int64_t) m_num_queries) );
+        o.push_back( Pair("footprint_bytes", (boost::int64_t) m_footprint) );
+        o.push_back( Pair("max_queries", (boost::int64_t) m_max_queries) );
+        o.push_back( Pair("max_query_memory", (boost::int64_t) m_max_query_memory) );
+        o.push_back( Pair("max_query_lifetime", (boost::int64_t) m_max_query_lifetime) );
+        o.push_back( Pair("evicted", (boost::int64_t) m_num_evicted) );
+        o.push_back( Pair("expired", (boost::int64_t) m_num_expired) );
+        o.push_back( Pair("tiers_done_early", (boost::int64_t) m_num_tiers_early) );
+        o.push_back( Pair("tiers_timed_out", (boost::int64_t) m_num_tiers_timeout) );
+        o.push_back( Pair("deadline_cut", (boost::int64_t) m_num_deadline_cut) );
+        o.push_back( Pair("hedged_tiers", (boost::int64_t) m_num_hedges) );
+        o.push_back( Pair("hedged_dispatches", (boost::int64_t) m_num_hedge_dispatches) );
+        o.push_back( Pair("hedged_cancels", (boost::int64_t) m_num_hedge_cancels) );
+        o.push_back( Pair("solved", (boost::int64_t) m_num_solved) );
+        o.push_back( Pair("work_skipped", (boost::int64_t) m_num_skipped) );
+        o.push_back( Pair("coalesce_leaders", (boost::int64_t) m_num_leaders) );
+        o.push_back( Pair("coalesce_followers", (boost::int64_t) m_num_followers) );
+        size_t total = m_num_leaders + m_num_followers;
+        o.push_back( Pair("coalesce_hit_rate", 
+                          total ? (double) m_num_followers / total : 0.0) );
+    }
+    o.push_back( Pair("sids", (boost::int64_t) m_sid2ri.size()) );
+    o.push_back( Pair("timers", (boost::int64_t) m_wheel->size()) );
+    if( m_cache ) o.push_back( Pair("cache", m_cache->stats()) );
+    o.push_back( Pair("delivery", m_delivery->stats()) );
+    Array lat;
+    BOOST_FOREACH( const pa_ptr & pap, m_resolvers )
+    {
+        Object lo = latency_stats( pap->rs() );
+        if( lo.size() ) lat.push_back( lo );
+    }
+    o.push_back( Pair("latency", lat) );
+    return o;
+}
+
 boost::shared_ptr<ResolverQuery>
 Resolver::rq(const query_uid & qid)
 {
-    map< query_uid, rq_ptr >::iterator it = m_queries.find(qid);
-    return it == m_queries.end() ? boost::shared_ptr<ResolverQuery>() : it->second;
+    rq_ptr rq;
+    m_queries.get(qid, rq);
+    return rq;
 }
 
 size_t
@@ -721,9 +1396,8 @@ Resolver::num_seen_queries()
 ss_ptr
 Resolver::get_ss(const source_uid & sid)
 {
-    map< source_uid, ri_ptr >::iterator it = m_sid2ri.find(sid);
-    if (it != m_sid2ri.end()) {
-        ri_ptr rip( it->second );
+    ri_ptr rip;
+    if (m_sid2ri.get(sid, rip)) {
         if( rip->url().empty() ) return ss_ptr();
 
         size_t offset = rip->url().find(':');
@@ -755,12 +1429,9 @@ Resolver::get_ss(const source_uid & sid)
 ri_ptr
 Resolver::sid2ri( const source_uid& sid )
 {
-    map< source_uid, ri_ptr >::iterator it = m_sid2ri.find(sid);
-    if (it != m_sid2ri.end())
-        return it->second;
-    else
-        return ri_ptr();
-          
+    ri_ptr rip;
+    m_sid2ri.get(sid, rip);
+    return rip;
 }
 
 template <class T>
@@ -0,0 +1,356 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "playdar/result_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <boost/foreach.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+namespace playdar {
+
+// most results we keep for one query, should be plenty:
+static const size_t max_items_per_key = 50;
+
+ResultCache::ResultCache( const string& filename, size_t max_entries )
+    : m_filename( filename ), m_max_entries( max_entries ), m_saver(0),
+      m_hits(0), m_misses(0), m_stale(0), m_invalidated(0),
+      m_stored(0), m_evicted(0)
+{
+}
+
+ResultCache::~ResultCache()
+{
+    boost::mutex::scoped_lock lk( m_saver_mut );
+    if( m_saver )
+    {
+        m_saver->join();
+        delete m_saver;
+    }
+}
+
+ResultCache::lookup_result
+ResultCache::get( const string& key, vector< Object >& out, float solve_threshold )
+{
+    time_t now;
+    time(&now);
+    vector< cached_item > items;
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        boost::unordered_map< string, lru_t::iterator >::iterator it = m_index.find( key );
+        if( it == m_index.end() )
+        {
+            ++m_misses;
+            return MISS;
+        }
+        items = it->second->items;
+    }
+    // local files are stat'd without the lock, every query dispatch
+    // comes through here:
+    bool stale = false;
+    bool solved = false;
+    vector< cached_item > gone; // file changed or gone since we cached it
+    BOOST_FOREACH( const cached_item& ci, items )
+    {
+        if( !still_valid( ci ) )
+        {
+            gone.push_back( ci );
+            continue;
+        }
+        if( ci.expires <= now ) stale = true;
+        if( ci.score >= solve_threshold ) solved = true;
+        out.push_back( ci.item );
+    }
+
+    boost::mutex::scoped_lock lk(m_mut);
+    boost::unordered_map< string, lru_t::iterator >::iterator it = m_index.find( key );
+    if( it != m_index.end() )
+    {
+        lru_t::iterator e = it->second;
+        // drop the gone ones, unless they were re-added meanwhile:
+        BOOST_FOREACH( const cached_item& g, gone )
+        {
+            for( vector< cached_item >::iterator i = e->items.begin();
+                 i != e->items.end(); ++i )
+            {
+                if( i->url == g.url && i->cached == g.cached )
+                {
+                    e->items.erase( i );
+                    ++m_invalidated;
+                    break;
+                }
+            }
+        }
+        if( e->items.empty() ) erase( e );
+        // move to front, most recently used:
+        else m_lru.splice( m_lru.begin(), m_lru, e );
+    }
+    if( out.empty() )
+    {
+        ++m_misses;
+        return MISS;
+    }
+    if( stale || !solved )
+    {
+        ++m_stale;
+        return STALE;
+    }
+    ++m_hits;
+    return HIT;
+}
+
+void
+ResultCache::add( const string& key, const ResolvedItem& ri, time_t ttl )
+{
+    if( ttl <= 0 ) return;
+    cached_item ci;
+    ci.url = ri.url();
+    ci.score = ri.score();
+    // sids are per-query, a fresh one is made each time we serve this:
+    BOOST_FOREACH( const Pair& p, ri.get_json() )
+    {
+        if( p.name_ != "sid" ) ci.item.push_back( p );
+    }
+    time(&ci.cached);
+    ci.expires = ci.cached + ttl;
+
+    boost::mutex::scoped_lock lk(m_mut);
+    boost::unordered_map< string, lru_t::iterator >::iterator it = m_index.find( key );
+    lru_t::iterator e;
+    if( it == m_index.end() )
+    {
+        entry ne;
+        ne.key = key;
+        ne.refreshing = 0;
+        m_lru.push_front( ne );
+        e = m_lru.begin();
+        m_index[key] = e;
+        while( m_max_entries && m_index.size() > m_max_entries )
+        {
+            erase( --m_lru.end() );
+            ++m_evicted;
+        }
+    }
+    else
+    {
+        e = it->second;
+        m_lru.splice( m_lru.begin(), m_lru, e );
+    }
+    ++m_stored;
+    BOOST_FOREACH( cached_item& old, e->items )
+    {
+        if( old.url == ci.url )
+        {
+            old = ci;
+            return;
+        }
+    }
+    if( e->items.size() < max_items_per_key )
+        e->items.push_back( ci );
+}
+
+bool
+ResultCache::begin_refresh( const string& key, time_t within )
+{
+    time_t now;
+    time(&now);
+    boost::mutex::scoped_lock lk(m_mut);
+    boost::unordered_map< string, lru_t::iterator >::iterator it = m_index.find( key );
+    if( it == m_index.end() ) return true;
+    if( now - it->second->refreshing < within ) return false;
+    it->second->refreshing = now;
+    return true;
+}
+
+/// local files must still be there, and not modified since we cached them.
+// static
+bool
+ResultCache::still_valid( const cached_item& ci )
+{
+    if( ci.url.substr(0, 7) != "file://" ) return true;
+    string p = ci.url.substr(7);
+    if( p.length() > 2 && p.at(0) == '/' && p.at(2) == ':' )
+        p = p.substr(1); // windows style, file:///C:/...
+    try
+    {
+        boost::filesystem::path path( p );
+        if( !boost::filesystem::exists( path ) ) return false;
+        if( boost::filesystem::last_write_time( path ) > ci.cached ) return false;
+        BOOST_FOREACH( const Pair& pr, ci.item )
+        {
+            if( pr.name_ == "size" && pr.value_.type() == int_type &&
+                (boost::uintmax_t) pr.value_.get_int64() != boost::filesystem::file_size( path ) )
+                return false;
+        }
+        return true;
+    }
+    catch( ... )
+    {
+        return false;
+    }
+}
+
+/// caller holds m_mut
+void
+ResultCache::erase( lru_t::iterator it )
+{
+    m_index.erase( it->key );
+    m_lru.erase( it );
+}
+
+bool
+ResultCache::load()
+{
+    ifstream ifs( m_filename.c_str() );
+    if( ifs.fail() ) return false; // no cache yet, that's fine
+    Value v;
+    if( !read( ifs, v ) || v.type() != obj_type )
+    {
+        cerr << "Result cache " << m_filename << " is corrupt, ignoring it" << endl;
+        return false;
+    }
+    map< string, Value > m;
+    obj_to_map( v.get_obj(), m );
+    if( m["entries"].type() != array_type ) return false;
+
+    boost::mutex::scoped_lock lk(m_mut);
+    // saved most recently used first, so append to keep the same order:
+    BOOST_FOREACH( const Value& ev, m["entries"].get_array() )
+    {
+        if( m_max_entries && m_index.size() >= m_max_entries ) break;
+        if( ev.type() != obj_type ) continue;
+        map< string, Value > em;
+        obj_to_map( ev.get_obj(), em );
+        if( em["key"].type() != str_type || em["items"].type() != array_type ) continue;
+        if( m_index.find( em["key"].get_str() ) != m_index.end() ) continue;
+        entry e;
+        e.key = em["key"].get_str();
+        e.refreshing = 0;
+        BOOST_FOREACH( const Value& iv, em["items"].get_array() )
+        {
+            if( iv.type() != obj_type ) continue;
+            map< string, Value > im;
+            obj_to_map( iv.get_obj(), im );
+            if( im["item"].type() != obj_type ||
+                im["cached"].type() != int_type ||
+                im["expires"].type() != int_type ) continue;
+            cached_item ci;
+            ci.item = im["item"].get_obj();
+            ResolvedItem ri( ci.item );
+            ci.url = ri.url();
+            ci.score = ri.score();
+            ci.cached = im["cached"].get_int64();
+            ci.expires = im["expires"].get_int64();
+            e.items.push_back( ci );
+        }
+        if( e.items.empty() ) continue;
+        m_lru.push_back( e );
+        m_index[e.key] = --m_lru.end();
+    }
+    cout << "Loaded " << m_index.size() << " cached queries from " << m_filename << endl;
+    return true;
+}
+
+void
+ResultCache::save_async()
+{
+    boost::mutex::scoped_lock lk( m_saver_mut );
+    if( m_saver )
+    {
+        if( !m_saver->timed_join( boost::posix_time::seconds(0) ) ) return;
+        delete m_saver;
+    }
+    m_saver = new boost::thread( boost::bind( &ResultCache::save, this ) );
+}
+
+bool
+ResultCache::save()
+{
+    boost::mutex::scoped_lock savelk( m_save_mut );
+    // copy it and let go, building and writing the json takes a while:
+    lru_t snapshot;
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        snapshot = m_lru;
+    }
+    Array entries;
+    BOOST_FOREACH( const entry& e, snapshot )
+    {
+        Array items;
+        BOOST_FOREACH( const cached_item& ci, e.items )
+        {
+            Object io;
+            io.push_back( Pair("cached", (boost::int64_t) ci.cached) );
+            io.push_back( Pair("expires", (boost::int64_t) ci.expires) );
+            io.push_back( Pair("item", ci.item) );
+            items.push_back( io );
+        }
+        Object eo;
+        eo.push_back( Pair("key", e.key) );
+        eo.push_back( Pair("items", items) );
+        entries.push_back( eo );
+    }
+    Object o;
+    o.push_back( Pair("version", 1) );
+    o.push_back( Pair("entries", entries) );
+
+    // write to a temp file and swap it in, so a crash doesn't lose the lot:
+    string tmp = m_filename + ".tmp";
+    {
+        ofstream ofs( tmp.c_str() );
+        if( ofs.fail() )
+        {
+            cerr << "Couldn't write result cache to " << tmp << endl;
+            return false;
+        }
+        write( o, ofs );
+        if( ofs.fail() ) return false;
+    }
+    remove( m_filename.c_str() );
+    if( rename( tmp.c_str(), m_filename.c_str() ) != 0 )
+    {
+        cerr << "Couldn't rename " << tmp << " to " << m_filename << endl;
+        return false;
+    }
+    return true;
+}
+
+Object
+ResultCache::stats()
+{
+    boost::mutex::scoped_lock lk(m_mut);
+    Object o;
+    o.push_back( Pair("entries", (boost::int64_t) m_index.size()) );
+    o.push_back( Pair("hits", (boost::int64_t) m_hits) );
+    o.push_back( Pair("misses", (boost::int64_t) m_misses) );
+    o.push_back( Pair("stale", (boost::int64_t) m_stale) );
+    o.push_back( Pair("invalidated", (boost::int64_t) m_invalidated) );
+    o.push_back( Pair("stored", (boost::int64_t) m_stored) );
+    o.push_back( Pair("evicted", (boost::int64_t) m_evicted) );
+    size_t lookups = m_hits + m_misses + m_stale;
+    o.push_back( Pair("hit_rate", lookups ? (double)(m_hits + m_stale) / lookups : 0.0) );
+    return o;
+}
+
+} // ns
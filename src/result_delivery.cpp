@@ -0,0 +1,198 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "playdar/result_delivery.h"
+
+#include <iostream>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+namespace playdar {
+
+// results a thread delivers to one subscriber before giving others a turn:
+static const size_t batch_size = 32;
+
+ResultDelivery::ResultDelivery( unsigned int nthreads, size_t max_backlog )
+    : m_max_backlog( max_backlog ),
+      m_exiting( false ),
+      m_delivered( 0 ), m_dropped( 0 ), m_max_seen( 0 )
+{
+    if( nthreads == 0 ) nthreads = 1;
+    for( unsigned int i = 0; i < nthreads; ++i )
+    {
+        m_threads.push_back( new boost::thread(
+                                boost::bind( &ResultDelivery::run, this ) ) );
+    }
+}
+
+ResultDelivery::~ResultDelivery()
+{
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        m_exiting = true;
+    }
+    m_cond.notify_all();
+    BOOST_FOREACH( boost::thread * t, m_threads )
+    {
+        t->join();
+        delete t;
+    }
+}
+
+// static
+boost::shared_ptr<ResultDelivery>
+ResultDelivery::create( unsigned int nthreads, size_t max_backlog )
+{
+    return boost::shared_ptr<ResultDelivery>( 
+        new ResultDelivery( nthreads, max_backlog ), &ResultDelivery::release );
+}
+
+/// deleter for create(). the destructor joins our threads, so if the 
+/// last reference went in one of our callbacks it can't run here. that 
+/// callback returns and its thread finishes while another one deletes us.
+// static
+void
+ResultDelivery::release( ResultDelivery * d )
+{
+    if( d->on_own_thread() )
+    {
+        boost::thread t( boost::bind( &ResultDelivery::destroy, d ) );
+        t.detach();
+    }
+    else
+    {
+        delete d;
+    }
+}
+
+bool
+ResultDelivery::on_own_thread() const
+{
+    BOOST_FOREACH( boost::thread * t, m_threads )
+    {
+        if( t->get_id() == boost::this_thread::get_id() ) return true;
+    }
+    return false;
+}
+
+void
+ResultDelivery::deliver( const sub_ptr & sub, const query_uid & qid, const ri_ptr & rip )
+{
+    size_t backlog;
+    {
+        boost::mutex::scoped_lock slk( sub->m_mut );
+        if( sub->m_closed ) return;
+        if( m_max_backlog && !sub->m_internal && 
+            sub->m_backlog.size() >= m_max_backlog )
+        {
+            // too far behind, this one's lost:
+            ++sub->m_dropped;
+            boost::mutex::scoped_lock lk( m_mut );
+            ++m_dropped;
+            return;
+        }
+        sub->m_backlog.push_back( make_pair( qid, rip ) );
+        backlog = sub->m_backlog.size();
+        if( sub->m_queued )
+        {
+            // a thread already has it, or it's waiting for one
+            boost::mutex::scoped_lock lk( m_mut );
+            if( backlog > m_max_seen ) m_max_seen = backlog;
+            return;
+        }
+        sub->m_queued = true;
+    }
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        m_ready.push_back( sub );
+        if( backlog > m_max_seen ) m_max_seen = backlog;
+    }
+    m_cond.notify_one();
+}
+
+/// delivery thread. only one thread has a given subscriber at a time,
+/// so its results arrive in the order they were queued.
+void
+ResultDelivery::run()
+{
+    while( true )
+    {
+        sub_ptr sub;
+        {
+            boost::mutex::scoped_lock lk( m_mut );
+            while( m_ready.empty() && !m_exiting ) m_cond.wait( lk );
+            if( m_exiting ) break;
+            sub = m_ready.front();
+            m_ready.pop_front();
+        }
+        vector< pair<query_uid, ri_ptr> > batch;
+        {
+            boost::mutex::scoped_lock slk( sub->m_mut );
+            while( batch.size() < batch_size && !sub->m_backlog.empty() )
+            {
+                batch.push_back( sub->m_backlog.front() );
+                sub->m_backlog.pop_front();
+            }
+        }
+        typedef pair<query_uid, ri_ptr> item_t;
+        BOOST_FOREACH( const item_t & item, batch )
+        {
+            if( sub->m_closed ) break;
+            try
+            {
+                sub->m_cb( item.first, item.second );
+            }
+            catch( const std::exception & e )
+            {
+                cerr << "Result callback threw: " << e.what() << endl;
+            }
+        }
+        bool more;
+        {
+            boost::mutex::scoped_lock slk( sub->m_mut );
+            more = !sub->m_backlog.empty();
+            if( !more ) sub->m_queued = false;
+        }
+        {
+            boost::mutex::scoped_lock lk( m_mut );
+            m_delivered += batch.size();
+            // back of the line, so one busy subscriber can't hog a thread:
+            if( more ) m_ready.push_back( sub );
+        }
+        if( more ) m_cond.notify_one();
+    }
+}
+
+json_spirit::Object
+ResultDelivery::stats()
+{
+    using namespace json_spirit;
+    boost::mutex::scoped_lock lk( m_mut );
+    Object o;
+    o.push_back( Pair("threads", (int) m_threads.size()) );
+    o.push_back( Pair("max_backlog", (boost::int64_t) m_max_backlog) );
+    o.push_back( Pair("delivered", (boost::int64_t) m_delivered) );
+    o.push_back( Pair("dropped", (boost::int64_t) m_dropped) );
+    o.push_back( Pair("ready", (boost::int64_t) m_ready.size()) );
+    o.push_back( Pair("largest_backlog", (boost::int64_t) m_max_seen) );
+    return o;
+}
+
+} // ns
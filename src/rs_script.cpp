@@ -31,6 +31,10 @@ stdin, results expected from stdout of the script.
 
 Messages sent via stdin/out are framed with a 4-byte integer (big endian) 
 denoting the length of the message. Actual protocol msgs are JSON objects.
+
+Once a query we've sent the script is solved, we follow it with
+{"_msgtype":"cancel","qid":...} so a script that works on queries in the
+background can drop that one. Scripts that don't can ignore it.
 */
 
 using namespace std;
@@ -137,26 +141,43 @@ rs_script::run()
         while(true)
         {
             rq_ptr rq;
+            query_uid cancel;
             {
                 //cout << "Waiting on something" << endl;
                 boost::mutex::scoped_lock lk(m_mutex);
-                if(m_pending.size() == 0) m_cond.wait(lk);
+                while(m_pending.empty() && m_cancels.empty() && !m_exiting && !m_dead)
+                    m_cond.wait(lk);
                 if(m_exiting || m_dead) break;
-                rq = m_pending.back();
-                m_pending.pop_back();
+                if(!m_cancels.empty())
+                {
+                    cancel = m_cancels.front();
+                    m_cancels.pop_front();
+                }
+                else
+                {
+                    rq = m_pending.back();
+                    m_pending.pop_back();
+                }
             }
-            // dispatch query to script:
-            if(rq && !rq->cancelled())
+            if(!cancel.empty())
             {
-                //cout << "Got " << rq->str() << endl;
-                ostringstream os;
-                write_formatted( rq->get_json(), os );
-                string msg = os.str();
-                boost::uint32_t len = htonl(msg.length());
-                m_os->write( (char*)&len, 4 );
-                m_os->write( msg.data(), msg.length() );
-                *m_os << flush;
+                json_spirit::Object o;
+                o.push_back( json_spirit::Pair("_msgtype", "cancel") );
+                o.push_back( json_spirit::Pair("qid", cancel) );
+                send( o );
+                continue;
             }
+            if(!rq) continue;
+            if(rq->finished())
+            {
+                // solved or cancelled while queued, don't bother the script
+                m_pap->report_skipped( rq->id() );
+                continue;
+            }
+            // dispatch query to script:
+            //cout << "Got " << rq->str() << endl;
+            send( rq->get_json_str() );
+            rq->on_solved( boost::bind(&rs_script::query_solved, this, _1) );
         }
     }
     catch(...)
@@ -166,6 +187,35 @@ rs_script::run()
     cout << "rs_script dispatch runner ending" << endl;
 }
 
+/// write a message to the script. only from the dispatcher thread.
+void
+rs_script::send(const json_spirit::Object& o)
+{
+    send( json_spirit::write( o ) );
+}
+
+/// write an already serialized message, queries come with theirs cached.
+void
+rs_script::send(const string& msg)
+{
+    boost::uint32_t len = htonl(msg.length());
+    m_os->write( (char*)&len, 4 );
+    m_os->write( msg.data(), msg.length() );
+    *m_os << flush;
+}
+
+/// a query we gave the script is solved, the dispatcher tells it so.
+void
+rs_script::query_solved(const query_uid& qid)
+{
+    if(m_dead || m_exiting) return;
+    {
+        boost::mutex::scoped_lock lk(m_mutex);
+        m_cancels.push_back( qid );
+    }
+    m_cond.notify_one();
+}
+
 
 void
 rs_script::init_worker()
@@ -298,11 +348,20 @@ rs_script::process_output()
                 //write_formatted(  pip->get_json(), cout );
 
                 if (pip->id().length() == 0) {
-                    pip->set_id( m_pap->gen_uuid() );
+                    pip->set_id( m_pap->gen_sid() );
                 }
                 v.push_back( pip->get_json() );
             }
             m_pap->report_results( qid, v );
+            continue;
+        }
+        
+        // script has finished with a query, with or without results:
+        if( msgtype == "done" &&
+            rr.find("qid") != rr.end() && 
+            rr["qid"].type() == str_type )
+        {
+            m_pap->report_done( rr["qid"].get_str() );
         }   
     }
     cout << "Gateway plugin read loop exited" << endl;
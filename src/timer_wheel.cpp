@@ -0,0 +1,218 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "playdar/timer_wheel.h"
+
+#include <iostream>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+namespace playdar {
+
+TimerWheel::TimerWheel( boost::asio::io_service & ios, unsigned int tick_ms )
+    : m_ios( ios ),
+      m_timer( ios ),
+      m_tick_ms( tick_ms ? tick_ms : 1 ),
+      m_epoch( boost::posix_time::microsec_clock::universal_time() ),
+      m_current( 0 ),
+      m_count( 0 ),
+      m_running( false )
+{
+    m_levels[0].resize( 1 << L0_BITS );
+    for( unsigned int l = 1; l < LEVELS; ++l )
+        m_levels[l].resize( 1 << LN_BITS );
+}
+
+TimerWheel::handle
+TimerWheel::schedule( unsigned int delay_ms, callback_t cb )
+{
+    handle h( new Entry );
+    h->m_cb = cb;
+    // we're somewhere inside the current tick, so add one to never fire early:
+    unsigned long long ticks = ( delay_ms + m_tick_ms - 1 ) / m_tick_ms + 1;
+
+    boost::mutex::scoped_lock lk( m_mut );
+    unsigned long long now = ticks_now();
+    if( !m_running && now > m_current )
+    {
+        // wheel was empty and stopped, catch up with the clock first:
+        m_current = now;
+    }
+    h->m_expires = ( now > m_current ? now : m_current ) + ticks;
+    insert( h );
+    ++m_count;
+    if( !m_running ) start_ticking();
+    return h;
+}
+
+void
+TimerWheel::cancel( const handle & h )
+{
+    if( !h ) return;
+    boost::mutex::scoped_lock lk( m_mut );
+    h->m_cancelled = true;
+    // drop whatever the callback holds on to now, not when we reach the slot:
+    h->m_cb = callback_t();
+}
+
+size_t
+TimerWheel::size() const
+{
+    boost::mutex::scoped_lock lk( m_mut );
+    return m_count;
+}
+
+/// put entry in the right slot for its expiry, relative to m_current.
+/// caller holds m_mut.
+void
+TimerWheel::insert( const handle & h )
+{
+    unsigned long long exp = h->m_expires;
+    unsigned long long delta = exp > m_current ? exp - m_current : 0;
+    if( delta < (1ULL << L0_BITS) )
+    {
+        m_levels[0][ exp & ((1 << L0_BITS) - 1) ].push_back( h );
+        return;
+    }
+    for( unsigned int l = 1; l < LEVELS; ++l )
+    {
+        unsigned int shift = L0_BITS + LN_BITS * (l-1);
+        unsigned long long span = 1ULL << (shift + LN_BITS);
+        if( delta < span || l == LEVELS-1 )
+        {
+            // too far out for the top level, park it as far away as we can,
+            // it gets re-slotted when that slot cascades:
+            if( delta >= span ) exp = m_current + span - 1;
+            m_levels[l][ (exp >> shift) & ((1 << LN_BITS) - 1) ].push_back( h );
+            return;
+        }
+    }
+}
+
+/// move everything in the current slot of this level down the wheel.
+/// caller holds m_mut.
+void
+TimerWheel::cascade( unsigned int level )
+{
+    unsigned int shift = L0_BITS + LN_BITS * (level-1);
+    slot_t entries;
+    entries.swap( m_levels[level][ (m_current >> shift) & ((1 << LN_BITS) - 1) ] );
+    BOOST_FOREACH( const handle & h, entries )
+    {
+        if( h->m_cancelled )
+            --m_count;
+        else
+            insert( h );
+    }
+}
+
+/// turn the wheel by one tick, collecting callbacks that are due.
+/// caller holds m_mut.
+void
+TimerWheel::advance( vector< callback_t > & fire )
+{
+    ++m_current;
+    for( unsigned int l = 1; l < LEVELS; ++l )
+    {
+        unsigned int shift = L0_BITS + LN_BITS * (l-1);
+        if( m_current & ((1ULL << shift) - 1) ) break;
+        cascade( l );
+    }
+    slot_t entries;
+    entries.swap( m_levels[0][ m_current & ((1 << L0_BITS) - 1) ] );
+    BOOST_FOREACH( const handle & h, entries )
+    {
+        if( h->m_cancelled )
+        {
+            --m_count;
+        }
+        else if( h->m_expires > m_current )
+        {
+            insert( h ); // was parked, not due yet
+        }
+        else
+        {
+            --m_count;
+            fire.push_back( h->m_cb );
+            h->m_cb = callback_t();
+            h->m_cancelled = true; // fired, so cancel() is a no-op
+        }
+    }
+}
+
+/// caller holds m_mut
+void
+TimerWheel::start_ticking()
+{
+    m_running = true;
+    // the deadline_timer is only ever touched from the io_service thread:
+    m_ios.post( boost::bind( &TimerWheel::on_tick, this,
+                             boost::system::error_code() ) );
+}
+
+void
+TimerWheel::on_tick( const boost::system::error_code & e )
+{
+    if( e ) return; // aborted
+    while( true )
+    {
+        vector< callback_t > fire;
+        {
+            boost::mutex::scoped_lock lk( m_mut );
+            if( m_current >= ticks_now() )
+            {
+                if( m_count == 0 )
+                {
+                    m_running = false;
+                }
+                else
+                {
+                    m_timer.expires_at( m_epoch +
+                        boost::posix_time::milliseconds( (m_current+1) * m_tick_ms ) );
+                    m_timer.async_wait( boost::bind( &TimerWheel::on_tick, this,
+                                        boost::asio::placeholders::error ) );
+                }
+                return;
+            }
+            advance( fire );
+        }
+        BOOST_FOREACH( const callback_t & cb, fire )
+        {
+            try
+            {
+                cb();
+            }
+            catch( const std::exception & ex )
+            {
+                cerr << "TimerWheel callback threw: " << ex.what() << endl;
+            }
+        }
+    }
+}
+
+unsigned long long
+TimerWheel::ticks_now() const
+{
+    boost::posix_time::time_duration d =
+        boost::posix_time::microsec_clock::universal_time() - m_epoch;
+    return d.total_milliseconds() / m_tick_ms;
+}
+
+} // ns
@@ -0,0 +1,101 @@
+#include "playdar/utils/id_gen.h"
+#include "playdar/utils/uuid.h"
+
+#include <boost/cstdint.hpp>
+
+namespace playdar {
+namespace utils { 
+
+static const char digits[] = 
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static const unsigned int base = 62;
+
+/// 64 random bits, from the hex digits of a uuid. skips the version 
+/// digit (and what follows it) so they're all random.
+static boost::uint64_t random64()
+{
+    std::string u = uuid_gen()();
+    boost::uint64_t r = 0;
+    int bits = 0;
+    for( size_t i = 0; i < u.length() && bits < 64; ++i )
+    {
+        char c = u[i];
+        if( c == '-' || i == 14 || i == 19 ) continue;
+        int v = ( c >= '0' && c <= '9' ) ? c - '0' : ( c | 0x20 ) - 'a' + 10;
+        r = ( r << 4 ) | ( v & 0xf );
+        bits += 4;
+    }
+    return r;
+}
+
+static void append62( std::string& s, boost::uint64_t n, int width )
+{
+    char buf[16];
+    int len = 0;
+    do
+    {
+        buf[len++] = digits[ n % base ];
+        n /= base;
+    } while( n || len < width );
+    s.append( buf, len );
+}
+
+#define ROTL64( x, b ) ( ( (x) << (b) ) | ( (x) >> ( 64 - (b) ) ) )
+#define SIPROUND \
+    do { \
+        v0 += v1; v1 = ROTL64( v1, 13 ); v1 ^= v0; v0 = ROTL64( v0, 32 ); \
+        v2 += v3; v3 = ROTL64( v3, 16 ); v3 ^= v2; \
+        v0 += v3; v3 = ROTL64( v3, 21 ); v3 ^= v0; \
+        v2 += v1; v1 = ROTL64( v1, 17 ); v1 ^= v2; v2 = ROTL64( v2, 32 ); \
+    } while( 0 )
+
+/// SipHash-2-4 of the one 8 byte word m, keyed with k0,k1.
+static boost::uint64_t siphash( boost::uint64_t k0, boost::uint64_t k1, boost::uint64_t m )
+{
+    boost::uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    boost::uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    boost::uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    boost::uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    v3 ^= m;
+    SIPROUND; SIPROUND;
+    v0 ^= m;
+    const boost::uint64_t b = (boost::uint64_t) 8 << 56; // length, no tail
+    v3 ^= b;
+    SIPROUND; SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND; SIPROUND; SIPROUND; SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+#undef ROTL64
+
+// use it like:
+// id_gen gen;
+// string val = gen();
+
+id_gen::id_gen()
+    : m_k0( random64() ), m_k1( random64() ), m_count( 0 )
+{
+    // 11 digits covers 64 bits:
+    append62( m_prefix, random64(), 11 );
+}
+
+std::string id_gen::operator()()
+{
+    boost::uint64_t n;
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        n = ++m_count;
+    }
+    std::string s;
+    s.reserve( m_prefix.length() + 8 + 11 );
+    s = m_prefix;
+    append62( s, n, 1 );
+    // the counter keeps them unique, this keeps them unguessable:
+    append62( s, siphash( m_k0, m_k1, n ), 11 );
+    return s;
+}
+
+}} // ns
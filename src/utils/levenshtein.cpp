@@ -1,8 +1,15 @@
 #include "playdar/utils/levenshtein.h"
 
+#include <boost/cstdint.hpp>
+
 namespace playdar { namespace utils {
 
-int levenshtein(const std::string & source, const std::string & target) 
+// strings up to this many 64 char blocks go through the bit-parallel
+// version, with everything on the stack:
+static const int max_blocks = 4;
+
+// the original dynamic programming version, for anything longer.
+static int levenshtein_dp(const std::string & source, const std::string & target)
 {
   // Step 1
   const int n = source.length();
@@ -14,7 +21,7 @@ int levenshtein(const std::string & source, const std::string & target)
     return n;
   }
   // Good form to declare a TYPEDEF
-  typedef std::vector< std::vector<int> > Tmatrix; 
+  typedef std::vector< std::vector<int> > Tmatrix;
   Tmatrix matrix(n+1);
   // Size the vectors in the 2.nd dimension. Unfortunately C++ doesn't
   // allow for allocation on declaration of 2.nd dimension of vec of vec
@@ -51,7 +58,7 @@ int levenshtein(const std::string & source, const std::string & target)
       if(above+1 < cell) cell = above+1;
       // Step 6A: Cover transposition, in addition to deletion,
       // insertion and substitution. This step is taken from:
-      // Berghel, Hal ; Roach, David : "An Extension of Ukkonen's 
+      // Berghel, Hal ; Roach, David : "An Extension of Ukkonen's
       // Enhanced Dynamic Programming ASM Algorithm"
       // (http://www.acm.org/~hlb/publications/asm/asm.html)
       if (i>2 && j>2) {
@@ -67,4 +74,110 @@ int levenshtein(const std::string & source, const std::string & target)
   return matrix[n][m];
 }
 
+// Myers' bit-vector algorithm, with Hyyro's extension for transpositions
+// ("A Bit-Vector Algorithm for Computing Levenshtein and Damerau Edit
+// Distances", 2003), split in to 64 bit blocks as in Myers' paper.
+// Bit i-1 of each vector is row i of the DP matrix above, one column
+// (char of target) is done per step, vertical deltas carried between
+// columns and horizontal ones between blocks.
+//
+// The DP version only counts a transposition once it's past the first two
+// chars of both strings (i>2 && j>2), so this does the same: no
+// transposition for row 2, or for the first two columns.
+static int levenshtein_bits(const std::string & source, const std::string & target,
+                            int max_dist)
+{
+  typedef boost::uint64_t word;
+  const int n = source.length();
+  const int m = target.length();
+  const int blocks = (n + 63) / 64;
+  const word last_bit = (word)1 << ((n - 1) % 64);
+
+  // peq[c][b]: bits of block b set where source has char c.
+  // only entries we read (target's chars) need clearing.
+  word peq[256][max_blocks];
+  for (int j = 0; j < m; j++) {
+    word * p = peq[(unsigned char)target[j]];
+    for (int b = 0; b < blocks; b++) p[b] = 0;
+  }
+  for (int i = 0; i < n; i++) {
+    word * p = peq[(unsigned char)source[i]];
+    p[i / 64] |= (word)1 << (i % 64);
+  }
+
+  word vp[max_blocks], vn[max_blocks], d0[max_blocks], pm_prev[max_blocks];
+  for (int b = 0; b < blocks; b++) {
+    vp[b] = ~(word)0;
+    vn[b] = 0;
+    d0[b] = 0;
+    pm_prev[b] = 0;
+  }
+  int score = n;
+
+  for (int j = 0; j < m; j++) {
+    const word * pm = peq[(unsigned char)target[j]];
+    // horizontal delta coming in to the top of block 0, row 0 is 0,1,2..
+    int hin = 1;
+    // bit carried up in to the next block's transposition vector:
+    word tr_carry = 0;
+    for (int b = 0; b < blocks; b++) {
+      word eq = pm[b];
+      word tr = 0;
+      if (j > 1) {
+        word t = ~d0[b] & eq;
+        tr = ((t << 1) | tr_carry) & pm_prev[b];
+        tr_carry = t >> 63;
+        if (b == 0) tr &= ~(word)2;
+      }
+      pm_prev[b] = eq;
+
+      word xv = eq | vn[b] | tr;
+      if (hin < 0) eq |= 1;
+      word xh = (((eq & vp[b]) + vp[b]) ^ vp[b]) | eq | tr;
+      d0[b] = xh | xv;
+
+      word hp = vn[b] | ~(xh | vp[b]);
+      word hn = vp[b] & xh;
+      if (b == blocks - 1) {
+        if (hp & last_bit) score++;
+        else if (hn & last_bit) score--;
+      }
+      int hout = (hp >> 63) ? 1 : (hn >> 63) ? -1 : 0;
+      hp <<= 1;
+      hn <<= 1;
+      if (hin < 0) hn |= 1;
+      else if (hin > 0) hp |= 1;
+      vp[b] = hn | ~(xv | hp);
+      vn[b] = hp & xv;
+      hin = hout;
+    }
+    // each column left can only take one off the final distance:
+    if (max_dist >= 0 && score - (m - j - 1) > max_dist) {
+      return max_dist + 1;
+    }
+  }
+  return score;
+}
+
+int levenshtein(const std::string & source, const std::string & target, int max_dist)
+{
+  // it's symmetric, and cheapest with the shorter one down the side:
+  if (source.length() > target.length()) {
+    return levenshtein(target, source, max_dist);
+  }
+  const int n = source.length();
+  const int m = target.length();
+  if (max_dist >= 0 && m - n > max_dist) {
+    return max_dist + 1;
+  }
+  if (n == 0) {
+    return m;
+  }
+  if (n > 64 * max_blocks) {
+    int d = levenshtein_dp(source, target);
+    return (max_dist >= 0 && d > max_dist) ? max_dist + 1 : d;
+  }
+  return levenshtein_bits(source, target, max_dist);
+}
+
 }}
@@ -0,0 +1,190 @@
+#include "playdar/utils/normalize.h"
+
+namespace playdar { namespace utils {
+
+// what each ASCII char becomes: itself, lower cased, 0 to drop it,
+// or ' ' to separate words.
+static const char ascii_map[128] = {
+    /* 00 */ ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+    /* 10 */ ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+    /* 20 */ ' ', ' ', ' ', '#', '$', '%', '&', 0,   ' ', ' ', '*', '+', ' ', ' ', 0,   ' ',
+    /* 30 */ '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', ' ', ' ', ' ', '=', ' ', ' ',
+    /* 40 */ '@', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    /* 50 */ 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', ' ', ' ', ' ', ' ', ' ',
+    /* 60 */ 0,   'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    /* 70 */ 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', ' ', ' ', ' ', ' ', ' ',
+};
+
+// the same for U+00A0 to U+017F, Latin-1 and Latin Extended-A, as strings
+// since some are more than one char (æ -> ae). 0 means pass it through.
+static const char * const latin_map[0x180 - 0xA0] = {
+    /* 00A0 */ " ", " ", " ", " ", " ", " ", " ", " ", "",  " ", "a", " ", " ", "",  " ", "",
+    /* 00B0 */ " ", " ", "2", "3", "",  0,   " ", " ", "",  "1", "o", " ", " ", " ", " ", " ",
+    /* 00C0 */ "a", "a", "a", "a", "a", "a", "ae","c", "e", "e", "e", "e", "i", "i", "i", "i",
+    /* 00D0 */ "d", "n", "o", "o", "o", "o", "o", " ", "o", "u", "u", "u", "u", "y", "th","ss",
+    /* 00E0 */ "a", "a", "a", "a", "a", "a", "ae","c", "e", "e", "e", "e", "i", "i", "i", "i",
+    /* 00F0 */ "d", "n", "o", "o", "o", "o", "o", " ", "o", "u", "u", "u", "u", "y", "th","y",
+    /* 0100 */ "a", "a", "a", "a", "a", "a", "c", "c", "c", "c", "c", "c", "c", "c", "d", "d",
+    /* 0110 */ "d", "d", "e", "e", "e", "e", "e", "e", "e", "e", "e", "e", "g", "g", "g", "g",
+    /* 0120 */ "g", "g", "g", "g", "h", "h", "h", "h", "i", "i", "i", "i", "i", "i", "i", "i",
+    /* 0130 */ "i", "i", "ij","ij","j", "j", "k", "k", "k", "l", "l", "l", "l", "l", "l", "l",
+    /* 0140 */ "l", "l", "l", "n", "n", "n", "n", "n", "n", "n", "n", "n", "o", "o", "o", "o",
+    /* 0150 */ "o", "o", "oe","oe","r", "r", "r", "r", "r", "r", "s", "s", "s", "s", "s", "s",
+    /* 0160 */ "s", "s", "t", "t", "t", "t", "t", "t", "u", "u", "u", "u", "u", "u", "u", "u",
+    /* 0170 */ "u", "u", "u", "u", "w", "w", "y", "y", "y", "z", "z", "z", "z", "z", "z", "s",
+};
+
+// builds the output, putting a single space between words.
+namespace {
+struct writer
+{
+    writer(std::string & o) : out(o), space(false) {}
+    void put(char c)
+    {
+        if (c == ' ') {
+            space = true;
+            return;
+        }
+        if (space && !out.empty()) out += ' ';
+        space = false;
+        out += c;
+    }
+    void put(const char * s)
+    {
+        for (; *s; ++s) put(*s);
+    }
+    void put(const char * s, size_t len)
+    {
+        if (space && !out.empty()) out += ' ';
+        space = false;
+        out.append(s, len);
+    }
+    // a two byte code point, U+0080 to U+07FF
+    void put_utf8(unsigned int cp)
+    {
+        char b[2];
+        b[0] = (char)(0xC0 | (cp >> 6));
+        b[1] = (char)(0x80 | (cp & 0x3F));
+        put(b, 2);
+    }
+    std::string & out;
+    bool space;
+};
+}
+
+// length of the UTF-8 sequence at s (which has n bytes left), and its
+// code point. 0 if it isn't a valid one.
+static int decode(const unsigned char * s, size_t n, unsigned int & cp)
+{
+    int len;
+    if ((s[0] & 0xE0) == 0xC0) { len = 2; cp = s[0] & 0x1F; }
+    else if ((s[0] & 0xF0) == 0xE0) { len = 3; cp = s[0] & 0x0F; }
+    else if ((s[0] & 0xF8) == 0xF0) { len = 4; cp = s[0] & 0x07; }
+    else return 0;
+    if ((size_t)len > n) return 0;
+    for (int i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    return len;
+}
+
+// fold one non-ASCII code point in to w. false if it stays as it is.
+static bool fold(unsigned int cp, writer & w)
+{
+    if (cp >= 0xA0 && cp < 0x180) {
+        const char * m = latin_map[cp - 0xA0];
+        if (!m) return false;
+        w.put(m);
+    } else if (cp >= 0x300 && cp < 0x370) {
+        // combining accents, from decomposed input
+    } else if (cp >= 0x391 && cp <= 0x3A9 && cp != 0x3A2) {
+        w.put_utf8(cp + 0x20); // Greek capitals
+    } else if (cp == 0x401 || cp == 0x451) {
+        w.put_utf8(0x435); // Cyrillic yo, without its diaeresis
+    } else if (cp >= 0x400 && cp < 0x410) {
+        w.put_utf8(cp + 0x50); // Cyrillic capitals..
+    } else if (cp >= 0x410 && cp < 0x430) {
+        w.put_utf8(cp + 0x20);
+    } else if (cp >= 0x2000 && cp < 0x2070) {
+        // general punctuation: curly apostrophes and primes go, like ',
+        // the rest (spaces, dashes, quotes..) separate words
+        if (cp != 0x2018 && cp != 0x2019 && cp != 0x201B && cp != 0x2032)
+            w.put(' ');
+    } else if (cp >= 0xFF01 && cp <= 0xFF5E) {
+        char c = ascii_map[cp - 0xFF00 + 0x20]; // fullwidth ASCII
+        if (c) w.put(c);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// cut "the" off the start or end, and anything from "feat" on.
+static void strip_words(std::string & out, int flags)
+{
+    if (flags & NORMALIZE_FEAT) {
+        static const char * const feat[] = { " feat ", " ft ", " featuring ", 0 };
+        std::string padded = out + " ";
+        for (int i = 0; feat[i]; i++) {
+            size_t p = padded.find(feat[i]);
+            if (p != std::string::npos) {
+                out.erase(p);
+                padded.erase(p);
+            }
+        }
+    }
+    if (flags & NORMALIZE_THE) {
+        if (out.length() > 4 && out.compare(0, 4, "the ") == 0)
+            out.erase(0, 4);
+        else if (out.length() > 4 && out.compare(out.length() - 4, 4, " the") == 0)
+            out.erase(out.length() - 4);
+    }
+}
+
+void normalize(const std::string & in, std::string & out, int flags)
+{
+    out.clear();
+    out.reserve(in.length());
+    writer w(out);
+    const unsigned char * s = (const unsigned char *) in.data();
+    const size_t n = in.length();
+    for (size_t i = 0; i < n; ) {
+        if (s[i] < 0x80) {
+            // fast path, most names are all ASCII:
+            char c = ascii_map[s[i++]];
+            if (c) w.put(c);
+            continue;
+        }
+        unsigned int cp;
+        int len = decode(s + i, n - i, cp);
+        if (len == 0) {
+            // not UTF-8, leave the byte alone
+            w.put((const char *) s + i, 1);
+            i++;
+            continue;
+        }
+        if (!fold(cp, w)) w.put((const char *) s + i, len);
+        i += len;
+    }
+    if (out.empty() && !in.empty()) {
+        // all punctuation, keep it so it doesn't match every other one:
+        for (size_t i = 0; i < n; i++) {
+            char c = in[i];
+            if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+            else if (c > 0 && c <= ' ') c = ' ';
+            w.put(c);
+        }
+        return;
+    }
+    if (flags) strip_words(out, flags);
+}
+
+std::string normalize(const std::string & in, int flags)
+{
+    std::string out;
+    normalize(in, out, flags);
+    return out;
+}
+
+}}
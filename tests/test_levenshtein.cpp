@@ -0,0 +1,153 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the bit-parallel levenshtein against the original DP version it
+// replaced. Both are static, so the source is included to get at them.
+#include "../src/utils/levenshtein.cpp"
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using namespace playdar::utils;
+
+static int failures = 0;
+
+static void check( const string& s, const string& t )
+{
+    // levenshtein() puts the shorter one down the side, and so do we:
+    const string& a = s.length() <= t.length() ? s : t;
+    const string& b = s.length() <= t.length() ? t : s;
+    int want = levenshtein_dp( a, b );
+    // levenshtein_bits only takes up to max_blocks, it's DP after that:
+    int got = a.empty() || a.length() > 64 * max_blocks 
+        ? want : levenshtein_bits( a, b, -1 );
+    if( got != want || levenshtein( s, t ) != want )
+    {
+        if( ++failures <= 20 )
+            cerr << "FAIL \"" << s << "\" \"" << t << "\": dp " << want 
+                 << " bits " << got << " levenshtein " << levenshtein( s, t ) << endl;
+        return;
+    }
+    // levenshtein_bits itself takes them either way round:
+    if( !a.empty() && b.length() <= 64 * max_blocks &&
+        levenshtein_bits( b, a, -1 ) != levenshtein_dp( b, a ) )
+    {
+        if( ++failures <= 20 )
+            cerr << "FAIL \"" << b << "\" \"" << a << "\": dp " << levenshtein_dp( b, a ) 
+                 << " bits " << levenshtein_bits( b, a, -1 ) << endl;
+        return;
+    }
+    // the early out: anything over max_dist comes back as max_dist+1.
+    // every max_dist for small distances, either side of it for big ones:
+    for( int k = 0; k <= want + 1; k = ( k < 8 || k >= want - 2 ) ? k + 1 : want - 2 )
+    {
+        int e = want > k ? k + 1 : want;
+        int r = levenshtein( s, t, k );
+        if( r != e && ++failures <= 20 )
+            cerr << "FAIL \"" << s << "\" \"" << t << "\" max_dist " << k
+                 << ": got " << r << " want " << e << endl;
+    }
+}
+
+static string random_string( int len, int alphabet )
+{
+    string s;
+    for( int i = 0; i < len; ++i ) s += (char)( 'a' + rand() % alphabet );
+    return s;
+}
+
+int main()
+{
+    // every pair of strings over "abc" up to 4 chars, and over "ab" up
+    // to 7. small alphabets have lots of transpositions, including in row
+    // and column 2, where the DP version doesn't count them (i>2 && j>2)
+    // and so neither does levenshtein_bits (tr &= ~2, and j > 1). one
+    // there can never beat matching the second char and an insert 
+    // anyway, so this passes with or without those; it keeps it that way:
+    size_t exhaustive = 0;
+    for( int alphabet = 2; alphabet <= 3; ++alphabet )
+    {
+        vector<string> all( 1, string() );
+        for( size_t i = 0; i < all.size(); ++i )
+        {
+            if( (int) all[i].length() == ( alphabet == 2 ? 7 : 4 ) ) continue;
+            for( char c = 'a'; c < 'a' + alphabet; ++c ) all.push_back( all[i] + c );
+        }
+        for( size_t i = 0; i < all.size(); ++i )
+            for( size_t j = 0; j < all.size(); ++j )
+                check( all[i], all[j] );
+        exhaustive += all.size() * all.size();
+    }
+    cout << "exhaustive: " << exhaustive << " pairs" << endl;
+
+    // transpositions across the 64 char block boundaries, carried in 
+    // to the next block:
+    for( int blk = 1; blk < max_blocks; ++blk )
+    {
+        for( int at = 64 * blk - 3; at <= 64 * blk + 1; ++at )
+        {
+            string s = random_string( 64 * blk + 20, 4 );
+            string t = s;
+            s[at] = 'x'; s[at+1] = 'y';
+            t[at] = 'y'; t[at+1] = 'x';
+            check( s, t );
+            check( s, t + "q" );
+            check( s.substr( 1 ), t );
+        }
+    }
+
+    // random pairs either side of each block size, and past max_blocks
+    // where it falls back to the DP version:
+    srand( 1 );
+    int pairs = 0;
+    for( int len = 1; len <= 64 * max_blocks + 70; len += ( len < 20 ? 1 : 7 ) )
+    {
+        for( int k = 0; k < 40; ++k, ++pairs )
+        {
+            int alphabet = 2 + k % 4;
+            string s = random_string( len, alphabet );
+            // mostly near misses, made by editing s:
+            string t = s;
+            int edits = rand() % 6;
+            for( int e = 0; e < edits && t.length() > 1; ++e )
+            {
+                size_t p = rand() % ( t.length() - 1 );
+                switch( rand() % 4 )
+                {
+                    case 0: t[p] = 'a' + rand() % alphabet; break;
+                    case 1: t.erase( p, 1 ); break;
+                    case 2: t.insert( p, 1, 'a' + rand() % alphabet ); break;
+                    case 3: swap( t[p], t[p+1] ); break;
+                }
+            }
+            if( k % 5 == 0 ) t = random_string( len + rand() % 10, alphabet );
+            check( s, t );
+        }
+    }
+    cout << "random: " << pairs << " pairs" << endl;
+
+    if( failures )
+    {
+        cerr << failures << " failures" << endl;
+        return 1;
+    }
+    cout << "OK" << endl;
+    return 0;
+}
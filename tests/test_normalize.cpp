@@ -0,0 +1,203 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Pins down what utils::normalize makes of names. Sortnames in existing
+// collection dbs were written by it (and rewritten by the schema 2->3
+// upgrade), so any change here stops queries matching them until the
+// library is rescanned.
+
+#include "playdar/utils/normalize.h"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+using namespace std;
+using namespace playdar::utils;
+
+static int failures = 0;
+
+// non-ASCII bytes as \xNN, so failures are readable whatever the terminal
+static string show( const string& s )
+{
+    string r;
+    for( size_t i = 0; i < s.length(); ++i )
+    {
+        unsigned char c = s[i];
+        if( c >= 0x20 && c < 0x7F ) { r += c; continue; }
+        char b[8];
+        sprintf( b, "\\x%02x", c );
+        r += b;
+    }
+    return "\"" + r + "\"";
+}
+
+static void check( const string& in, int flags, const string& want )
+{
+    string got = normalize( in, flags );
+    // the version that reuses a buffer must agree, whatever was in it:
+    string reused = "leftovers";
+    normalize( in, reused, flags );
+    if( got != want || reused != want )
+    {
+        if( ++failures <= 20 )
+            cerr << "FAIL " << show( in ) << " flags " << flags << ": got " 
+                 << show( got ) << " want " << show( want ) << endl;
+    }
+}
+
+static void check( const string& in, const string& want )
+{
+    check( in, 0, want );
+}
+
+// UTF-8 for a code point, up to U+FFFF
+static string utf8( unsigned int cp )
+{
+    string s;
+    if( cp < 0x80 ) s += (char) cp;
+    else if( cp < 0x800 )
+    {
+        s += (char)( 0xC0 | ( cp >> 6 ) );
+        s += (char)( 0x80 | ( cp & 0x3F ) );
+    }
+    else
+    {
+        s += (char)( 0xE0 | ( cp >> 12 ) );
+        s += (char)( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+        s += (char)( 0x80 | ( cp & 0x3F ) );
+    }
+    return s;
+}
+
+int main()
+{
+    // ASCII: case, dropped punctuation, word separators
+    check( "R.E.M.", "rem" );
+    check( "Guns N' Roses", "guns n roses" );
+    check( "AC/DC", "ac dc" );
+    check( "  Massive\t\tAttack \n", "massive attack" );
+    check( "Sigur Ros - Hoppipolla", "sigur ros hoppipolla" );
+    check( "Mr. Scruff", "mr scruff" );
+    check( "Salt-N-Pepa", "salt n pepa" );
+    check( "#1 Crush", "#1 crush" );
+    check( "$ & % @ + = *", "$ & % @ + = *" );
+    check( "`quoted'", "quoted" );
+    check( "", "" );
+    check( "   ", "" );      // nothing but whitespace is nothing
+
+    // all punctuation: kept, so "!!!" doesn't match every other such name
+    check( "!!!", "!!!" );
+    check( "  ?!  ", "?!" );
+    check( "...", "..." );
+    check( "(( ))", "(( ))" );
+    check( "!\t\t!", "! !" );
+
+    // Latin-1 and Latin Extended-A
+    check( "Sigur R\xc3\xb3s", "sigur ros" );
+    check( "MOT\xc3\x96RHEAD", "motorhead" );
+    check( "Mot\xc3\xb6rhead", "motorhead" );
+    check( "Bj\xc3\xb6rk", "bjork" );
+    check( "Stra\xc3\x9f" "e", "strasse" );
+    check( "\xc3\x86sop", "aesop" );
+    check( "\xc3\x98ystein", "oystein" );
+    check( "\xc3\x9e\xc3\xb3r", "thor" );
+    check( "\xc5\x81\xc3\xb3" "d\xc5\xba", "lodz" );
+    check( "\xc5\x92uvre", "oeuvre" );
+    check( "caf\xc3\xa9\xc2\xa0" "del mar", "cafe del mar" );   // nbsp
+    check( "\xc2\xbf" "Qu\xc3\xa9?", "que" );
+    check( "Dvo\xc5\x99\xc3\xa1k", "dvorak" );
+
+    // decomposed accents, the way some taggers write them
+    check( "Beyonce\xcc\x81", "beyonce" );
+    check( normalize( "Beyonce\xcc\x81" ), normalize( "Beyonc\xc3\xa9" ) );
+    check( "Mo\xcc\x88tley Cru\xcc\x88" "e", "motley crue" );
+
+    // general punctuation: curly apostrophes go, the rest separate words
+    check( "Don\xe2\x80\x99t Stop", "dont stop" );
+    check( "\xe2\x80\x9cHello\xe2\x80\x9d", "hello" );
+    check( "Rock\xe2\x80\x94Roll", "rock roll" );
+
+    // fullwidth ASCII
+    check( "\xef\xbc\xa1\xef\xbc\xa2\xef\xbc\xa3", "abc" );
+    check( "\xef\xbc\xb2\xef\xbc\x8e\xef\xbc\xa5\xef\xbc\x8e\xef\xbc\xad\xef\xbc\x8e", "rem" );
+
+    // Greek and Cyrillic are case folded
+    check( "\xce\x91\xce\x92\xce\x93", "\xce\xb1\xce\xb2\xce\xb3" );
+    check( "\xd0\x81\xd0\x9b\xd0\x9a\xd0\x90", "\xd0\xb5\xd0\xbb\xd0\xba\xd0\xb0" );
+    check( "\xd0\x84", "\xd1\x94" );
+
+    // other scripts pass through as they are
+    check( "\xe6\x9d\xb1\xe4\xba\xac", "\xe6\x9d\xb1\xe4\xba\xac" );
+    check( "\xe6\x9d\xb1 \xe4\xba\xac!", "\xe6\x9d\xb1 \xe4\xba\xac" );
+
+    // invalid UTF-8 is passed through a byte at a time
+    check( "caf\xc3", "caf\xc3" );
+    check( "\xff\xfe" "abc", "\xff\xfe" "abc" );
+    check( "A\x80" "B", "a\x80" "b" );
+    check( "\xc3(x", "\xc3 x" );
+
+    // NORMALIZE_THE
+    check( "The Beatles", NORMALIZE_THE, "beatles" );
+    check( "Beatles, The", NORMALIZE_THE, "beatles" );
+    check( "The Beatles", 0, "the beatles" );
+    check( "The The", NORMALIZE_THE, "the" );
+    check( "The", NORMALIZE_THE, "the" );
+    check( "Theatre of Tragedy", NORMALIZE_THE, "theatre of tragedy" );
+    check( "Bathe", NORMALIZE_THE, "bathe" );
+
+    // NORMALIZE_FEAT
+    check( "Song (feat. Someone)", NORMALIZE_FEAT, "song" );
+    check( "Song ft. Someone", NORMALIZE_FEAT, "song" );
+    check( "Song featuring Someone", NORMALIZE_FEAT, "song" );
+    check( "Song (feat. Someone)", 0, "song feat someone" );
+    check( "Feature Film", NORMALIZE_FEAT, "feature film" );
+    check( "Left Feat", NORMALIZE_FEAT, "left" );
+    check( "The Song feat. The Band", NORMALIZE_THE | NORMALIZE_FEAT, "song" );
+
+    // the ASCII fast path and the decoding path must agree: every
+    // printable ASCII char, against its fullwidth form, between words
+    int n = 0;
+    for( unsigned int c = 0x21; c < 0x7F; ++c, ++n )
+    {
+        string a = "ab" + string( 1, (char) c ) + "cd";
+        string b = "ab" + utf8( 0xFF00 + c - 0x20 ) + "cd";
+        check( b, normalize( a ) );
+        check( "x " + b + " y", normalize( "x " + a + " y" ) );
+    }
+    // and the no-break and other unicode spaces split words like ' ' does
+    check( "a" + utf8( 0xA0 ) + "b", normalize( "a b" ) );
+    check( "a" + utf8( 0x2003 ) + "b", normalize( "a b" ) );
+    cout << "fast path: " << n << " chars" << endl;
+
+    // normalizing twice changes nothing, so stored sortnames are stable
+    const char* names[] = { "R.E.M.", "Sigur R\xc3\xb3s", "MOT\xc3\x96RHEAD",
+        "Stra\xc3\x9f" "e", "Beyonce\xcc\x81", "!!!", "caf\xc3", 
+        "\xef\xbc\xa1\xef\xbc\xa2", "\xd0\x81\xd0\x9b\xd0\x9a\xd0\x90", 0 };
+    for( int i = 0; names[i]; ++i )
+        check( normalize( names[i] ), normalize( names[i] ) );
+
+    if( failures )
+    {
+        cerr << failures << " failures" << endl;
+        return 1;
+    }
+    cout << "OK" << endl;
+    return 0;
+}